@@ -55,15 +55,22 @@ type RspAdd struct {
 	Err string `json:"err"`
 }
 
+// ReqSearch searches the nearest vector above the db distance threshold by default.
+// K asks for top K vectors, DistThr asks for at most K (default 1) vectors above DistThr. K shall be in [0, SizeLimit].
 type ReqSearch struct {
-	DbID int       `json:"dbID"`
-	Xq   []float32 `json:"xq"`
+	DbID    int       `json:"dbID"`
+	Xq      []float32 `json:"xq"`
+	K       int       `json:"k,omitempty"`
+	DistThr *float32  `json:"distThr,omitempty"`
 }
 
+// RspSearch.Xid and RspSearch.Distance are the nearest result. RspSearch.Xids and RspSearch.Distances are all results of a K or DistThr search.
 type RspSearch struct {
-	Xid      uint64  `json:"xid"`
-	Distance float32 `json:"distance"`
-	Err      string  `json:"err"`
+	Xid       uint64    `json:"xid"`
+	Distance  float32   `json:"distance"`
+	Xids      []uint64  `json:"xids,omitempty"`
+	Distances []float32 `json:"distances,omitempty"`
+	Err       string    `json:"err"`
 }
 
 type ControllerConf struct {
@@ -74,6 +81,10 @@ type ControllerConf struct {
 	DisThr          float64
 	SizeLimit       int
 	BalanceInterval int
+	SlabMode        bool
+	Storage         string
+	Prefilter       bool
+	LocalDir        string
 
 	EurekaAddr string
 	EurekaApp  string
@@ -83,6 +94,9 @@ type Controller struct {
 	conf      *ControllerConf
 	rwlock    sync.RWMutex
 	dbls      map[int]*vectodb.VectoDBLite
+	releasing map[int]struct{}     // dbs being destroyed by release outside of rwlock
+	slab      *vectodb.VectoDBSlab // shared by dbls if conf.SlabMode
+	storage   int
 	hc        *http.Client
 	etcdCli   *clientv3.Client
 	isLeader  bool
@@ -102,6 +116,7 @@ func NewControllerConf() (conf *ControllerConf) {
 		DisThr:          0.9,
 		SizeLimit:       10000,
 		BalanceInterval: 60,
+		Storage:         "fp32",
 		EurekaAddr:      "http://127.0.0.1:8761/eureka",
 		EurekaApp:       "vectodblite-cluster",
 	}
@@ -109,10 +124,24 @@ func NewControllerConf() (conf *ControllerConf) {
 
 func NewController(conf *ControllerConf, ctx context.Context) (ctl *Controller) {
 	ctl = &Controller{
-		conf: conf,
-		dbls: make(map[int]*vectodb.VectoDBLite),
-		hc:   &http.Client{Timeout: time.Second * 5},
-		ctx:  ctx,
+		conf:      conf,
+		dbls:      make(map[int]*vectodb.VectoDBLite),
+		releasing: make(map[int]struct{}),
+		hc:        &http.Client{Timeout: time.Second * 5},
+		ctx:       ctx,
+	}
+	if conf.SlabMode {
+		ctl.slab = vectodb.NewVectoDBSlab(conf.Dim)
+	}
+	switch conf.Storage {
+	case "fp32":
+		ctl.storage = vectodb.StorageFP32
+	case "fp16":
+		ctl.storage = vectodb.StorageFP16
+	case "sq8":
+		ctl.storage = vectodb.StorageSQ8
+	default:
+		log.Fatalf("invalid storage %v", conf.Storage)
 	}
 	if err := ctl.initMgmt(); err != nil {
 		log.Fatalf("got error %+v", err)
@@ -180,6 +209,11 @@ func (ctl *Controller) HandleSearch(c *gin.Context) {
 		err = errors.Wrap(err, "")
 		log.Infof("failed to parse request body, error %+v", err)
 		c.String(http.StatusBadRequest, err.Error())
+	} else if reqSearch.K < 0 || reqSearch.K > ctl.conf.SizeLimit {
+		// A db never holds more than SizeLimit vectors. Result buffers are sized by K, so it's bounded before any allocation.
+		err = errors.Errorf("invalid k, want [0, %v], have %v", ctl.conf.SizeLimit, reqSearch.K)
+		log.Infof("failed to parse request body, error %+v", err)
+		c.String(http.StatusBadRequest, err.Error())
 	} else {
 		var rspSearch RspSearch
 		var dbl *vectodb.VectoDBLite
@@ -194,7 +228,27 @@ func (ctl *Controller) HandleSearch(c *gin.Context) {
 			//already return a response
 			return
 		}
-		rspSearch.Xid, rspSearch.Distance, err = dbl.Search(reqSearch.Xq)
+		// No more than Size vectors can be found.
+		k := reqSearch.K
+		if size := dbl.Size(); k > size {
+			k = size
+		}
+		if k <= 0 {
+			k = 1
+		}
+		if reqSearch.DistThr != nil {
+			rspSearch.Xids, rspSearch.Distances, err = dbl.SearchRange(reqSearch.Xq, *reqSearch.DistThr, k)
+		} else if reqSearch.K > 0 {
+			rspSearch.Xids, rspSearch.Distances, err = dbl.SearchK(reqSearch.Xq, k)
+		} else {
+			rspSearch.Xid, rspSearch.Distance, err = dbl.Search(reqSearch.Xq)
+		}
+		if reqSearch.DistThr != nil || reqSearch.K > 0 {
+			rspSearch.Xid = ^uint64(0)
+			if len(rspSearch.Xids) != 0 {
+				rspSearch.Xid, rspSearch.Distance = rspSearch.Xids[0], rspSearch.Distances[0]
+			}
+		}
 		if err != nil {
 			rspSearch.Err = err.Error()
 			log.Errorf("got error %+v", err)
@@ -209,6 +263,10 @@ func (ctl *Controller) getVectoDBLite(c *gin.Context, dbID int) (dbl *vectodb.Ve
 	if dbl, ok = ctl.dbls[dbID]; ok {
 		return
 	}
+	if _, ok = ctl.releasing[dbID]; ok {
+		err = errors.Errorf("vectodblite %d is being released", dbID)
+		return
+	}
 	var dstNodeAddr string
 	if ctl.isLeader {
 		ctx := c.Request.Context()
@@ -239,10 +297,8 @@ func (ctl *Controller) getVectoDBLite(c *gin.Context, dbID int) (dbl *vectodb.Ve
 		c.Redirect(http.StatusPermanentRedirect, dstURL.String())
 		return
 	}
-	var dblNew *vectodb.VectoDBLite
-	if dblNew, err = vectodb.NewVectoDBLite(ctl.conf.RedisAddr, dbID, ctl.conf.Dim, float32(ctl.conf.DisThr), ctl.conf.SizeLimit); err != nil {
-		return
-	}
+	// Create under the write lock so that concurrent first requests don't load the db twice, which would also
+	// clobber its tenant in the shared slab.
 	ctl.rwlock.RUnlock()
 	ctl.rwlock.Lock()
 	defer func() {
@@ -252,6 +308,24 @@ func (ctl *Controller) getVectoDBLite(c *gin.Context, dbID int) (dbl *vectodb.Ve
 	if dbl, ok = ctl.dbls[dbID]; ok {
 		return
 	}
+	if _, ok = ctl.releasing[dbID]; ok {
+		err = errors.Errorf("vectodblite %d is being released", dbID)
+		return
+	}
+	var dblNew *vectodb.VectoDBLite
+	opts := vectodb.VectoDBLiteOptions{
+		Slab:      ctl.slab,
+		Storage:   ctl.storage,
+		Prefilter: ctl.conf.Prefilter,
+	}
+	if ctl.conf.LocalDir != "" {
+		if opts.Store, err = vectodb.NewLiteLocalStore(ctl.conf.LocalDir, dbID); err != nil {
+			return
+		}
+	}
+	if dblNew, err = vectodb.NewVectoDBLiteWithOptions(ctl.conf.RedisAddr, dbID, ctl.conf.Dim, float32(ctl.conf.DisThr), ctl.conf.SizeLimit, opts); err != nil {
+		return
+	}
 	ctl.dbls[dbID] = dblNew
 	dbl = dblNew
 	return
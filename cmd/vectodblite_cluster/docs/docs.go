@@ -264,6 +264,12 @@ var doc = `{
                 "dbID": {
                     "type": "integer"
                 },
+                "distThr": {
+                    "type": "number"
+                },
+                "k": {
+                    "type": "integer"
+                },
                 "xq": {
                     "type": "array",
                     "items": {
@@ -314,11 +320,23 @@ var doc = `{
                 "distance": {
                     "type": "number"
                 },
+                "distances": {
+                    "type": "array",
+                    "items": {
+                        "type": "number"
+                    }
+                },
                 "err": {
                     "type": "string"
                 },
                 "xid": {
                     "type": "integer"
+                },
+                "xids": {
+                    "type": "array",
+                    "items": {
+                        "type": "integer"
+                    }
                 }
             }
         },
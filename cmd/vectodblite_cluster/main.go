@@ -45,6 +45,10 @@ func parseConfig() (conf *ControllerConf) {
 	flag.Float64Var(&conf.DisThr, "distance-threshold", conf.DisThr, "VectoDBLite distance threshold")
 	flag.IntVar(&conf.SizeLimit, "size-limit", conf.SizeLimit, "VectoDBLite size limit")
 	flag.IntVar(&conf.BalanceInterval, "balance-interval", conf.BalanceInterval, "Time interval (in seconds) to balance the cluster load")
+	flag.BoolVar(&conf.SlabMode, "slab-mode", conf.SlabMode, "Store vectors of all VectoDBLite of the node in one shared slab index")
+	flag.StringVar(&conf.LocalDir, "local-dir", conf.LocalDir, "Persist VectoDBLite under the local directory instead of redis. Only for single node deployments")
+	flag.StringVar(&conf.Storage, "storage", conf.Storage, "VectoDBLite vector storage: fp32, fp16 or sq8. Only fp32 is supported with slab-mode")
+	flag.BoolVar(&conf.Prefilter, "prefilter", conf.Prefilter, "Scan binary codes of VectoDBLite vectors before exact rerank. Ignored with slab-mode")
 
 	flag.StringVar(&conf.EurekaAddr, "eureka-addr", conf.EurekaAddr, "eureka server address list, seperated by comma.")
 	flag.StringVar(&conf.EurekaApp, "eureka-app", conf.EurekaApp, "VectoDBLite cluster service name which will be registered with eureka.")
@@ -323,19 +323,36 @@ func (ctl *Controller) HandleRelease(c *gin.Context) {
 	}
 }
 
+// release destroys the db outside of the lock, since flushing and writing the snapshot may take long.
+// Requests of the db fail meanwhile, instead of loading it again from the store.
 func (ctl *Controller) release(dbID int) (err error) {
 	ctl.rwlock.Lock()
-	defer ctl.rwlock.Unlock()
-	if dbl, ok := ctl.dbls[dbID]; ok {
-		delete(ctl.dbls, dbID)
-		if err = dbl.Destroy(); err != nil {
-			return
+	dbl, ok := ctl.dbls[dbID]
+	if !ok {
+		_, releasing := ctl.releasing[dbID]
+		ctl.rwlock.Unlock()
+		if releasing {
+			err = errors.Errorf("vectodblite %d is being released", dbID)
 		} else {
-			log.Infof("released vectodblite %d", dbID)
+			log.Infof("vectodblite %d is already released", dbID)
 		}
-	} else {
-		log.Infof("vectodblite %d is already released", dbID)
+		return
+	}
+	delete(ctl.dbls, dbID)
+	ctl.releasing[dbID] = struct{}{}
+	ctl.rwlock.Unlock()
+
+	err = dbl.Destroy()
+
+	ctl.rwlock.Lock()
+	defer ctl.rwlock.Unlock()
+	delete(ctl.releasing, dbID)
+	if err != nil {
+		// The db keeps serving with writes not flushed yet. Keep the ownership, so that they aren't lost by a new owner.
+		ctl.dbls[dbID] = dbl
+		return
 	}
+	log.Infof("released vectodblite %d", dbID)
 	return
 }
 
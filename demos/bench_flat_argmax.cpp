@@ -0,0 +1,123 @@
+#include "index_flat_wrapper.h"
+#include "faiss/IndexFlat.h"
+#include "faiss/impl/AuxIndexStructures.h"
+#include "faiss/utils/distances.h"
+
+#include <sys/time.h>
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/**
+ * This benchmark compares the k=1 search of IndexFlatWrapper, which dispatches to a dimension specialized argmax kernel,
+ * against the generic faiss::IndexFlat::search on the same vectors. Queries are issued one by one as VectoDBLite does.
+ * It also compares IndexFlatRangeSearch with k=1, which is what VectoDBLite::Search calls, against collecting every row
+ * above the threshold with faiss::range_search_inner_product and keeping the best one.
+ *
+ * usage: bench_flat_argmax [nb] [nq]
+ **/
+
+double elapsed()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+void bench(long dim, long nb, long nq)
+{
+    vector<float> xb(nb * dim);
+    vector<unsigned long> xids(nb);
+    std::mt19937 rng(0);
+    std::normal_distribution<float> dist;
+    for (long i = 0; i < nb; i++) {
+        float norm = 0;
+        for (long j = 0; j < dim; j++) {
+            xb[i * dim + j] = dist(rng);
+            norm += xb[i * dim + j] * xb[i * dim + j];
+        }
+        norm = sqrtf(norm);
+        for (long j = 0; j < dim; j++)
+            xb[i * dim + j] /= norm;
+        xids[i] = i;
+    }
+    // Perturbed copies of database vectors, so that each query has a clear nearest neighbor.
+    vector<float> xq(nq * dim);
+    for (long i = 0; i < nq; i++) {
+        long row = rng() % nb;
+        for (long j = 0; j < dim; j++)
+            xq[i * dim + j] = xb[row * dim + j] + 0.01f * dist(rng);
+    }
+
+    faiss::IndexFlat flat(dim, faiss::METRIC_INNER_PRODUCT);
+    flat.add(nb, xb.data());
+    void* ifw = IndexFlatNew(dim);
+    IndexFlatAddWithIds(ifw, nb, xb.data(), xids.data());
+
+    vector<float> D0(nq), D1(nq);
+    vector<long> I0(nq);
+    vector<unsigned long> I1(nq);
+    double t0 = elapsed();
+    for (long i = 0; i < nq; i++)
+        flat.search(1, &xq[i * dim], 1, &D0[i], &I0[i]);
+    double t1 = elapsed();
+    for (long i = 0; i < nq; i++)
+        IndexFlatSearch(ifw, 1, &xq[i * dim], &D1[i], &I1[i]);
+    double t2 = elapsed();
+
+    long mismatch = 0;
+    for (long i = 0; i < nq; i++) {
+        if ((unsigned long)I0[i] != I1[i] && fabsf(D0[i] - D1[i]) > 1e-5f)
+            mismatch++;
+    }
+    cout << "dim " << dim << ", nb " << nb
+         << ": IndexFlat::search " << (t1 - t0) * 1e6 / nq << " us/query"
+         << ", IndexFlatSearch " << (t2 - t1) * 1e6 / nq << " us/query"
+         << ", speedup " << (t1 - t0) / (t2 - t1)
+         << ", mismatch " << mismatch << endl;
+
+    const float distThr = 0.9f;
+    vector<long> n0(nq), n1(nq);
+    t0 = elapsed();
+    for (long i = 0; i < nq; i++) {
+        faiss::RangeSearchResult result(1);
+        faiss::range_search_inner_product(&xq[i * dim], xb.data(), dim, 1, nb, distThr, &result);
+        n0[i] = 0;
+        for (size_t j = 0; j < result.lims[1]; j++) {
+            if (n0[i] == 0 || result.distances[j] > D0[i]) {
+                D0[i] = result.distances[j];
+                I0[i] = result.labels[j];
+                n0[i] = 1;
+            }
+        }
+    }
+    t1 = elapsed();
+    for (long i = 0; i < nq; i++)
+        n1[i] = IndexFlatRangeSearch(ifw, &xq[i * dim], distThr, 1, &D1[i], &I1[i]);
+    t2 = elapsed();
+
+    mismatch = 0;
+    for (long i = 0; i < nq; i++) {
+        if (n0[i] != n1[i] || (n0[i] != 0 && (unsigned long)I0[i] != I1[i] && fabsf(D0[i] - D1[i]) > 1e-5f))
+            mismatch++;
+    }
+    cout << "dim " << dim << ", nb " << nb
+         << ": range_search_inner_product " << (t1 - t0) * 1e6 / nq << " us/query"
+         << ", IndexFlatRangeSearch " << (t2 - t1) * 1e6 / nq << " us/query"
+         << ", speedup " << (t1 - t0) / (t2 - t1)
+         << ", mismatch " << mismatch << endl;
+    IndexFlatDelete(ifw);
+}
+
+int main(int argc, char** argv)
+{
+    const long nb = (argc > 1) ? atol(argv[1]) : 10000L;
+    const long nq = (argc > 2) ? atol(argv[2]) : 10000L;
+    for (long dim : { 128L, 256L, 512L, 200L })
+        bench(dim, nb, nq);
+    return 0;
+}
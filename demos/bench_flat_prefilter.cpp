@@ -0,0 +1,123 @@
+#include "index_flat_wrapper.h"
+
+#include <sys/time.h>
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/**
+ * This benchmark compares IndexFlatRangeSearch with and without the binary prefilter on normalized vectors, for fp32 and
+ * SQ8 storages. Half of the queries are perturbed copies of database vectors, the other half are placed at an inner
+ * product just around distThr with a database vector, which is the hard case for the prefilter radius.
+ * Queries are issued one by one as VectoDBLite does.
+ *
+ * usage: bench_flat_prefilter [nb] [nq] [distThr]
+ **/
+
+double elapsed()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+void normalize(long dim, float* x)
+{
+    float norm = 0;
+    for (long j = 0; j < dim; j++)
+        norm += x[j] * x[j];
+    norm = sqrtf(norm);
+    for (long j = 0; j < dim; j++)
+        x[j] /= norm;
+}
+
+void bench(long dim, long nb, long nq, float distThr, int storage)
+{
+    vector<float> xb(nb * dim);
+    vector<unsigned long> xids(nb);
+    std::mt19937 rng(0);
+    std::normal_distribution<float> dist;
+    std::uniform_real_distribution<float> uniform(-0.03f, 0.03f);
+    for (long i = 0; i < nb; i++) {
+        for (long j = 0; j < dim; j++)
+            xb[i * dim + j] = dist(rng);
+        normalize(dim, &xb[i * dim]);
+        xids[i] = i;
+    }
+    vector<float> xq(nq * dim);
+    vector<float> u(dim);
+    for (long i = 0; i < nq; i++) {
+        const float* x = &xb[(rng() % nb) * dim];
+        float* q = &xq[i * dim];
+        if (i % 2 == 0) {
+            for (long j = 0; j < dim; j++)
+                q[j] = x[j] + 0.01f * dist(rng);
+        } else {
+            // q = c * x + s * u, where u is a random unit vector orthogonal to x.
+            float dot = 0;
+            for (long j = 0; j < dim; j++) {
+                u[j] = dist(rng);
+                dot += u[j] * x[j];
+            }
+            for (long j = 0; j < dim; j++)
+                u[j] -= dot * x[j];
+            normalize(dim, u.data());
+            float c = distThr + uniform(rng);
+            float s = sqrtf(1 - c * c);
+            for (long j = 0; j < dim; j++)
+                q[j] = c * x[j] + s * u[j];
+        }
+        normalize(dim, q);
+    }
+
+    void* ifws[2];
+    for (int p = 0; p < 2; p++) {
+        ifws[p] = IndexFlatNewWithStorage(dim, storage);
+        IndexFlatSetPrefilter(ifws[p], p);
+        IndexFlatAddWithIds(ifws[p], nb, xb.data(), xids.data());
+    }
+    const long k = 10;
+    vector<float> D(2 * nq * k);
+    vector<unsigned long> I(2 * nq * k);
+    vector<long> n(2 * nq);
+    double t[2];
+    for (int p = 0; p < 2; p++) {
+        double t0 = elapsed();
+        for (long i = 0; i < nq; i++)
+            n[p * nq + i] = IndexFlatRangeSearch(ifws[p], &xq[i * dim], distThr, k, &D[(p * nq + i) * k], &I[(p * nq + i) * k]);
+        t[p] = elapsed() - t0;
+    }
+
+    long hits = 0, mismatch = 0;
+    for (long i = 0; i < nq; i++) {
+        hits += n[i];
+        bool same = n[i] == n[nq + i];
+        for (long j = 0; same && j < n[i]; j++)
+            same = I[i * k + j] == I[(nq + i) * k + j];
+        if (!same)
+            mismatch++;
+    }
+    cout << "dim " << dim << ", nb " << nb << ", storage " << (storage == INDEX_FLAT_STORAGE_SQ8 ? "sq8" : "fp32")
+         << ": exact " << t[0] * 1e6 / nq << " us/query"
+         << ", prefilter " << t[1] * 1e6 / nq << " us/query"
+         << ", speedup " << t[0] / t[1]
+         << ", hits " << hits << ", mismatch " << mismatch << endl;
+    for (int p = 0; p < 2; p++)
+        IndexFlatDelete(ifws[p]);
+}
+
+int main(int argc, char** argv)
+{
+    const long nb = (argc > 1) ? atol(argv[1]) : 100000L;
+    const long nq = (argc > 2) ? atol(argv[2]) : 1000L;
+    const float distThr = (argc > 3) ? atof(argv[3]) : 0.9f;
+    for (int storage : { INDEX_FLAT_STORAGE_FP32, INDEX_FLAT_STORAGE_SQ8 }) {
+        for (long dim : { 128L, 256L, 512L })
+            bench(dim, nb, nq, distThr, storage);
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "vectodb.hpp"
+
+#include <glog/logging.h>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+/**
+ * This benchmark compares refine-heavy searches with and without transparent huge pages.
+ * The same database is loaded once per round in each mode, alternating so that neither mode gets a warmer page cache.
+ * It reports mean, median and p99 latency, dTLB load misses (if perf events are permitted) and AnonHugePages of the process.
+ *
+ * usage: bench_hugepage [nb] [nq] [k] [rounds]
+ **/
+
+double elapsed()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Count dTLB load misses of all threads of the process which are created later.
+int open_dtlb_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long read_counter(int fd)
+{
+    long count = -1;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+long anon_huge_pages_kb()
+{
+    ifstream ifs("/proc/self/smaps_rollup");
+    string line;
+    while (getline(ifs, line)) {
+        if (line.compare(0, 14, "AnonHugePages:") == 0) {
+            istringstream iss(line.substr(14));
+            long kb = 0;
+            iss >> kb;
+            return kb;
+        }
+    }
+    return -1;
+}
+
+void bench(const char* work_dir, long dim, long nq, long k, const float* xq, int fd, const char* name)
+{
+    VectoDB vdb(work_dir, dim, "IVF1024,SQ8", "nprobe=64");
+    vector<float> D(nq * k);
+    vector<long> I(nq * k);
+    // warm up
+    vdb.Search(std::min(nq, 100L), k, xq, nullptr, D.data(), I.data());
+    vector<double> lat(nq);
+    long misses0 = read_counter(fd);
+    double t0 = elapsed();
+    for (long q = 0; q < nq; q++) {
+        double tq = elapsed();
+        vdb.Search(1, k, xq + q * dim, nullptr, D.data() + q * k, I.data() + q * k);
+        lat[q] = (elapsed() - tq) * 1e6;
+    }
+    double t1 = elapsed();
+    long misses1 = read_counter(fd);
+    std::sort(lat.begin(), lat.end());
+    ostringstream oss;
+    oss << name << ": " << (t1 - t0) * 1e6 / nq << " us/query, p50 " << lat[nq / 2] << " us, p99 " << lat[nq * 99 / 100] << " us";
+    if (misses0 >= 0 && misses1 >= 0)
+        oss << ", " << (misses1 - misses0) / nq << " dTLB load misses/query";
+    else
+        oss << ", dTLB load misses n/a";
+    oss << ", AnonHugePages " << anon_huge_pages_kb() << " kB";
+    LOG(INFO) << oss.str();
+    cout << oss.str() << endl;
+}
+
+int main(int argc, char** argv)
+{
+    FLAGS_stderrthreshold = 0;
+    FLAGS_log_dir = ".";
+    google::InitGoogleLogging(argv[0]);
+
+    int fd = open_dtlb_counter();
+    const long dim = 128L;
+    const long nb = (argc > 1) ? atol(argv[1]) : 2000000L;
+    const long nq = (argc > 2) ? atol(argv[2]) : 1000L;
+    const long k = (argc > 3) ? atol(argv[3]) : 400L;
+    const long rounds = (argc > 4) ? atol(argv[4]) : 2L;
+    const char* work_dir = "/tmp/bench_hugepage";
+
+    LOG(INFO) << "Generating " << nb << " vectors";
+    vector<float> xb(nb * dim);
+    vector<long> xids(nb);
+    std::mt19937 rng(0);
+    std::normal_distribution<float> dist;
+    for (long i = 0; i < nb; i++) {
+        for (long j = 0; j < dim; j++)
+            xb[i * dim + j] = dist(rng);
+        NormVec(&xb[i * dim], dim);
+        xids[i] = i;
+    }
+    {
+        ClearDir(work_dir);
+        VectoDB vdb(work_dir, dim, "IVF1024,SQ8", "nprobe=64");
+        vdb.AddWithIds(nb, xb.data(), xids.data());
+        vdb.SyncIndex();
+    }
+    // Large k makes refining gather k random rows of the flat codes for each query.
+    const float* xq = xb.data();
+    for (long r = 0; r < rounds; r++) {
+        SetHugePages(false);
+        bench(work_dir, dim, nq, k, xq, fd, "4KB pages");
+        SetHugePages(true);
+        bench(work_dir, dim, nq, k, xq, fd, "huge pages");
+    }
+    return 0;
+}
@@ -1,35 +1,240 @@
 
 #include "index_flat_wrapper.h"
 #include "faiss/IndexFlat.h"
+#include "faiss/VectorTransform.h"
+#include "faiss/impl/AuxIndexStructures.h"
+#include "faiss/impl/ScalarQuantizer.h"
+#include "faiss/utils/Heap.h"
+#include "faiss/utils/distances.h"
+#include "faiss/utils/hamming.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
 #include <shared_mutex>
 #include <mutex>
 #include <pthread.h>
 #include <sstream>
+#include <string.h>
 #include <string>
 #include <unordered_map>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 using mtxlock = unique_lock<mutex>;
 using rlock = unique_lock<shared_mutex>;
 using wlock = shared_lock<shared_mutex>;
 
+// ArgmaxKernel finds the row of xb[nb][dim] which has the max inner product with xq.
+using ArgmaxKernel = void (*)(const float* xq, const float* xb, long nb, float* distance, long* label);
+
 struct IndexFlatWrapper {
     shared_mutex rw_flat;
     faiss::IndexFlat* flat;
+    faiss::ScalarQuantizer* sq; //not nullptr if vectors are compressed into codes, flat stays empty then
+    vector<uint8_t> codes; //codes of all vectors if sq is not nullptr
+    size_t code_size; //bytes per vector
     unordered_map<uint64_t, uint64_t> xid2num;
     vector<uint64_t> xids; //vector of xid of all vectors
+    ArgmaxKernel argmax; //nullptr if there's no kernel for the dimension
+    faiss::RandomRotationMatrix* rotation; //not nullptr if the binary prefilter is enabled
+    vector<uint8_t> bcodes; //sign codes of rotated vectors if rotation is not nullptr
+    size_t bcode_size; //bytes per sign code, a multiple of 8
+
+    uint8_t* row(uint64_t num) { return sq ? &codes[num * code_size] : (uint8_t*)&flat->xb[num * flat->d]; }
+
+    // binarize computes sign codes of n rotated vectors.
+    void binarize(long n, const float* x, uint8_t* bcode)
+    {
+        const long dim = flat->d;
+        vector<float> rotated(n * dim);
+        rotation->apply_noalloc(n, x, rotated.data());
+        memset(bcode, 0, n * bcode_size);
+        for (long i = 0; i < n; i++)
+            faiss::fvec2bitvec(&rotated[i * dim], bcode + i * bcode_size, dim);
+    }
+
+    void overwrite(uint64_t num, const float* x)
+    {
+        if (sq)
+            sq->compute_codes(x, row(num), 1);
+        else
+            memcpy(row(num), x, code_size);
+        if (rotation)
+            binarize(1, x, &bcodes[num * bcode_size]);
+    }
+
+    void append(long n, const float* x)
+    {
+        if (sq) {
+            size_t offset = codes.size();
+            codes.resize(offset + n * code_size);
+            sq->compute_codes(x, &codes[offset], n);
+        } else {
+            flat->add(n, x);
+        }
+        if (rotation) {
+            size_t offset = bcodes.size();
+            bcodes.resize(offset + n * bcode_size);
+            binarize(n, x, &bcodes[offset]);
+        }
+    }
+
+    void move(uint64_t from, uint64_t to)
+    {
+        memcpy(row(to), row(from), code_size);
+        if (rotation)
+            memcpy(&bcodes[to * bcode_size], &bcodes[from * bcode_size], bcode_size);
+    }
+
+    void truncate(uint64_t ntotal)
+    {
+        if (sq) {
+            codes.resize(ntotal * code_size);
+        } else {
+            flat->xb.resize(ntotal * flat->d);
+            flat->ntotal = ntotal;
+        }
+        if (rotation)
+            bcodes.resize(ntotal * bcode_size);
+    }
 };
 
+#if defined(__x86_64__)
+// Sum of the 8 floats of v.
+__attribute__((target("avx2,fma"))) static inline float hsum(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(s);
+}
+
+// argmaxAvx2 computes inner products of 4 rows at once with FMA, and keeps the running max instead of a k=1 heap.
+// D is a compile time constant so that the inner loop is fully unrolled.
+template <long D>
+__attribute__((target("avx2,fma"))) static void argmaxAvx2(const float* xq, const float* xb, long nb, float* distance, long* label)
+{
+    static_assert(D % 8 == 0, "D shall be a multiple of 8");
+    const long BLOCK = 4;
+    float best = -numeric_limits<float>::max();
+    long bestNum = -1;
+    long i = 0;
+    for (; i + BLOCK <= nb; i += BLOCK) {
+        const float* y = xb + i * D;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        for (long j = 0; j < D; j += 8) {
+            __m256 q = _mm256_loadu_ps(xq + j);
+            acc0 = _mm256_fmadd_ps(q, _mm256_loadu_ps(y + j), acc0);
+            acc1 = _mm256_fmadd_ps(q, _mm256_loadu_ps(y + D + j), acc1);
+            acc2 = _mm256_fmadd_ps(q, _mm256_loadu_ps(y + 2 * D + j), acc2);
+            acc3 = _mm256_fmadd_ps(q, _mm256_loadu_ps(y + 3 * D + j), acc3);
+        }
+        // Reduce the 4 accumulators together. Lane l of dots is the inner product of row i+l.
+        __m256 s = _mm256_hadd_ps(_mm256_hadd_ps(acc0, acc1), _mm256_hadd_ps(acc2, acc3));
+        __m128 dots = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+        float d[BLOCK];
+        _mm_storeu_ps(d, dots);
+        for (long l = 0; l < BLOCK; l++) {
+            if (d[l] > best) {
+                best = d[l];
+                bestNum = i + l;
+            }
+        }
+    }
+    for (; i < nb; i++) {
+        const float* y = xb + i * D;
+        __m256 acc = _mm256_setzero_ps();
+        for (long j = 0; j < D; j += 8)
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(xq + j), _mm256_loadu_ps(y + j), acc);
+        float d = hsum(acc);
+        if (d > best) {
+            best = d;
+            bestNum = i;
+        }
+    }
+    *distance = best;
+    *label = bestNum;
+}
+#endif
+
+static ArgmaxKernel getArgmaxKernel(long dim)
+{
+#if defined(__x86_64__)
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (avx2) {
+        switch (dim) {
+        case 128:
+            return argmaxAvx2<128>;
+        case 256:
+            return argmaxAvx2<256>;
+        case 512:
+            return argmaxAvx2<512>;
+        }
+    }
+#endif
+    (void)dim;
+    return nullptr;
+}
+
+// argmaxGeneric is the fallback of dimensions without a specialized kernel.
+static void argmaxGeneric(long dim, const float* xq, const float* xb, long nb, float* distance, long* label)
+{
+    float best = -numeric_limits<float>::max();
+    long bestNum = -1;
+    for (long i = 0; i < nb; i++) {
+        float d = faiss::fvec_inner_product(xq, xb + i * dim, dim);
+        if (d > best) {
+            best = d;
+            bestNum = i;
+        }
+    }
+    *distance = best;
+    *label = bestNum;
+}
+
 void* IndexFlatNew(long dim)
+{
+    return IndexFlatNewWithStorage(dim, INDEX_FLAT_STORAGE_FP32);
+}
+
+void* IndexFlatNewWithStorage(long dim, int storage)
 {
     IndexFlatWrapper* ifw = new IndexFlatWrapper();
     ifw->flat = new faiss::IndexFlat(dim, faiss::METRIC_INNER_PRODUCT);
+    ifw->sq = nullptr;
+    ifw->code_size = sizeof(float) * dim;
+    ifw->argmax = nullptr;
+    ifw->rotation = nullptr;
+    ifw->bcode_size = (dim + 63) / 64 * 8;
+    switch (storage) {
+    case INDEX_FLAT_STORAGE_FP16:
+        ifw->sq = new faiss::ScalarQuantizer(dim, faiss::ScalarQuantizer::QT_fp16);
+        break;
+    case INDEX_FLAT_STORAGE_SQ8:
+        // Components of normalized vectors are in [-1, 1], so the range is fixed instead of trained.
+        ifw->sq = new faiss::ScalarQuantizer(dim, faiss::ScalarQuantizer::QT_8bit_uniform);
+        ifw->sq->trained = { -1.0f, 2.0f };
+        break;
+    default:
+        ifw->argmax = getArgmaxKernel(dim);
+    }
+    if (ifw->sq != nullptr)
+        ifw->code_size = ifw->sq->code_size;
     return ifw;
 }
 
 void IndexFlatDelete(void* ifwIn)
 {
     IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
+    delete ifw->rotation;
+    delete ifw->sq;
     delete ifw->flat;
     delete ifw;
 }
@@ -38,23 +243,422 @@ void IndexFlatAddWithIds(void* ifwIn, long nb, float* xb, unsigned long* xids)
 {
     IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
     wlock w{ ifw->rw_flat };
-    long ntotal = ifw->flat->ntotal;
-    ifw->flat->add(nb, xb);
+    const long dim = ifw->flat->d;
+    const long ntotal = ifw->xids.size();
+    // fresh[j] is the position in xb of the vector to append as row ntotal+j.
+    vector<long> fresh;
+    fresh.reserve(nb);
+    for (long i = 0; i < nb; i++) {
+        auto it = ifw->xid2num.find(xids[i]);
+        if (it == ifw->xid2num.end()) {
+            ifw->xid2num[xids[i]] = ntotal + fresh.size();
+            ifw->xids.push_back(xids[i]);
+            fresh.push_back(i);
+        } else if ((long)it->second >= ntotal) {
+            // Duplicated xid inside this batch, the last one wins.
+            fresh[it->second - ntotal] = i;
+        } else {
+            // Overwrite the vector of an existing xid in place. Otherwise a stale duplicate would outlive the removal of that xid.
+            ifw->overwrite(it->second, xb + i * dim);
+        }
+    }
+    if ((long)fresh.size() == nb) {
+        // Common case, add the whole block at once.
+        ifw->append(nb, xb);
+    } else if (!fresh.empty()) {
+        vector<float> block(fresh.size() * dim);
+        for (size_t j = 0; j < fresh.size(); j++)
+            memcpy(&block[j * dim], xb + fresh[j] * dim, sizeof(float) * dim);
+        ifw->append(fresh.size(), block.data());
+    }
+}
+
+long IndexFlatRemoveIds(void* ifwIn, long nb, unsigned long* xids)
+{
+    IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
+    rlock r{ ifw->rw_flat };
+    long nremove = 0;
+    for (long i = 0; i < nb; i++) {
+        auto it = ifw->xid2num.find(xids[i]);
+        if (it == ifw->xid2num.end())
+            continue;
+        uint64_t num = it->second;
+        uint64_t last = ifw->xids.size() - 1;
+        ifw->xid2num.erase(it);
+        if (num != last) {
+            ifw->move(last, num);
+            ifw->xids[num] = ifw->xids[last];
+            ifw->xid2num[ifw->xids[num]] = num;
+        }
+        ifw->xids.pop_back();
+        ifw->truncate(last);
+        nremove++;
+    }
+    return nremove;
+}
+
+long IndexFlatNtotal(void* ifwIn)
+{
+    IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
+    wlock w{ ifw->rw_flat };
+    return ifw->xids.size();
+}
+
+long IndexFlatReconstruct(void* ifwIn, long nb, unsigned long* xids, float* xb)
+{
+    IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
+    wlock w{ ifw->rw_flat };
+    const long dim = ifw->flat->d;
+    long nfound = 0;
     for (long i = 0; i < nb; i++) {
-        ifw->xid2num[xids[i]] = ntotal + i;
-        ifw->xids.push_back(xids[i]);
+        auto it = ifw->xid2num.find(xids[i]);
+        if (it == ifw->xid2num.end()) {
+            xids[i] = (unsigned long)-1;
+            continue;
+        }
+        if (ifw->sq)
+            ifw->sq->decode(ifw->row(it->second), xb + i * dim, 1);
+        else
+            memcpy(xb + i * dim, ifw->row(it->second), sizeof(float) * dim);
+        nfound++;
+    }
+    return nfound;
+}
+
+// searchCodes is IndexFlat::search over compressed codes. It uses the SIMD distance computer of faiss
+// which computes inner products directly on codes. Labels are row numbers.
+static void searchCodes(IndexFlatWrapper* ifw, long nq, const float* xq, long k, float* distances, long* labels)
+{
+    unique_ptr<faiss::ScalarQuantizer::SQDistanceComputer> dc(ifw->sq->get_distance_computer(faiss::METRIC_INNER_PRODUCT));
+    dc->codes = ifw->codes.data();
+    dc->code_size = ifw->code_size;
+    const long ntotal = ifw->xids.size();
+    for (long i = 0; i < nq; i++) {
+        float* D = distances + i * k;
+        long* I = labels + i * k;
+        faiss::minheap_heapify(k, D, I);
+        dc->set_query(xq + i * ifw->flat->d);
+        for (long j = 0; j < ntotal; j++) {
+            float dis = (*dc)(j);
+            if (dis > D[0]) {
+                faiss::minheap_pop(k, D, I);
+                faiss::minheap_push(k, D, I, dis, j);
+            }
+        }
+        faiss::minheap_reorder(k, D, I);
+    }
+}
+
+void IndexFlatSetPrefilter(void* ifwIn, int enable)
+{
+    IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
+    rlock r{ ifw->rw_flat };
+    if (!enable) {
+        delete ifw->rotation;
+        ifw->rotation = nullptr;
+        vector<uint8_t>().swap(ifw->bcodes);
+        return;
+    }
+    if (ifw->rotation != nullptr)
+        return;
+    const long dim = ifw->flat->d;
+    ifw->rotation = new faiss::RandomRotationMatrix(dim, dim);
+    ifw->rotation->init(1234);
+    const long ntotal = ifw->xids.size();
+    ifw->bcodes.resize(ntotal * ifw->bcode_size);
+    if (ifw->sq != nullptr) {
+        vector<float> x(ntotal * dim);
+        ifw->sq->decode(ifw->codes.data(), x.data(), ntotal);
+        ifw->binarize(ntotal, x.data(), ifw->bcodes.data());
+    } else {
+        ifw->binarize(ntotal, ifw->flat->xb.data(), ifw->bcodes.data());
+    }
+}
+
+// prefilterRadius returns the Hamming radius of sign codes of two unit vectors whose inner product is above distThr.
+// After a random rotation each bit differs with probability θ/π, so the radius is the mean plus 6 standard deviations.
+static int prefilterRadius(long dim, float distThr)
+{
+    double p = acos(std::max(-1.0, std::min(1.0, (double)distThr))) / M_PI;
+    double radius = dim * p + 6 * sqrt(dim * p * (1 - p));
+    return std::min(dim, (long)ceil(radius));
+}
+
+// prefilter scans sign codes and returns rows within radius of the query code.
+template <class HammingComputer>
+static void prefilter(const IndexFlatWrapper* ifw, const uint8_t* qcode, int radius, vector<long>& candidates)
+{
+    HammingComputer hc(qcode, ifw->bcode_size);
+    const long ntotal = ifw->xids.size();
+    const uint8_t* bcode = ifw->bcodes.data();
+    for (long j = 0; j < ntotal; j++, bcode += ifw->bcode_size) {
+        if (hc.hamming(bcode) <= radius)
+            candidates.push_back(j);
     }
 }
 
 void IndexFlatSearch(void* ifwIn, long nq, float* xq, float* distances, unsigned long* xids)
 {
-    static const long k = 1;
+    IndexFlatSearchK(ifwIn, nq, xq, 1, distances, xids);
+}
+
+void IndexFlatSearchK(void* ifwIn, long nq, float* xq, long k, float* distances, unsigned long* xids)
+{
     IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
-    {
-        rlock r{ ifw->rw_flat };
+    rlock r{ ifw->rw_flat };
+    if (ifw->sq != nullptr) {
+        searchCodes(ifw, nq, xq, k, distances, (long*)xids);
+    } else if (k == 1 && ifw->argmax != nullptr && ifw->flat->ntotal > 0) {
+        for (long i = 0; i < nq; i++)
+            ifw->argmax(xq + i * ifw->flat->d, ifw->flat->xb.data(), ifw->flat->ntotal, distances + i, (long*)xids + i);
+    } else {
         ifw->flat->search(nq, xq, k, distances, (long*)xids);
     }
-    for (int i = 0; i < nq; i++) {
-        xids[i] = ifw->xids[xids[i]];
+    // Translate row numbers while holding the lock since a concurrent removal moves rows around.
+    for (long i = 0; i < nq * k; i++) {
+        if ((long)xids[i] >= 0)
+            xids[i] = ifw->xids[xids[i]];
+    }
+}
+
+long IndexFlatRangeSearch(void* ifwIn, float* xq, float distThr, long k, float* distances, unsigned long* xids)
+{
+    IndexFlatWrapper* ifw = static_cast<IndexFlatWrapper*>(ifwIn);
+    rlock r{ ifw->rw_flat };
+    vector<pair<float, long>> hits;
+    if (ifw->rotation != nullptr) {
+        vector<uint8_t> qcode(ifw->bcode_size);
+        ifw->binarize(1, xq, qcode.data());
+        int radius = prefilterRadius(ifw->flat->d, distThr);
+        vector<long> candidates;
+        switch (ifw->bcode_size) {
+        case 16:
+            prefilter<faiss::HammingComputer16>(ifw, qcode.data(), radius, candidates);
+            break;
+        case 32:
+            prefilter<faiss::HammingComputer32>(ifw, qcode.data(), radius, candidates);
+            break;
+        case 64:
+            prefilter<faiss::HammingComputer64>(ifw, qcode.data(), radius, candidates);
+            break;
+        default:
+            prefilter<faiss::HammingComputerM8>(ifw, qcode.data(), radius, candidates);
+        }
+        // Exact rerank of the candidates keeps the threshold semantics.
+        unique_ptr<faiss::ScalarQuantizer::SQDistanceComputer> dc;
+        if (ifw->sq != nullptr) {
+            dc.reset(ifw->sq->get_distance_computer(faiss::METRIC_INNER_PRODUCT));
+            dc->codes = ifw->codes.data();
+            dc->code_size = ifw->code_size;
+            dc->set_query(xq);
+        }
+        for (long j : candidates) {
+            float dis = dc ? (*dc)(j) : faiss::fvec_inner_product(xq, &ifw->flat->xb[j * ifw->flat->d], ifw->flat->d);
+            if (dis > distThr)
+                hits.push_back(make_pair(dis, j));
+        }
+    } else if (ifw->sq != nullptr) {
+        unique_ptr<faiss::ScalarQuantizer::SQDistanceComputer> dc(ifw->sq->get_distance_computer(faiss::METRIC_INNER_PRODUCT));
+        dc->codes = ifw->codes.data();
+        dc->code_size = ifw->code_size;
+        dc->set_query(xq);
+        for (long j = 0; j < (long)ifw->xids.size(); j++) {
+            float dis = (*dc)(j);
+            if (dis > distThr)
+                hits.push_back(make_pair(dis, j));
+        }
+    } else if (k == 1 && ifw->argmax != nullptr) {
+        // Search of VectoDBLite only wants the best hit, so the running max replaces collecting every row above distThr.
+        if (ifw->flat->ntotal > 0) {
+            float dis;
+            long j;
+            ifw->argmax(xq, ifw->flat->xb.data(), ifw->flat->ntotal, &dis, &j);
+            if (dis > distThr)
+                hits.push_back(make_pair(dis, j));
+        }
+    } else {
+        faiss::RangeSearchResult result(1);
+        faiss::range_search_inner_product(xq, ifw->flat->xb.data(), ifw->flat->d, 1, ifw->flat->ntotal, distThr, &result);
+        hits.resize(result.lims[1]);
+        for (size_t i = 0; i < result.lims[1]; i++)
+            hits[i] = make_pair(result.distances[i], result.labels[i]);
+    }
+    long nhits = std::min((long)hits.size(), k);
+    partial_sort(hits.begin(), hits.begin() + nhits, hits.end(), [](const pair<float, long>& a, const pair<float, long>& b) { return a.first > b.first; });
+    for (long i = 0; i < nhits; i++) {
+        distances[i] = hits[i].first;
+        xids[i] = ifw->xids[hits[i].second];
+    }
+    return nhits;
+}
+
+//number of vectors per slab chunk
+const long SLAB_CHUNK_ROWS = 64;
+
+struct SlabTenant {
+    vector<long> chunks; //chunk numbers in the arena, vector num is at chunks[num/SLAB_CHUNK_ROWS]
+    unordered_map<uint64_t, uint64_t> xid2num;
+    vector<uint64_t> xids; //vector of xid of all vectors
+};
+
+struct IndexSlab {
+    shared_mutex rw_slab;
+    long dim;
+    vector<float> arena; //chunks of SLAB_CHUNK_ROWS vectors
+    vector<long> freeChunks;
+    unordered_map<long, SlabTenant> tenants;
+    ArgmaxKernel argmax;
+
+    float* chunk(long c) { return arena.data() + c * SLAB_CHUNK_ROWS * dim; }
+    float* row(const SlabTenant& t, uint64_t num) { return chunk(t.chunks[num / SLAB_CHUNK_ROWS]) + (num % SLAB_CHUNK_ROWS) * dim; }
+
+    long allocChunk()
+    {
+        if (!freeChunks.empty()) {
+            long c = freeChunks.back();
+            freeChunks.pop_back();
+            return c;
+        }
+        long c = arena.size() / (SLAB_CHUNK_ROWS * dim);
+        arena.resize(arena.size() + SLAB_CHUNK_ROWS * dim);
+        return c;
+    }
+};
+
+void* IndexSlabNew(long dim)
+{
+    IndexSlab* slab = new IndexSlab();
+    slab->dim = dim;
+    slab->argmax = getArgmaxKernel(dim);
+    return slab;
+}
+
+void IndexSlabDelete(void* slabIn)
+{
+    delete static_cast<IndexSlab*>(slabIn);
+}
+
+void IndexSlabAddWithIds(void* slabIn, long tenant, long nb, float* xb, unsigned long* xids)
+{
+    IndexSlab* slab = static_cast<IndexSlab*>(slabIn);
+    rlock r{ slab->rw_slab };
+    const long dim = slab->dim;
+    SlabTenant& t = slab->tenants[tenant];
+    for (long i = 0; i < nb; i++) {
+        auto it = t.xid2num.find(xids[i]);
+        if (it != t.xid2num.end()) {
+            memcpy(slab->row(t, it->second), xb + i * dim, sizeof(float) * dim);
+            continue;
+        }
+        uint64_t num = t.xids.size();
+        if (num % SLAB_CHUNK_ROWS == 0)
+            t.chunks.push_back(slab->allocChunk());
+        memcpy(slab->row(t, num), xb + i * dim, sizeof(float) * dim);
+        t.xid2num[xids[i]] = num;
+        t.xids.push_back(xids[i]);
+    }
+}
+
+long IndexSlabRemoveIds(void* slabIn, long tenant, long nb, unsigned long* xids)
+{
+    IndexSlab* slab = static_cast<IndexSlab*>(slabIn);
+    rlock r{ slab->rw_slab };
+    auto tit = slab->tenants.find(tenant);
+    if (tit == slab->tenants.end())
+        return 0;
+    SlabTenant& t = tit->second;
+    long nremove = 0;
+    for (long i = 0; i < nb; i++) {
+        auto it = t.xid2num.find(xids[i]);
+        if (it == t.xid2num.end())
+            continue;
+        uint64_t num = it->second;
+        uint64_t last = t.xids.size() - 1;
+        t.xid2num.erase(it);
+        if (num != last) {
+            memcpy(slab->row(t, num), slab->row(t, last), sizeof(float) * slab->dim);
+            t.xids[num] = t.xids[last];
+            t.xid2num[t.xids[num]] = num;
+        }
+        t.xids.pop_back();
+        if (last % SLAB_CHUNK_ROWS == 0) {
+            slab->freeChunks.push_back(t.chunks.back());
+            t.chunks.pop_back();
+        }
+        nremove++;
+    }
+    return nremove;
+}
+
+void IndexSlabRemoveTenant(void* slabIn, long tenant)
+{
+    IndexSlab* slab = static_cast<IndexSlab*>(slabIn);
+    rlock r{ slab->rw_slab };
+    auto tit = slab->tenants.find(tenant);
+    if (tit == slab->tenants.end())
+        return;
+    slab->freeChunks.insert(slab->freeChunks.end(), tit->second.chunks.begin(), tit->second.chunks.end());
+    slab->tenants.erase(tit);
+}
+
+long IndexSlabNtotal(void* slabIn, long tenant)
+{
+    IndexSlab* slab = static_cast<IndexSlab*>(slabIn);
+    wlock w{ slab->rw_slab };
+    auto tit = slab->tenants.find(tenant);
+    return (tit == slab->tenants.end()) ? 0 : tit->second.xids.size();
+}
+
+long IndexSlabReconstruct(void* slabIn, long tenant, long nb, unsigned long* xids, float* xb)
+{
+    IndexSlab* slab = static_cast<IndexSlab*>(slabIn);
+    wlock w{ slab->rw_slab };
+    auto tit = slab->tenants.find(tenant);
+    long nfound = 0;
+    for (long i = 0; i < nb; i++) {
+        if (tit != slab->tenants.end()) {
+            auto it = tit->second.xid2num.find(xids[i]);
+            if (it != tit->second.xid2num.end()) {
+                memcpy(xb + i * slab->dim, slab->row(tit->second, it->second), sizeof(float) * slab->dim);
+                nfound++;
+                continue;
+            }
+        }
+        xids[i] = (unsigned long)-1;
+    }
+    return nfound;
+}
+
+void IndexSlabSearch(void* slabIn, long nq, long* tenants, float* xq, float* distances, unsigned long* xids)
+{
+    IndexSlab* slab = static_cast<IndexSlab*>(slabIn);
+    wlock w{ slab->rw_slab };
+    const long dim = slab->dim;
+    for (long i = 0; i < nq; i++) {
+        const float* q = xq + i * dim;
+        float best = -numeric_limits<float>::max();
+        long bestNum = -1;
+        auto tit = slab->tenants.find(tenants[i]);
+        if (tit != slab->tenants.end()) {
+            const SlabTenant& t = tit->second;
+            const long ntotal = t.xids.size();
+            for (size_t c = 0; c < t.chunks.size(); c++) {
+                long rows = std::min(SLAB_CHUNK_ROWS, ntotal - (long)c * SLAB_CHUNK_ROWS);
+                float d;
+                long l;
+                if (slab->argmax != nullptr)
+                    slab->argmax(q, slab->chunk(t.chunks[c]), rows, &d, &l);
+                else
+                    argmaxGeneric(dim, q, slab->chunk(t.chunks[c]), rows, &d, &l);
+                if (l >= 0 && d > best) {
+                    best = d;
+                    bestNum = c * SLAB_CHUNK_ROWS + l;
+                }
+            }
+            if (bestNum >= 0)
+                bestNum = t.xids[bestNum];
+        }
+        distances[i] = best;
+        xids[i] = bestNum;
     }
 }
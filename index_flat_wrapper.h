@@ -6,9 +6,47 @@ extern "C" {
 
 // IndexFlatWrapper is a thin wrapper of faiss::IndexFlat. Only supports metric type 0 - METRIC_INNER_PRODUCT.
 void* IndexFlatNew(long dim);
+// Storage of IndexFlatWrapper vectors. FP16 and SQ8 store compressed codes and cut memory by 2x and 4x.
+// SQ8 assumes normalized vectors whose components are in [-1, 1].
+enum IndexFlatStorage {
+    INDEX_FLAT_STORAGE_FP32 = 0,
+    INDEX_FLAT_STORAGE_FP16 = 1,
+    INDEX_FLAT_STORAGE_SQ8 = 2,
+};
+void* IndexFlatNewWithStorage(long dim, int storage);
 void IndexFlatDelete(void* ifw);
+// IndexFlatAddWithIds adds nb vectors in one go. The vector of an existing xid is overwritten in place.
 void IndexFlatAddWithIds(void* ifw, long nb, float* xb, unsigned long* xids);
+// IndexFlatRemoveIds removes given vectors by moving the last vector into the hole, returns the number of vectors removed.
+long IndexFlatRemoveIds(void* ifw, long nb, unsigned long* xids);
+// IndexFlatNtotal returns the number of vectors.
+long IndexFlatNtotal(void* ifw);
+// IndexFlatReconstruct copies vectors of given xids to xb, decoding compressed codes. xids of absent vectors are set to -1.
+// Returns the number of vectors copied.
+long IndexFlatReconstruct(void* ifw, long nb, unsigned long* xids, float* xb);
 void IndexFlatSearch(void* ifw, long nq, float* xq, float* distances, unsigned long* xids);
+// IndexFlatSearchK searches top k vectors of each query. Absent results are filled with xid -1.
+void IndexFlatSearchK(void* ifw, long nq, float* xq, long k, float* distances, unsigned long* xids);
+// IndexFlatSetPrefilter enables or disables a sign code per randomly rotated vector. IndexFlatRangeSearch then scans
+// Hamming distances of codes first, and only reranks candidates within the radius implied by distThr. Assumes normalized vectors.
+void IndexFlatSetPrefilter(void* ifw, int enable);
+// IndexFlatRangeSearch searches vectors whose inner product with xq is larger than distThr.
+// At most k results are stored in descending order of distance, returns the number of results stored.
+long IndexFlatRangeSearch(void* ifw, float* xq, float distThr, long k, float* distances, unsigned long* xids);
+
+// IndexSlab stores vectors of many tenants in one arena of fixed size chunks. Each chunk belongs to one tenant,
+// so the per-tenant overhead is a chunk list instead of a whole index. Only supports metric type 0 - METRIC_INNER_PRODUCT.
+void* IndexSlabNew(long dim);
+void IndexSlabDelete(void* slab);
+void IndexSlabAddWithIds(void* slab, long tenant, long nb, float* xb, unsigned long* xids);
+long IndexSlabRemoveIds(void* slab, long tenant, long nb, unsigned long* xids);
+void IndexSlabRemoveTenant(void* slab, long tenant);
+long IndexSlabNtotal(void* slab, long tenant);
+// IndexSlabReconstruct copies vectors of given xids of the tenant to xb. xids of absent vectors are set to -1.
+// Returns the number of vectors copied.
+long IndexSlabReconstruct(void* slab, long tenant, long nb, unsigned long* xids, float* xb);
+// IndexSlabSearch searches the nearest vector of xq[i] among vectors of tenants[i], for i in [0, nq). Absent results are filled with xid -1.
+void IndexSlabSearch(void* slab, long nq, long* tenants, float* xq, float* distances, unsigned long* xids);
 
 #ifdef __cplusplus
 }
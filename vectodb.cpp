@@ -5,8 +5,15 @@
 #include "faiss/IndexFlat.h"
 #include "faiss/IndexHNSW.h"
 #include "faiss/IndexIVFFlat.h"
+#include "faiss/IndexIVFPQ.h"
+#include "faiss/IndexPQ.h"
+#include "faiss/IndexScalarQuantizer.h"
+#include "faiss/IVFlib.h"
+#include "faiss/InvertedLists.h"
+#include "faiss/impl/AuxIndexStructures.h"
 #include "faiss/index_io.h"
 #include "faiss/index_factory.h"
+#include "faiss/utils/distances.h"
 
 #include <filesystem>
 #include <system_error>
@@ -16,9 +23,14 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <deque>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <math.h>
 #include <mutex>
 #include <pthread.h>
@@ -26,12 +38,20 @@
 #include <stdio.h>
 #include <string>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <thread>
 #include <system_error>
 #include <unordered_map>
 #include <vector>
 #include <regex>
+#include <sched.h>
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25 //since Linux 6.1
+#endif
 
 using namespace std;
 namespace fs = std::filesystem;
@@ -42,6 +62,339 @@ using wlock = shared_lock<shared_mutex>;
 //the number of training points which IVF4096 needs for 1M dataset
 const long DESIRED_NTRAIN = 200000L;
 const long ALLOW_ADD_GAP  =  10000L;
+//the maximum number of vectors added during rebuild which are indexed inside of locks
+const long CATCHUP_LOCKED = 1000L;
+//the size of each chunk which AddFromFile streams from the input files
+const long LEN_LOAD_CHUNK = 64L << 20;
+//the maximum size of each run of live vectors which compaction copies at once
+const long LEN_COMPACT_CHUNK = 16L << 20;
+//the number of most recently evaluated queries which the recall estimation is averaged over
+const long RECALL_WINDOW = 1000L;
+//the maximum number of sampled queries pending for evaluation, more samples are dropped
+const long RECALL_MAX_PENDING = 100L;
+//the number of queries and the k of recall@k which auto-tuning evaluates on
+const long TUNE_NQ = 1000L;
+const long TUNE_K = 10L;
+//the size of ingest buffer which producers append to concurrently
+const long LEN_INGEST_BUFFER = 16L << 20;
+//the maximum number of queries which the async search pool coalesces into one batch
+const long ASYNC_MAX_BATCH = 256L;
+//the maximum number of queries which the search coalescer gathers into one batch
+const long COALESCE_MAX_BATCH = 256L;
+//the size of the head and the tail of base.fvecs which the fingerprint of a manifest covers
+const long LEN_FINGERPRINT = 64L << 10;
+//the number of candidates which each member vector of a set query contributes, in multiple of k
+const long SET_CANDIDATE_FACTOR = 2L;
+//the maximum number of NUMA nodes, the size of node masks passed to mbind(2) and set_mempolicy(2)
+const long NUMA_MAX_NODES = 1024L;
+//memory policy modes and flags of mbind(2) and set_mempolicy(2), so that libnuma is not required
+const int NUMA_MPOL_DEFAULT = 0;
+const int NUMA_MPOL_PREFERRED = 1;
+const unsigned NUMA_MPOL_MF_MOVE = 1U << 1;
+//the size of transparent huge pages
+const uintptr_t LEN_HUGE_PAGE = 2UL << 20;
+
+struct CoalescedBatch {
+    CoalescedBatch()
+        : k(0L)
+        , nq(0L)
+        , done(false)
+    {
+    }
+    long k;
+    long nq;
+    vector<float> xq;
+    vector<float> scores;
+    vector<long> xids;
+    bool done;
+    condition_variable cv;
+};
+
+// Manifest records the latest index snapshot and the base files it covers. It's replaced atomically.
+struct Manifest {
+    string index; //file name of the index under work_dir
+    long mutation; //base mutation of the index
+    long ntotal; //number of base rows covered by the index, rows after it are replayed from base files on recovery
+    uint64_t index_checksum;
+    uint64_t base_fingerprint; //checksum of the head and the tail of the first ntotal rows of base.fvecs
+    long swap; //1 if temp files are being renamed to base files
+    long index_size; //size of the index file when it was dumped
+    long index_mtime; //mtime of the index file in nanoseconds when it was dumped. The checksum is verified only if it or the size changes.
+};
+
+// Parse a decimal integer which spans the whole string.
+static bool parseLong(const string& s, long& val)
+{
+    char* end = nullptr;
+    errno = 0;
+    val = strtol(s.c_str(), &end, 10);
+    return !s.empty() && errno == 0 && *end == '\0';
+}
+
+static bool parseUint64(const string& s, uint64_t& val)
+{
+    char* end = nullptr;
+    errno = 0;
+    val = strtoull(s.c_str(), &end, 10);
+    return !s.empty() && s[0] != '-' && errno == 0 && *end == '\0';
+}
+
+// Flush the file to disk, so that it's durable before a rename or a manifest refers to it.
+static void syncFile(const string& fp)
+{
+    int f = open(fp.c_str(), O_RDONLY);
+    if (f < 0)
+        throw fs::filesystem_error(fp, error_code(errno, generic_category()));
+    int rc = fsync(f);
+    int err = errno;
+    close(f);
+    if (rc < 0)
+        throw fs::filesystem_error(fp, error_code(err, generic_category()));
+}
+
+static long getMtimeNs(const struct stat& st)
+{
+    return st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec;
+}
+
+// FNV-1a over 8-byte words. It's fast enough to verify an index as large as memory.
+static uint64_t checksum(const uint8_t* data, long len, uint64_t h = 14695981039346656037ULL)
+{
+    const uint64_t prime = 1099511628211ULL;
+    long i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * prime;
+    }
+    for (; i < len; i++)
+        h = (h ^ data[i]) * prime;
+    return h;
+}
+
+// Replace the term of the same name in comma separated params like "nprobe=256,ht=64", or append it if there's none.
+static string replaceParam(const string& params, const string& term)
+{
+    const string name = term.substr(0, term.find('='));
+    string replaced;
+    std::istringstream iss(params);
+    string cur;
+    while (std::getline(iss, cur, ',')) {
+        if (!cur.empty() && cur.substr(0, cur.find('=')) != name)
+            replaced += cur + ",";
+    }
+    return replaced + term;
+}
+
+struct RecallSample {
+    long k;
+    vector<float> xq;
+    vector<long> xids; //xids returned by the index, size k
+};
+
+// Parse a list like "0-3,8-11" of /sys/devices/system/node.
+static vector<long> parseIdList(const string& fp)
+{
+    vector<long> ids;
+    std::ifstream ifs(fp);
+    string line;
+    if (!std::getline(ifs, line))
+        return ids;
+    std::istringstream iss(line);
+    string range;
+    while (std::getline(iss, range, ',')) {
+        if (range.empty())
+            continue;
+        size_t pos = range.find('-');
+        long first = std::stol(range.substr(0, pos));
+        long last = (pos == string::npos) ? first : std::stol(range.substr(pos + 1));
+        for (long id = first; id <= last; id++)
+            ids.push_back(id);
+    }
+    return ids;
+}
+
+static vector<unsigned long> getNodeMask(long node)
+{
+    const long bits = 8 * sizeof(unsigned long);
+    vector<unsigned long> mask(NUMA_MAX_NODES / bits, 0UL);
+    if (node >= 0 && node < NUMA_MAX_NODES)
+        mask[node / bits] |= 1UL << (node % bits);
+    return mask;
+}
+
+static long getCurrentNumaNode()
+{
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0)
+        return -1L;
+    return node;
+}
+
+// Move pages of the given memory to the node, and let pages faulted later be allocated there.
+static void bindMemory(const void* addr, long len, long node)
+{
+    if (node < 0 || node >= NUMA_MAX_NODES || addr == nullptr || len <= 0)
+        return;
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)addr & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + len + page - 1) & ~(page - 1);
+    vector<unsigned long> mask = getNodeMask(node);
+    if (syscall(SYS_mbind, begin, end - begin, NUMA_MPOL_PREFERRED, mask.data(), NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE) < 0)
+        LOG(ERROR) << "mbind to node " << node << " failed with " << strerror(errno);
+}
+
+template <typename T>
+static void bindVector(const vector<T>& vec, long node)
+{
+    bindMemory(vec.data(), vec.size() * sizeof(T), node);
+}
+
+// Visit buffers of flat codes, inverted lists and quantizers of the index.
+static void visitIndex(const faiss::Index* index, const std::function<void(const void*, long)>& visit)
+{
+    if (index == nullptr)
+        return;
+    if (auto refFlat = dynamic_cast<const faiss::IndexRefineFlat*>(index)) {
+        visit(refFlat->refine_index.xb.data(), refFlat->refine_index.xb.size() * sizeof(float));
+        visitIndex(refFlat->base_index, visit);
+    } else if (auto flat = dynamic_cast<const faiss::IndexFlat*>(index)) {
+        visit(flat->xb.data(), flat->xb.size() * sizeof(float));
+    } else if (auto ivf = dynamic_cast<const faiss::IndexIVF*>(index)) {
+        visitIndex(ivf->quantizer, visit);
+        if (auto ails = dynamic_cast<const faiss::ArrayInvertedLists*>(ivf->invlists)) {
+            for (size_t i = 0; i < ails->nlist; i++) {
+                visit(ails->codes[i].data(), ails->codes[i].size());
+                visit(ails->ids[i].data(), ails->ids[i].size() * sizeof(faiss::Index::idx_t));
+            }
+        }
+    } else if (auto sq = dynamic_cast<const faiss::IndexScalarQuantizer*>(index)) {
+        visit(sq->codes.data(), sq->codes.size());
+    } else if (auto pq = dynamic_cast<const faiss::IndexPQ*>(index)) {
+        visit(pq->codes.data(), pq->codes.size());
+        visit(pq->pq.centroids.data(), pq->pq.centroids.size() * sizeof(float));
+    }
+}
+
+// Bind flat codes, inverted lists and quantizers of the index to the node.
+static void bindIndex(const faiss::Index* index, long node)
+{
+    if (node < 0)
+        return;
+    visitIndex(index, [node](const void* addr, long len) { bindMemory(addr, len, node); });
+}
+
+// Whether index structures and mapped base files are backed by transparent huge pages.
+static atomic<bool> hugePages{ false };
+
+// Let transparent huge pages back the 2MB aligned part of the memory. Pages which are already faulted in are collapsed if collapse is true.
+static void adviseHugePages(const void* addr, long len, bool collapse)
+{
+    uintptr_t begin = ((uintptr_t)addr + LEN_HUGE_PAGE - 1) & ~(LEN_HUGE_PAGE - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(LEN_HUGE_PAGE - 1);
+    if (addr == nullptr || end <= begin)
+        return;
+    if (madvise((void*)begin, end - begin, MADV_HUGEPAGE) < 0)
+        return;
+    // MADV_COLLAPSE is supported since Linux 6.1, it fails harmlessly on older kernels.
+    if (collapse)
+        madvise((void*)begin, end - begin, MADV_COLLAPSE);
+}
+
+// Place the index on the node and on huge pages according to the settings.
+static void placeIndex(const faiss::Index* index, long node, bool collapse)
+{
+    bindIndex(index, node);
+    if (hugePages)
+        visitIndex(index, [collapse](const void* addr, long len) { adviseHugePages(addr, len, collapse); });
+}
+
+// Prefer the node for memory allocated by the calling thread, and pin it to the cpus of the node. node < 0 resets both.
+static void setThreadNumaNode(long node)
+{
+    vector<unsigned long> mask = getNodeMask(node);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    vector<long> cpu_ids;
+    if (node >= 0 && node < NUMA_MAX_NODES) {
+        if (syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask.data(), NUMA_MAX_NODES + 1) < 0)
+            LOG(ERROR) << "set_mempolicy to node " << node << " failed with " << strerror(errno);
+        cpu_ids = parseIdList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    } else {
+        syscall(SYS_set_mempolicy, NUMA_MPOL_DEFAULT, nullptr, 0);
+        for (long cpu = 0; cpu < (long)std::thread::hardware_concurrency(); cpu++)
+            cpu_ids.push_back(cpu);
+    }
+    for (long cpu : cpu_ids)
+        CPU_SET(cpu, &cpus);
+    if (!cpu_ids.empty() && sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+        LOG(ERROR) << "sched_setaffinity to node " << node << " failed with " << strerror(errno);
+}
+
+// NumaScope prefers the node for memory allocated by the calling thread in the scope, and restores the previous policy on exit.
+class NumaScope {
+public:
+    explicit NumaScope(long node)
+        : mode(NUMA_MPOL_DEFAULT)
+        , mask(getNodeMask(-1))
+        , active(node >= 0 && node < NUMA_MAX_NODES)
+    {
+        if (!active)
+            return;
+        if (syscall(SYS_get_mempolicy, &mode, mask.data(), NUMA_MAX_NODES + 1, nullptr, 0) < 0) {
+            active = false;
+            return;
+        }
+        vector<unsigned long> preferred = getNodeMask(node);
+        syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, preferred.data(), NUMA_MAX_NODES + 1);
+    }
+    ~NumaScope()
+    {
+        if (active)
+            syscall(SYS_set_mempolicy, mode, mode == NUMA_MPOL_DEFAULT ? nullptr : mask.data(), NUMA_MAX_NODES + 1);
+    }
+
+private:
+    int mode;
+    vector<unsigned long> mask;
+    bool active;
+};
+
+// Add resident bytes of components of the index to stats.
+static void accountIndex(const faiss::Index* index, VectoDBStats& stats)
+{
+    if (index == nullptr)
+        return;
+    if (auto refFlat = dynamic_cast<const faiss::IndexRefineFlat*>(index)) {
+        stats.flat_bytes += refFlat->refine_index.xb.capacity() * sizeof(float);
+        accountIndex(refFlat->base_index, stats);
+    } else if (auto flat = dynamic_cast<const faiss::IndexFlat*>(index)) {
+        stats.flat_bytes += flat->xb.capacity() * sizeof(float);
+    } else if (auto ivf = dynamic_cast<const faiss::IndexIVF*>(index)) {
+        VectoDBStats quantizer{};
+        accountIndex(ivf->quantizer, quantizer);
+        stats.quantizer_bytes += quantizer.flat_bytes + quantizer.codes_bytes + quantizer.ids_bytes + quantizer.quantizer_bytes + quantizer.tables_bytes;
+        if (auto ails = dynamic_cast<const faiss::ArrayInvertedLists*>(ivf->invlists)) {
+            for (size_t i = 0; i < ails->nlist; i++) {
+                stats.codes_bytes += ails->codes[i].capacity();
+                stats.ids_bytes += ails->ids[i].capacity() * sizeof(faiss::Index::idx_t);
+            }
+            stats.codes_bytes += ails->codes.capacity() * sizeof(ails->codes[0]);
+            stats.ids_bytes += ails->ids.capacity() * sizeof(ails->ids[0]);
+        }
+        if (auto ivfpq = dynamic_cast<const faiss::IndexIVFPQ*>(index)) {
+            stats.tables_bytes += (ivfpq->pq.centroids.capacity() + ivfpq->pq.sdc_table.capacity() + ivfpq->precomputed_table.capacity()) * sizeof(float);
+        } else if (auto ivfsq = dynamic_cast<const faiss::IndexIVFScalarQuantizer*>(index)) {
+            stats.tables_bytes += ivfsq->sq.trained.capacity() * sizeof(float);
+        }
+    } else if (auto sq = dynamic_cast<const faiss::IndexScalarQuantizer*>(index)) {
+        stats.codes_bytes += sq->codes.capacity();
+        stats.tables_bytes += sq->sq.trained.capacity() * sizeof(float);
+    } else if (auto pq = dynamic_cast<const faiss::IndexPQ*>(index)) {
+        stats.codes_bytes += pq->codes.capacity();
+        stats.tables_bytes += (pq->pq.centroids.capacity() + pq->pq.sdc_table.capacity()) * sizeof(float);
+    }
+}
 
 struct DbState {
     DbState()
@@ -50,6 +403,23 @@ struct DbState {
         , refDumpedTotal(0L)
         , refFlat(nullptr)
         , initFlat(nullptr)
+        , tuneRecall(0.0)
+        , recallPeriod(0L)
+        , cntQueries(0L)
+        , stopRecall(false)
+        , recallSum(0.0)
+        , recallQueries(0L)
+        , ingestCap(0L)
+        , ingestReserved(0L)
+        , ingestPublished(0L)
+        , ingestFailed(-1L)
+        , stopIngest(false)
+        , coalesceWindow(0L)
+        , numaNode(-1L)
+        , replica(false)
+        , replicaMutation(-1L)
+        , replicaXidsInode(-1L)
+        , replicaFvecsInode(-1L)
     {
     }
     ~DbState()
@@ -72,14 +442,64 @@ struct DbState {
     faiss::IndexFlat* initFlat;
     vector<long> xids; //vector of xid of all vectors
     std::unordered_map<long, long> xid2num;
+    atomic<double> tuneRecall; //recall target of auto-tuning at rebuild, 0 means disabled
+
+    // Shadow sampling of queries against exact search over base files.
+    atomic<long> recallPeriod; //sample one of every recallPeriod queries, 0 means disabled
+    atomic<long> cntQueries;
+    mutex m_recall; //protects all following
+    condition_variable cv_recall;
+    bool stopRecall;
+    std::thread recallWorker;
+    deque<RecallSample> recallPending;
+    deque<double> recallWindow; //recall of the most recently evaluated queries
+    double recallSum; //sum of recallWindow
+    long recallQueries; //number of evaluated queries
+
+    // Ingest buffer. Producers reserve row slots atomically and copy in parallel, the publisher appends ready rows in batch.
+    // Slot s is row s % ingestCap of the ring, and it's ready when ingestReady[s % ingestCap] == s + 1.
+    long ingestCap;
+    vector<float> ingestXb;
+    vector<long> ingestXids;
+    std::unique_ptr<atomic<long>[]> ingestReady;
+    atomic<long> ingestReserved;
+    atomic<long> ingestPublished; //watermark, slots below it are visible to search or failed
+    atomic<long> ingestFailed; //the first slot which failed to be appended, -1 if none. All slots after it fail too.
+    mutex m_ingest; //protects all following
+    condition_variable cv_ingest; //notified when rows become ready
+    condition_variable cv_published; //notified when the watermark advances
+    bool stopIngest;
+    std::thread ingestPublisher;
+
+    // Coalescing of concurrent small searches.
+    atomic<long> coalesceWindow; //in microseconds, 0 means disabled
+    mutex m_coalesce; //protects coalescing and all open batches
+    std::shared_ptr<CoalescedBatch> coalescing; //the batch which is open for joining
+
+    atomic<long> numaNode; //the NUMA node which memory and search work are placed on, -1 means no placement
+
+    // Read replica which follows base files and snapshots of the primary in the same work_dir. Protected by m_sync.
+    bool replica;
+    Manifest replicaManifest; //the adopted snapshot, empty index if none
+    long replicaMutation; //base mutation whose removals have been applied
+    long replicaXidsInode; //base files which the rows are from, they change when the primary swaps base files
+    long replicaFvecsInode;
 };
 
+static long getInode(const string& fp)
+{
+    struct stat st;
+    if (stat(fp.c_str(), &st) < 0)
+        return -1L;
+    return st.st_ino;
+}
+
 struct VecExt {
     long count;
     vector<float> vec;
 };
 
-VectoDB::VectoDB(const char* work_dir_in, long dim_in, const char* index_key_in, const char* query_params_in)
+VectoDB::VectoDB(const char* work_dir_in, long dim_in, const char* index_key_in, const char* query_params_in, bool replica)
     : work_dir(work_dir_in)
     , dim(dim_in)
     , len_vec(dim * sizeof(float))
@@ -103,14 +523,47 @@ VectoDB::VectoDB(const char* work_dir_in, long dim_in, const char* index_key_in,
     state->fs_base_fvecs.exceptions(std::ios::failbit | std::ios::badbit);
     state->fs_base_xids.exceptions(std::ios::failbit | std::ios::badbit);
 
+    if (replica) {
+        // A replica never writes work_dir, it's owned by the primary.
+        state->replica = true;
+        state->replicaManifest = Manifest{ "", -1L, 0L, 0, 0, 0, -1L, -1L };
+        state->initFlat = new faiss::IndexFlat(dim, faiss::METRIC_INNER_PRODUCT);
+        SyncIndex();
+        return;
+    }
+
+    state->ingestCap = std::max(1024L, LEN_INGEST_BUFFER / len_vec);
+    state->ingestXb.resize(state->ingestCap * dim);
+    state->ingestXids.resize(state->ingestCap);
+    state->ingestReady.reset(new atomic<long>[state->ingestCap]);
+    for (long i = 0; i < state->ingestCap; i++)
+        state->ingestReady[i] = 0L;
+
+    fs::create_directories(work_dir);
+    recoverSwap();
     createBaseFilesIfNotExist();
     openBaseFiles();
     SyncIndex();
+    state->ingestPublisher = std::thread(&VectoDB::servePublish, this);
     google::FlushLogFiles(google::INFO);
 }
 
 VectoDB::~VectoDB()
 {
+    {
+        mtxlock l{ state->m_ingest };
+        state->stopIngest = true;
+    }
+    state->cv_ingest.notify_all();
+    if (state->ingestPublisher.joinable())
+        state->ingestPublisher.join();
+    {
+        mtxlock l{ state->m_recall };
+        state->stopRecall = true;
+    }
+    state->cv_recall.notify_all();
+    if (state->recallWorker.joinable())
+        state->recallWorker.join();
     long len_mut = sizeof(uint64_t);
     MunmapFile(fp_base_mutation, state->data_mut, len_mut);
     // There's no lock protection since I assume the object is idle.
@@ -123,8 +576,94 @@ VectoDB::~VectoDB()
 
 void VectoDB::AddWithIds(long nb, const float* xb, const long* xids)
 {
-    mtxlock m{ state->m_base };
-    wlock w{ state->rw_index };
+    if (state->replica)
+        throw fs::filesystem_error("database is a read replica", work_dir, error_code(EROFS, generic_category()));
+    if (state->ingestFailed >= 0)
+        throw fs::filesystem_error("base files failed to be appended", work_dir, error_code(EIO, generic_category()));
+    // Large batches are split so that each reservation fits in the ingest buffer.
+    const long cap = state->ingestCap;
+    const long max_batch = std::max(1L, cap / 4);
+    long end = 0;
+    for (long added = 0; added < nb;) {
+        long batch = std::min(max_batch, nb - added);
+        long begin = state->ingestReserved.fetch_add(batch);
+        end = begin + batch;
+        if (end - state->ingestPublished.load(std::memory_order_acquire) > cap) {
+            mtxlock l{ state->m_ingest };
+            state->cv_published.wait(l, [&] { return end - state->ingestPublished.load(std::memory_order_acquire) <= cap; });
+        }
+        for (long i = 0; i < batch; i++) {
+            long slot = (begin + i) % cap;
+            memcpy(&state->ingestXb[slot * dim], xb + (added + i) * dim, len_vec);
+            state->ingestXids[slot] = xids[added + i];
+            state->ingestReady[slot].store(begin + i + 1, std::memory_order_release);
+        }
+        // Passing through m_ingest orders the stores before the publisher's check of its wait predicate, so the notification is not lost.
+        {
+            mtxlock l{ state->m_ingest };
+        }
+        state->cv_ingest.notify_one();
+        added += batch;
+    }
+    // Wait until the publisher makes the vectors visible to search.
+    if (state->ingestPublished.load(std::memory_order_acquire) < end) {
+        mtxlock l{ state->m_ingest };
+        state->cv_published.wait(l, [&] { return state->ingestPublished.load(std::memory_order_acquire) >= end; });
+    }
+    long failed = state->ingestFailed;
+    if (failed >= 0 && end > failed)
+        throw fs::filesystem_error("base files failed to be appended", work_dir, error_code(EIO, generic_category()));
+}
+
+void VectoDB::servePublish()
+{
+    const long cap = state->ingestCap;
+    long node = -1L;
+    while (true) {
+        // Follow the placement, so that growth of id maps and flat codes is allocated on the node.
+        if (state->numaNode != node) {
+            node = state->numaNode;
+            setThreadNumaNode(node);
+        }
+        long begin = state->ingestPublished.load(std::memory_order_relaxed);
+        long end = begin;
+        while (end < begin + cap && state->ingestReady[end % cap].load(std::memory_order_acquire) == end + 1)
+            end++;
+        if (end == begin) {
+            // Rows reserved before the stop are still published.
+            auto ready = [&] { return state->ingestReady[begin % cap].load(std::memory_order_acquire) == begin + 1; };
+            mtxlock l{ state->m_ingest };
+            state->cv_ingest.wait(l, [&] { return ready() || (state->stopIngest && state->ingestReserved == begin); });
+            if (!ready())
+                return;
+            continue;
+        }
+        // After a failure, base files may end with a partial row, so the rows are failed until the database is reopened.
+        if (state->ingestFailed < 0) {
+            try {
+                mtxlock m{ state->m_base };
+                wlock w{ state->rw_index };
+                // The ready rows may wrap around the ring.
+                long slot = begin % cap;
+                long first = std::min(end - begin, cap - slot);
+                appendBase(first, &state->ingestXb[slot * dim], &state->ingestXids[slot]);
+                if (first < end - begin)
+                    appendBase(end - begin - first, &state->ingestXb[0], &state->ingestXids[0]);
+            } catch (const std::exception& e) {
+                LOG(ERROR) << "Failed to append " << end - begin << " vectors to base files of " << work_dir << ": " << e.what();
+                state->ingestFailed = begin;
+            }
+        }
+        {
+            mtxlock l{ state->m_ingest };
+            state->ingestPublished.store(end, std::memory_order_release);
+        }
+        state->cv_published.notify_all();
+    }
+}
+
+void VectoDB::appendBase(long nb, const float* xb, const long* xids)
+{
     state->fs_base_fvecs.write((const char*)xb, len_vec*nb);
     state->fs_base_xids.write((const char*)xids, sizeof(long)*nb);
     state->fs_base_fvecs.flush();
@@ -143,6 +682,8 @@ void VectoDB::AddWithIds(long nb, const float* xb, const long* xids)
 
 void VectoDB::RemoveIds(long nb, const long* xids)
 {
+    if (state->replica)
+        throw fs::filesystem_error("database is a read replica", work_dir, error_code(EROFS, generic_category()));
     mtxlock m{ state->m_base };
     wlock w{ state->rw_index };
     bool seeked = false;
@@ -155,7 +696,7 @@ void VectoDB::RemoveIds(long nb, const long* xids)
         state->xids[num] = -1L;
         state->xid2num.erase(it);
         xid = -1L;
-        state->fs_base_xids.seekp(num, ios_base::beg);
+        state->fs_base_xids.seekp(num * sizeof(long), ios_base::beg);
         state->fs_base_xids.write((const char*)&xid, sizeof(long));
         seeked = true;
     }
@@ -166,10 +707,65 @@ void VectoDB::RemoveIds(long nb, const long* xids)
     incBaseMutation();
 }
 
+VectoDBCursor* VectoDB::Scan(long uid_begin, long uid_end)
+{
+    std::unique_ptr<VectoDBCursor> cursor(new VectoDBCursor(dim, uid_begin, uid_end));
+    // Both files are mapped under m_base so that they have the same rows. The mappings survive the rename of base files by SyncIndex.
+    mtxlock m{ state->m_base };
+    cursor->fp_fvecs = fp_base_fvecs;
+    cursor->fp_xids = fp_base_xids;
+    MmapFile(fp_base_fvecs, cursor->data_fvecs, cursor->len_fvecs, false, true);
+    MmapFile(fp_base_xids, cursor->data_xids, cursor->len_xids, false, true);
+    cursor->total = std::min(cursor->len_fvecs / len_vec, cursor->len_xids / (long)sizeof(long));
+    return cursor.release();
+}
+
+VectoDBCursor::VectoDBCursor(long dim_in, long uid_begin_in, long uid_end_in)
+    : dim(dim_in)
+    , uid_begin(uid_begin_in)
+    , uid_end(uid_end_in)
+    , data_fvecs(nullptr)
+    , data_xids(nullptr)
+    , len_fvecs(0L)
+    , len_xids(0L)
+    , pos(0L)
+    , total(0L)
+{
+}
+
+VectoDBCursor::~VectoDBCursor()
+{
+    MunmapFile(fp_fvecs, data_fvecs, len_fvecs);
+    MunmapFile(fp_xids, data_xids, len_xids);
+}
+
+long VectoDBCursor::Next(long n, float* xb, long* xids)
+{
+    const long len_vec = dim * sizeof(float);
+    long cnt = 0;
+    for (; pos < total && cnt < n; pos++) {
+        long xid = *((const long*)data_xids + pos);
+        if (xid == -1L)
+            continue;
+        long uid = (long)((unsigned long)xid >> 32);
+        if (uid < uid_begin || (uid_end >= 0 && uid >= uid_end))
+            continue;
+        memcpy(xb + cnt * dim, data_fvecs + pos * len_vec, len_vec);
+        xids[cnt] = xid;
+        cnt++;
+    }
+    return cnt;
+}
+
 void VectoDB::SyncIndex()
 {
+    if (state->replica) {
+        followPrimary();
+        return;
+    }
     LOG(INFO) << "SyncIndex begin of " << work_dir;
     mtxlock ms{ state->m_sync };
+    NumaScope numa{ state->numaNode };
     long rawMutation = 0;
     {
         mtxlock m{ state->m_base };
@@ -184,43 +780,28 @@ void VectoDB::SyncIndex()
                 google::FlushLogFiles(google::INFO);
                 return;
             } else {
-                long mutation = 0;
-                long ntotal = 0;
-                getIndexFpLatest(mutation, ntotal);
                 rawMutation = getBaseMutationRaw();
-                if(ntotal>0 && mutation == rawMutation) {
-                    // Reuse existing index if mutation match.
-                    assert(rawTotal>=ntotal);
-                    uint8_t *data_xids, *data_fvecs;
-                    long len_xids, len_fvecs;
-                    vector<long> xids(rawTotal);
-                    unordered_map<long, long> xid2num;
-                    MmapFile(fp_base_xids, data_xids, len_xids);
-                    memcpy(&xids[0], data_xids, len_xids);
-                    MunmapFile(fp_base_xids, data_xids, len_xids);
-                    for(long i=0; i<rawTotal; i++){
-                        xid2num[xids[i]] = i;
+                Manifest man;
+                if (readManifest(man)) {
+                    // Removals after the snapshot are tombstones in base.xids, so the index is still valid for search.
+                    // A mutation mismatch only makes the next SyncIndex rebuild it.
+                    if (verifyManifest(man, rawTotal)) {
+                        loadIndex(work_dir + "/" + man.index, man.mutation, man.ntotal, rawTotal);
+                        LOG(INFO) << "SyncIndex end of " << work_dir;
+                        google::FlushLogFiles(google::INFO);
+                        return;
                     }
-
-                    const string fp_index = getIndexFp(mutation, ntotal);
-                    faiss::Index *refFlat = faiss::read_index(fp_index.c_str(), 0);
-                    LOG(INFO) << "Readed index " << fp_index;
-                    if(rawTotal > ntotal){
-                        LOG(INFO) << "Indexing another " << rawTotal-ntotal << " vectors of " << work_dir;
-                        MmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
-                        refFlat->add(rawTotal-ntotal, (float *)data_fvecs+dim*ntotal);
-                        MunmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
+                } else {
+                    // Work directories created before manifests were introduced.
+                    long mutation = 0;
+                    long ntotal = 0;
+                    getIndexFpLatest(mutation, ntotal);
+                    if (ntotal > 0 && mutation == rawMutation && rawTotal >= ntotal) {
+                        loadIndex(getIndexFp(mutation, ntotal), mutation, ntotal, rawTotal);
+                        LOG(INFO) << "SyncIndex end of " << work_dir;
+                        google::FlushLogFiles(google::INFO);
+                        return;
                     }
-
-                    state->refMutation = mutation;
-                    state->refDumpedTotal = rawTotal;
-                    state->refFlat = dynamic_cast<faiss::IndexRefineFlat *>(refFlat);
-                    state->initFlat = nullptr;
-                    state->xids = std::move(xids);
-                    state->xid2num = std::move(xid2num);
-                    LOG(INFO) << "SyncIndex end of " << work_dir;
-                    google::FlushLogFiles(google::INFO);
-                    return;
                 }
             }
         }
@@ -236,12 +817,14 @@ void VectoDB::SyncIndex()
                 google::FlushLogFiles(google::INFO);
                 return;
             }
-            clearIndexFiles();
-            // Output index
-            const string& fp_index = getIndexFp(state->refMutation, (long)state->xids.size());
-            faiss::write_index(state->refFlat, fp_index.c_str());
-            state->refDumpedTotal = (long)state->xids.size();
-            LOG(INFO) << "Dumped index to " << fp_index;
+            // Buffers reallocated by additions since the last sync are advised again, and left to khugepaged.
+            placeIndex(state->refFlat, -1L, false);
+            Manifest man;
+            dumpIndex(state->refFlat, state->refMutation, (long)state->xids.size(), man);
+            man.base_fingerprint = fingerprintBase(fp_base_fvecs, man.ntotal);
+            writeManifest(man);
+            clearIndexFiles(man.index);
+            state->refDumpedTotal = man.ntotal;
             google::FlushLogFiles(google::INFO);
             return;
         }
@@ -249,115 +832,96 @@ void VectoDB::SyncIndex()
         fs::remove(fp_base_xids_tmp);
         fs::remove(fp_base_fvecs_tmp);
         fs::remove(fp_base_mutation_tmp);
+        // base.fvecs is append-only, its prefix is compacted outside of the lock.
         fs::copy(fp_base_xids, fp_base_xids_tmp);
-        fs::copy(fp_base_fvecs, fp_base_fvecs_tmp);
         fs::copy(fp_base_mutation, fp_base_mutation_tmp);
-        LOG(INFO) << "Created temp files " << fp_base_xids_tmp << ", " << fp_base_fvecs_tmp << ", " << fp_base_mutation_tmp;
+        LOG(INFO) << "Created temp files " << fp_base_xids_tmp << ", " << fp_base_mutation_tmp;
     }
 
     long orig_cnt_xids, cnt_xids;
-    uint8_t *data_xids, *data_fvecs;
-    long len_xids, len_fvecs;
-    long i=0, j=0;
-    MmapFile(fp_base_xids_tmp, data_xids, len_xids);
-    MmapFile(fp_base_fvecs_tmp, data_fvecs, len_fvecs);
-    assert(len_xids/(long)sizeof(long) == len_fvecs/len_vec);
-    orig_cnt_xids = cnt_xids = len_xids/sizeof(long);
-    // locate first i, elements[i]=-1
-    for(; i<cnt_xids && *((long*)data_xids+i) != -1L; i++);
-    if(i<cnt_xids) {
-        j = i+1;
-        while(1){
-            // locate first j, elements[j]!=-1
-            for(; j<cnt_xids && *((long*)data_xids+j) == -1L; j++);
-            if(j>=cnt_xids)
-                break;
-            //move elements[j] to position i
-            memmove(data_xids+i*sizeof(long), data_xids+j*sizeof(long), sizeof(long));
-            memmove(data_fvecs+i*len_vec, data_fvecs+j*len_vec, len_vec);
-            i++;
-            j++;
-        }
-        cnt_xids = i;
-        fs::resize_file(fp_base_xids_tmp, cnt_xids*sizeof(long));
-        fs::resize_file(fp_base_fvecs_tmp, cnt_xids*len_vec);
-        LOG(INFO) << "Compacted temp files " << fp_base_xids_tmp << ", " << fp_base_fvecs_tmp;
-    }
-
-    faiss::Index* base_index;
-    faiss::IndexIVFFlat* index_ivf;
+    uint8_t* data_fvecs;
+    long len_fvecs;
     faiss::IndexRefineFlat* refFlat;
-    faiss::ParameterSpace params;
-    vector<long> xids(cnt_xids);
+    vector<long> xids;
     unordered_map<long, long> xid2num;
-    long nt = cnt_xids;
-    if(nt>DESIRED_NTRAIN)
-        nt = DESIRED_NTRAIN;
-    LOG(INFO) << "Training on " << nt << " vectors of " << work_dir;
-    base_index = faiss::index_factory(dim, index_key.c_str(), faiss::METRIC_INNER_PRODUCT);
-    // according to faiss/benchs/bench_hnsw.py, ivf_hnsw_quantizer.
-    index_ivf = dynamic_cast<faiss::IndexIVFFlat*>(base_index);
-    if (index_ivf != nullptr) {
-        index_ivf->cp.min_points_per_centroid = 5; //quiet warning
-        index_ivf->quantizer_trains_alone = 2;
-    }
-    base_index->train(nt, (const float*)data_fvecs);
-    params.initialize(base_index);
-    params.set_index_parameters(base_index, query_params.c_str());
-    LOG(INFO) << "Indexing " << cnt_xids << " vectors of " << work_dir;
-    refFlat = new faiss::IndexRefineFlat(base_index);
-    refFlat->own_fields = true;
-    refFlat->add(cnt_xids, (const float*)data_fvecs);
-    memcpy(&xids[0], data_xids, len_xids);
-    for(long i=0; i<cnt_xids; i++){
-        long& xid = *(long *)(data_xids + i*sizeof(long));
-        xid2num[xid] = i;
+    orig_cnt_xids = compactBaseFiles(xids, xid2num);
+    cnt_xids = xids.size();
+    MmapFile(fp_base_fvecs_tmp, data_fvecs, len_fvecs, false, true);
+    refFlat = buildIndex(cnt_xids, (const float*)data_fvecs);
+
+    // Catch up vectors added during the build in batches, outside of locks since refFlat is not published yet.
+    long caught = orig_cnt_xids;
+    while (true) {
+        vector<long> tail;
+        {
+            mtxlock m{ state->m_base };
+            if ((long)state->xids.size() - caught <= CATCHUP_LOCKED)
+                break;
+            tail.assign(state->xids.begin() + caught, state->xids.end());
+        }
+        catchUpIndex(refFlat, caught, tail, xids, xid2num);
+        caught += tail.size();
     }
+    // Pages allocated by OpenMP threads during the build are moved to the node.
+    placeIndex(refFlat, state->numaNode, true);
+    // Dump the index before activating it. On recovery, vectors after it are re-added from base files.
+    long dumped = xids.size();
+    Manifest man;
+    dumpIndex(refFlat, rawMutation, dumped, man);
 
-    {
+    // Until the manifest refers to it, the dumped index is an orphan which is removed on failure.
+    bool switched = false;
+    try {
+        mtxlock m{ state->m_base };
         wlock w{ state->rw_index };
-        if((long)state->xids.size()>orig_cnt_xids){
-            long gap = state->xids.size() - orig_cnt_xids;
-            LOG(INFO) << "Indexing another " << gap << " vectors of " << work_dir;
-            for(long i=0, j=0; i<gap; i++){
-                long xid = state->xids[orig_cnt_xids+i];
-                if(xid==-1L)
-                    continue;
-                refFlat->add(1, (float *)data_fvecs+dim*(orig_cnt_xids+i));
-                xids.push_back(xid);
-                xid2num[xid] = cnt_xids + j;
-                j++;
-            }
-        } else if(state->xids.empty() || rawMutation>=getBaseMutation()) {
-            mtxlock m{ state->m_base };
-            closeBaseFiles();
-            fs::remove(fp_base_xids);
-            fs::remove(fp_base_fvecs);
-            fs::remove(fp_base_mutation);
-            fs::create_hard_link(fp_base_xids_tmp, fp_base_xids);
-            fs::create_hard_link(fp_base_fvecs_tmp, fp_base_fvecs);
-            fs::create_hard_link(fp_base_mutation_tmp, fp_base_mutation);
-            openBaseFiles();
-            LOG(INFO) << "Copyied back temp files " << fp_base_xids_tmp << ", " << fp_base_fvecs_tmp << ", " << fp_base_mutation_tmp;
+        // Only the last few vectors are indexed inside of locks.
+        if ((long)state->xids.size() > caught) {
+            vector<long> tail(state->xids.begin() + caught, state->xids.end());
+            catchUpIndex(refFlat, caught, tail, xids, xid2num);
         }
+        // Rows removed during the build are still live in the temp files and the new index, they are tombstoned as RemoveIds does.
+        // The index keeps the old mutation, so that the next SyncIndex rebuilds without them.
+        const long mutation = getBaseMutation();
+        if (mutation != rawMutation)
+            tombstoneRemoved(orig_cnt_xids, cnt_xids, mutation, xids, xid2num);
+        // The manifest is switched to the new index before temp files replace base files.
+        // If it crashes in between, recoverSwap finishes the renames, so temp files must be durable before the manifest.
+        closeBaseFiles();
+        syncFile(fp_base_xids_tmp);
+        syncFile(fp_base_fvecs_tmp);
+        syncFile(fp_base_mutation_tmp);
+        man.base_fingerprint = fingerprintBase(fp_base_fvecs_tmp, man.ntotal);
+        man.swap = 1;
+        writeManifest(man);
+        switched = true;
+        fs::rename(fp_base_xids_tmp, fp_base_xids);
+        fs::rename(fp_base_fvecs_tmp, fp_base_fvecs);
+        fs::rename(fp_base_mutation_tmp, fp_base_mutation);
+        man.swap = 0;
+        writeManifest(man);
+        clearIndexFiles(man.index);
+        openBaseFiles();
+        LOG(INFO) << "Renamed temp files " << fp_base_xids_tmp << ", " << fp_base_fvecs_tmp << ", " << fp_base_mutation_tmp;
         if(state->initFlat)
             delete state->initFlat;
         else if(state->refFlat){
             delete state->refFlat;
         }
         state->refMutation = rawMutation;
-        state->refDumpedTotal = xids.size();
+        state->refDumpedTotal = dumped;
         state->refFlat = refFlat;
         state->initFlat = nullptr;
         state->xids = std::move(xids);
         state->xid2num = std::move(xid2num);
-        // Output index
-        const string& fp_index = getIndexFp(rawMutation, state->refDumpedTotal);
-        faiss::write_index(refFlat, fp_index.c_str());
-        LOG(INFO) << "Dumped index to " << fp_index;
+        LOG(INFO) << "Activated index of " << work_dir;
+    } catch (const std::exception&) {
+        if (!switched) {
+            error_code ec;
+            fs::remove(work_dir + "/" + man.index, ec);
+        }
+        throw;
     }
 
-    MunmapFile(fp_base_xids_tmp, data_xids, len_xids);
     MunmapFile(fp_base_fvecs_tmp, data_fvecs, len_fvecs);
     fs::remove(fp_base_xids_tmp);
     fs::remove(fp_base_fvecs_tmp);
@@ -367,53 +931,510 @@ void VectoDB::SyncIndex()
     google::FlushLogFiles(google::INFO);
 }
 
-void VectoDB::createBaseFilesIfNotExist()
+void VectoDB::AddFromFile(const char* fp_vecs_in, const char* fp_xids_in)
 {
-    fs::create_directories(work_dir);
-    if (!fs::is_regular_file(fp_base_xids) || !fs::is_regular_file(fp_base_fvecs) || !fs::is_regular_file(fp_base_mutation)) {
-        std::ofstream out1(fp_base_xids);
-        std::ofstream out2(fp_base_fvecs);
-        std::ofstream out3(fp_base_mutation);
-        if (!fs::is_regular_file(fp_base_mutation) || fs::file_size(fp_base_mutation)!=8) {
-            std::ofstream ofs;
-            ofs.open(fp_base_mutation, std::fstream::out | std::fstream::binary);
-            long zero = 0L;
-            ofs.write(reinterpret_cast<char*>(&zero), sizeof(zero));
-            ofs.close();
-            fs::resize_file(fp_base_mutation, 8);
+    const string fp_vecs(fp_vecs_in);
+    const string fp_xids(fp_xids_in == nullptr ? "" : fp_xids_in);
+    const string ext = fs::path(fp_vecs).extension().string();
+    // Each row of fvecs and bvecs is prefixed with its dimension as int32.
+    const long len_hdr = (ext == ".fvecs" || ext == ".bvecs") ? sizeof(int32_t) : 0;
+    const long len_elem = (ext == ".bvecs") ? sizeof(uint8_t) : sizeof(float);
+    const long len_row = len_hdr + dim * len_elem;
+    if (state->replica)
+        throw fs::filesystem_error("database is a read replica", work_dir, error_code(EROFS, generic_category()));
+    // The input is validated entirely before anything is written.
+    const long len_f = fs::file_size(fp_vecs);
+    if (len_f == 0 || len_f % len_row != 0)
+        throw fs::filesystem_error("weird file size", fp_vecs, error_code(EINVAL, generic_category()));
+    const long nb = len_f / len_row;
+    if (!fp_xids.empty() && (long)fs::file_size(fp_xids) != nb * (long)sizeof(long))
+        throw fs::filesystem_error("xids file size mismatch", fp_xids, error_code(EINVAL, generic_category()));
+    if (len_hdr != 0) {
+        uint8_t* data;
+        long len_data;
+        MmapFile(fp_vecs, data, len_data, false, true);
+        long i = 0;
+        while (i < nb && *(const int32_t*)(data + i * len_row) == dim)
+            i++;
+        MunmapFile(fp_vecs, data, len_data);
+        if (i < nb)
+            throw fs::filesystem_error("dimension mismatch at row " + std::to_string(i), fp_vecs, error_code(EINVAL, generic_category()));
+    }
+    LOG(INFO) << "AddFromFile begin of " << work_dir << ", " << nb << " vectors from " << fp_vecs;
+
+    mtxlock ms{ state->m_sync };
+    NumaScope numa{ state->numaNode };
+    mtxlock m{ state->m_base };
+    wlock w{ state->rw_index };
+    if (!state->xids.empty() || state->initFlat == nullptr)
+        throw fs::filesystem_error("database is not empty", work_dir, error_code(EEXIST, generic_category()));
+
+    // The input is loaded into temp files which replace the empty base files at last, so that a failure leaves base files untouched.
+    try {
+        if (len_hdr == 0 && !fp_xids.empty()) {
+            // The kernel copies the raw files without passing the data through user space.
+            fs::copy_file(fp_vecs, fp_base_fvecs_tmp, fs::copy_options::overwrite_existing);
+            fs::copy_file(fp_xids, fp_base_xids_tmp, fs::copy_options::overwrite_existing);
+        } else {
+            const long chunk = std::max(1L, LEN_LOAD_CHUNK / len_row);
+            std::ifstream ifs_vecs, ifs_xids;
+            std::ofstream ofs_fvecs, ofs_xids;
+            ifs_vecs.exceptions(std::ios::failbit | std::ios::badbit);
+            ifs_xids.exceptions(std::ios::failbit | std::ios::badbit);
+            ofs_fvecs.exceptions(std::ios::failbit | std::ios::badbit);
+            ofs_xids.exceptions(std::ios::failbit | std::ios::badbit);
+            ifs_vecs.open(fp_vecs, std::ifstream::binary);
+            if (!fp_xids.empty())
+                ifs_xids.open(fp_xids, std::ifstream::binary);
+            ofs_fvecs.open(fp_base_fvecs_tmp, std::ofstream::binary | std::ofstream::trunc);
+            ofs_xids.open(fp_base_xids_tmp, std::ofstream::binary | std::ofstream::trunc);
+            vector<uint8_t> rows(chunk * len_row);
+            vector<float> xb(len_hdr == 0 ? 0 : chunk * dim);
+            vector<long> xids(chunk);
+            for (long done = 0; done < nb;) {
+                long batch = std::min(chunk, nb - done);
+                ifs_vecs.read((char*)&rows[0], batch * len_row);
+                const float* data = (const float*)&rows[0];
+                if (len_hdr != 0) {
+                    for (long i = 0; i < batch; i++) {
+                        const uint8_t* row = &rows[i * len_row] + len_hdr;
+                        if (len_elem == sizeof(float))
+                            memcpy(&xb[i * dim], row, len_vec);
+                        else
+                            for (long j = 0; j < dim; j++)
+                                xb[i * dim + j] = (float)row[j];
+                    }
+                    data = &xb[0];
+                }
+                if (!fp_xids.empty()) {
+                    ifs_xids.read((char*)&xids[0], batch * sizeof(long));
+                } else {
+                    // Without an xids file, row numbers are the xids.
+                    for (long i = 0; i < batch; i++)
+                        xids[i] = done + i;
+                }
+                ofs_fvecs.write((const char*)data, len_vec * batch);
+                ofs_xids.write((const char*)&xids[0], sizeof(long) * batch);
+                done += batch;
+            }
+            ofs_fvecs.close();
+            ofs_xids.close();
         }
-        LOG(INFO) << "Created " << fp_base_xids << ", " << fp_base_fvecs << ", " << fp_base_mutation;
+    } catch (...) {
+        error_code ec;
+        fs::remove(fp_base_fvecs_tmp, ec);
+        fs::remove(fp_base_xids_tmp, ec);
+        throw;
+    }
+    syncFile(fp_base_fvecs_tmp);
+    syncFile(fp_base_xids_tmp);
+    closeBaseFiles();
+    fs::rename(fp_base_fvecs_tmp, fp_base_fvecs);
+    fs::rename(fp_base_xids_tmp, fp_base_xids);
+    openBaseFiles();
+    LOG(INFO) << "Loaded " << nb << " vectors into base files of " << work_dir;
+
+    uint8_t *data_xids, *data_fvecs;
+    long len_xids, len_fvecs;
+    vector<long> xids(nb);
+    unordered_map<long, long> xid2num;
+    xid2num.reserve(nb);
+    MmapFile(fp_base_xids, data_xids, len_xids);
+    memcpy(&xids[0], data_xids, len_xids);
+    MunmapFile(fp_base_xids, data_xids, len_xids);
+    for (long i = 0; i < nb; i++) {
+        xid2num[xids[i]] = i;
+    }
+
+    MmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
+    if (nb < DESIRED_NTRAIN) {
+        state->initFlat->add(nb, (const float*)data_fvecs);
+    } else {
+        faiss::IndexRefineFlat* refFlat = buildIndex(nb, (const float*)data_fvecs);
+        placeIndex(refFlat, state->numaNode, true);
+        delete state->initFlat;
+        state->initFlat = nullptr;
+        state->refFlat = refFlat;
+        state->refMutation = getBaseMutation();
+        state->refDumpedTotal = nb;
+        Manifest man;
+        dumpIndex(refFlat, state->refMutation, nb, man);
+        man.base_fingerprint = fingerprintBase(fp_base_fvecs, nb);
+        writeManifest(man);
+        clearIndexFiles(man.index);
     }
+    MunmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
+    state->xids = std::move(xids);
+    state->xid2num = std::move(xid2num);
+    LOG(INFO) << "AddFromFile end of " << work_dir;
+    google::FlushLogFiles(google::INFO);
 }
 
-void VectoDB::openBaseFiles()
+long VectoDB::compactBaseFiles(vector<long>& xids, unordered_map<long, long>& xid2num)
 {
-    //https://stackoverflow.com/questions/31483349/how-can-i-open-a-file-for-reading-writing-creating-it-if-it-does-not-exist-w
-    state->fs_base_fvecs.open(fp_base_fvecs, std::fstream::in | std::fstream::out | std::fstream::binary);
-    state->fs_base_fvecs.seekp(0, ios_base::end); //a particular libstdc++ implementation may use a single pointer for both seekg and seekp.
-    state->fs_base_xids.open(fp_base_xids, std::fstream::in | std::fstream::out | std::fstream::binary);
-    state->fs_base_xids.seekp(0, ios_base::end); //a particular libstdc++ implementation may use a single pointer for both seekg and seekp.
-    long len_mut = sizeof(uint64_t);
-    MmapFile(fp_base_mutation, state->data_mut, len_mut);
+    struct Run {
+        long src;
+        long dst;
+        long len;
+    };
+    // Runs are split at this size so that copying is balanced among threads.
+    const long max_run = std::max(1L, LEN_COMPACT_CHUNK / len_vec);
+    uint8_t *data_xids, *data_src, *data_dst;
+    long len_xids, len_src, len_dst;
+    vector<Run> runs;
+    MmapFile(fp_base_xids_tmp, data_xids, len_xids, false, true);
+    const long cnt_xids = len_xids / sizeof(long);
+    xids.clear();
+    xids.reserve(cnt_xids);
+    xid2num.clear();
+    xid2num.reserve(cnt_xids);
+    // Locate runs of live rows, and build the id map of the compacted base in the same pass.
+    for (long i = 0; i < cnt_xids; i++) {
+        long xid = *((long*)data_xids + i);
+        if (xid == -1L)
+            continue;
+        long num = xids.size();
+        if (!runs.empty() && runs.back().src + runs.back().len == i && runs.back().len < max_run)
+            runs.back().len++;
+        else
+            runs.push_back(Run{ i, num, 1 });
+        xids.push_back(xid);
+        xid2num[xid] = num;
+    }
+    MunmapFile(fp_base_xids_tmp, data_xids, len_xids);
+
+    const long cnt_live = xids.size();
+    if (cnt_live == cnt_xids) {
+        fs::copy_file(fp_base_fvecs, fp_base_fvecs_tmp, fs::copy_options::overwrite_existing);
+        fs::resize_file(fp_base_fvecs_tmp, cnt_xids * len_vec);
+        LOG(INFO) << "Created temp file " << fp_base_fvecs_tmp << ", nothing to compact";
+        return cnt_xids;
+    }
+    {
+        std::ofstream ofs(fp_base_xids_tmp, std::ofstream::binary | std::ofstream::trunc);
+        ofs.exceptions(std::ios::failbit | std::ios::badbit);
+        ofs.write((const char*)xids.data(), cnt_live * sizeof(long));
+        std::ofstream ofs2(fp_base_fvecs_tmp, std::ofstream::binary | std::ofstream::trunc);
+    }
+    fs::resize_file(fp_base_fvecs_tmp, cnt_live * len_vec);
+    MmapFile(fp_base_fvecs, data_src, len_src, false, true);
+    MmapFile(fp_base_fvecs_tmp, data_dst, len_dst, true, true);
+    assert(len_src >= cnt_xids * len_vec);
+#pragma omp parallel for schedule(dynamic)
+    for (long r = 0; r < (long)runs.size(); r++) {
+        memcpy(data_dst + runs[r].dst * len_vec, data_src + runs[r].src * len_vec, runs[r].len * len_vec);
+    }
+    MunmapFile(fp_base_fvecs_tmp, data_dst, len_dst);
+    MunmapFile(fp_base_fvecs, data_src, len_src);
+    LOG(INFO) << "Compacted " << cnt_xids << " vectors to " << cnt_live << " in " << runs.size() << " runs into " << fp_base_xids_tmp << ", " << fp_base_fvecs_tmp;
+    return cnt_xids;
 }
 
-void VectoDB::closeBaseFiles()
+void VectoDB::tombstoneRemoved(long orig_cnt_xids, long cnt_xids, long mutation, vector<long>& xids, unordered_map<long, long>& xid2num)
 {
-    long len_mut = sizeof(uint64_t);
-    if(state->data_mut!=nullptr)
-        MunmapFile(fp_base_mutation, state->data_mut, len_mut);
-    state->data_mut = nullptr;
-    state->fs_base_fvecs.close();
-    state->fs_base_xids.close();
+    std::fstream fs_xids(fp_base_xids_tmp, std::fstream::in | std::fstream::out | std::fstream::binary);
+    fs_xids.exceptions(std::ios::failbit | std::ios::badbit);
+    long cnt_removed = 0;
+    for (long num = 0; num < (long)xids.size(); num++) {
+        long xid = xids[num];
+        if (xid == -1L)
+            continue;
+        // Rows of the compacted prefix come from the copied base files, the others are caught up after it.
+        // A removed and re-added xid is live only in the part of its current row.
+        auto it = state->xid2num.find(xid);
+        if (it != state->xid2num.end() && (it->second < orig_cnt_xids) == (num < cnt_xids))
+            continue;
+        xids[num] = -1L;
+        auto it2 = xid2num.find(xid);
+        if (it2 != xid2num.end() && it2->second == num)
+            xid2num.erase(it2);
+        xid = -1L;
+        fs_xids.seekp(num * sizeof(long), ios_base::beg);
+        fs_xids.write((const char*)&xid, sizeof(long));
+        cnt_removed++;
+    }
+    // The mutation shall not go back when the temp files replace base files.
+    std::ofstream ofs_mut(fp_base_mutation_tmp, std::ofstream::binary | std::ofstream::trunc);
+    ofs_mut.exceptions(std::ios::failbit | std::ios::badbit);
+    ofs_mut.write((const char*)&mutation, sizeof(long));
+    LOG(INFO) << "Tombstoned " << cnt_removed << " vectors removed during the build of " << work_dir;
 }
 
-long VectoDB::GetTotal()
+void VectoDB::catchUpIndex(faiss::IndexRefineFlat* refFlat, long begin, const vector<long>& tail, vector<long>& xids, unordered_map<long, long>& xid2num)
 {
-    rlock l{ state->rw_index };
-    return state->xids.size();
+    uint8_t* data_fvecs;
+    long len_fvecs;
+    vector<float> xb;
+    vector<long> live;
+    xb.reserve(tail.size() * dim);
+    live.reserve(tail.size());
+    MmapFile(fp_base_fvecs, data_fvecs, len_fvecs, false, true);
+    assert(len_fvecs >= (begin + (long)tail.size()) * len_vec);
+    for (long i = 0; i < (long)tail.size(); i++) {
+        if (tail[i] == -1L)
+            continue;
+        const float* vec = (const float*)data_fvecs + (begin + i) * dim;
+        xb.insert(xb.end(), vec, vec + dim);
+        live.push_back(tail[i]);
+    }
+    MunmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
+    LOG(INFO) << "Indexing another " << live.size() << " vectors of " << work_dir;
+    if (live.empty())
+        return;
+    refFlat->add(live.size(), xb.data());
+    for (long xid : live) {
+        xid2num[xid] = xids.size();
+        xids.push_back(xid);
+    }
+    // Keep temp files consistent with the index, so that they can replace base files.
+    std::ofstream ofs_fvecs(fp_base_fvecs_tmp, std::ofstream::binary | std::ofstream::app);
+    std::ofstream ofs_xids(fp_base_xids_tmp, std::ofstream::binary | std::ofstream::app);
+    ofs_fvecs.exceptions(std::ios::failbit | std::ios::badbit);
+    ofs_xids.exceptions(std::ios::failbit | std::ios::badbit);
+    ofs_fvecs.write((const char*)xb.data(), live.size() * len_vec);
+    ofs_xids.write((const char*)live.data(), live.size() * sizeof(long));
+}
+
+faiss::IndexRefineFlat* VectoDB::buildIndex(long nb, const float* xb)
+{
+    faiss::Index* base_index;
+    faiss::IndexIVFFlat* index_ivf;
+    faiss::IndexRefineFlat* refFlat;
+    faiss::ParameterSpace params;
+    // Train on vectors evenly sampled from the whole base, which is more representative than a prefix.
+    long nt = nb;
+    const float* xt = xb;
+    vector<float> sample;
+    if (nt > DESIRED_NTRAIN) {
+        nt = DESIRED_NTRAIN;
+        sample.resize(nt * dim);
+        for (long i = 0; i < nt; i++)
+            memcpy(&sample[i * dim], xb + (i * nb / nt) * dim, len_vec);
+        xt = &sample[0];
+    }
+    LOG(INFO) << "Training on " << nt << " vectors of " << work_dir;
+    base_index = faiss::index_factory(dim, index_key.c_str(), faiss::METRIC_INNER_PRODUCT);
+    // according to faiss/benchs/bench_hnsw.py, ivf_hnsw_quantizer.
+    index_ivf = dynamic_cast<faiss::IndexIVFFlat*>(base_index);
+    if (index_ivf != nullptr) {
+        index_ivf->cp.min_points_per_centroid = 5; //quiet warning
+        index_ivf->quantizer_trains_alone = 2;
+    }
+    base_index->train(nt, xt);
+    params.initialize(base_index);
+    params.set_index_parameters(base_index, query_params.c_str());
+    LOG(INFO) << "Indexing " << nb << " vectors of " << work_dir;
+    refFlat = new faiss::IndexRefineFlat(base_index);
+    refFlat->own_fields = true;
+    refFlat->add(nb, xb);
+    const string fp_params = getIndexParamsFp();
+    double target = state->tuneRecall;
+    if (target > 0.0 && nb >= 2 * TUNE_K) {
+        const string chosen = tuneIndex(base_index, nb, xb, target);
+        std::ofstream ofs(fp_params, std::ofstream::trunc);
+        ofs << chosen << endl;
+        LOG(INFO) << "Persisted tuned query params " << chosen << " to " << fp_params;
+    } else {
+        fs::remove(fp_params);
+    }
+    return refFlat;
+}
+
+std::string VectoDB::tuneIndex(faiss::Index* index, long nb, const float* xb, double target) const
+{
+    // Only nprobe is explored, other parameters are fixed by query_params.
+    // Explore on the base index since refining doesn't change the set of top-k when k_factor is 1.
+    faiss::ParameterSpace params;
+    faiss::OperatingPoints ops;
+    params.verbose = 0;
+    params.initialize(index);
+    params.set_index_parameters(index, query_params.c_str());
+    auto& ranges = params.parameter_ranges;
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](const faiss::ParameterRange& pr) { return pr.name != "nprobe"; }), ranges.end());
+    if (ranges.empty() || ranges[0].values.empty()) {
+        LOG(INFO) << "Skipped tuning since index " << index_key << " has no nprobe";
+        return query_params;
+    }
+
+    // Queries are evenly sampled from base and held out of the index while exploring, otherwise each of them finds itself
+    // at any nprobe and the recall is inflated. Their exact ground truth is computed by brute force over the other rows.
+    const long nq = std::min(nb / 2, TUNE_NQ);
+    const long k_gt = 2 * TUNE_K;
+    vector<float> xq(nq * dim);
+    vector<faiss::Index::idx_t> held(nq);
+    for (long q = 0; q < nq; q++) {
+        held[q] = q * nb / nq;
+        memcpy(&xq[q * dim], xb + held[q] * dim, len_vec);
+    }
+    vector<float> knn_D(nq * k_gt);
+    vector<faiss::Index::idx_t> knn_I(nq * k_gt);
+    faiss::float_minheap_array_t knn = { size_t(nq), size_t(k_gt), knn_I.data(), knn_D.data() };
+    faiss::knn_inner_product(xq.data(), xb, dim, nq, nb, &knn);
+    // Held out rows are a small fraction of base, so the top-k of the other rows is within the top-2k of all rows.
+    vector<float> gt_D(nq * TUNE_K, -1.0f);
+    vector<faiss::Index::idx_t> gt_I(nq * TUNE_K, -1L);
+    for (long q = 0; q < nq; q++) {
+        long cnt = 0;
+        for (long i = 0; i < k_gt && cnt < TUNE_K; i++) {
+            faiss::Index::idx_t num = knn_I[q * k_gt + i];
+            if (num < 0 || std::binary_search(held.begin(), held.end(), num))
+                continue;
+            gt_D[q * TUNE_K + cnt] = knn_D[q * k_gt + i];
+            gt_I[q * TUNE_K + cnt] = num;
+            cnt++;
+        }
+    }
+    faiss::IntersectionCriterion crit(nq, TUNE_K);
+    crit.set_groundtruth(TUNE_K, gt_D.data(), gt_I.data());
+
+    LOG(INFO) << "Tuning nprobe for recall@" << TUNE_K << " " << target << " with " << nq << " held out queries of " << work_dir;
+    faiss::IDSelectorBatch sel(nq, held.data());
+    index->remove_ids(sel);
+    params.explore(index, nq, xq.data(), crit, &ops);
+    index->add_with_ids(nq, xq.data(), held.data());
+    // Optimal points are sorted by increasing perf and time, the first one which meets the target is the cheapest.
+    const faiss::OperatingPoint* chosen = &ops.optimal_pts.back();
+    for (const auto& op : ops.optimal_pts) {
+        if (op.perf >= target) {
+            chosen = &op;
+            break;
+        }
+    }
+    LOG(INFO) << "Tuned " << chosen->key << ", recall " << chosen->perf << ", " << chosen->t << "s for " << nq << " queries";
+    const string tuned = replaceParam(query_params, chosen->key);
+    params.set_index_parameters(index, tuned.c_str());
+    return tuned;
+}
+
+void VectoDB::setQueryParams(faiss::Index* index) const
+{
+    string params_str = query_params;
+    const string fp_params = getIndexParamsFp();
+    if (fs::is_regular_file(fp_params)) {
+        std::ifstream ifs(fp_params);
+        std::getline(ifs, params_str);
+        LOG(INFO) << "Loaded tuned query params " << params_str << " from " << fp_params;
+    }
+    faiss::ParameterSpace params;
+    params.set_index_parameters(index, params_str.c_str());
+}
+
+void VectoDB::SetTuneRecall(double recall)
+{
+    state->tuneRecall = recall;
+}
+
+void VectoDB::createBaseFilesIfNotExist()
+{
+    fs::create_directories(work_dir);
+    if (!fs::is_regular_file(fp_base_xids) || !fs::is_regular_file(fp_base_fvecs) || !fs::is_regular_file(fp_base_mutation)) {
+        std::ofstream out1(fp_base_xids);
+        std::ofstream out2(fp_base_fvecs);
+        std::ofstream out3(fp_base_mutation);
+        if (!fs::is_regular_file(fp_base_mutation) || fs::file_size(fp_base_mutation)!=8) {
+            std::ofstream ofs;
+            ofs.open(fp_base_mutation, std::fstream::out | std::fstream::binary);
+            long zero = 0L;
+            ofs.write(reinterpret_cast<char*>(&zero), sizeof(zero));
+            ofs.close();
+            fs::resize_file(fp_base_mutation, 8);
+        }
+        LOG(INFO) << "Created " << fp_base_xids << ", " << fp_base_fvecs << ", " << fp_base_mutation;
+    }
+}
+
+void VectoDB::openBaseFiles()
+{
+    //https://stackoverflow.com/questions/31483349/how-can-i-open-a-file-for-reading-writing-creating-it-if-it-does-not-exist-w
+    state->fs_base_fvecs.open(fp_base_fvecs, std::fstream::in | std::fstream::out | std::fstream::binary);
+    state->fs_base_fvecs.seekp(0, ios_base::end); //a particular libstdc++ implementation may use a single pointer for both seekg and seekp.
+    state->fs_base_xids.open(fp_base_xids, std::fstream::in | std::fstream::out | std::fstream::binary);
+    state->fs_base_xids.seekp(0, ios_base::end); //a particular libstdc++ implementation may use a single pointer for both seekg and seekp.
+    long len_mut = sizeof(uint64_t);
+    MmapFile(fp_base_mutation, state->data_mut, len_mut, true);
+}
+
+void VectoDB::closeBaseFiles()
+{
+    long len_mut = sizeof(uint64_t);
+    if(state->data_mut!=nullptr)
+        MunmapFile(fp_base_mutation, state->data_mut, len_mut);
+    state->data_mut = nullptr;
+    state->fs_base_fvecs.close();
+    state->fs_base_xids.close();
+}
+
+long VectoDB::GetTotal()
+{
+    rlock l{ state->rw_index };
+    return state->xids.size();
+}
+
+void VectoDB::Search(long nq, long k, const float* xq, const long* uids, float* scores, long* xids)
+{
+    long node = state->numaNode;
+    if (node >= 0 && getCurrentNumaNode() != node) {
+        // Route to the workers on the node which the index is placed on, instead of streaming it across the interconnect.
+        mutex m_done;
+        condition_variable cv_done;
+        bool done = false;
+        SearchAsync(nq, k, xq, uids, scores, xids, [&] {
+            mtxlock l{ m_done };
+            done = true;
+            cv_done.notify_one();
+        });
+        mtxlock l{ m_done };
+        cv_done.wait(l, [&] { return done; });
+        return;
+    }
+    long window = state->coalesceWindow;
+    if (window <= 0 || nq >= faiss::distance_compute_blas_threshold) {
+        searchBatch(nq, k, xq, uids, scores, xids);
+        return;
+    }
+    // Join the open batch, or open one and lead it.
+    mtxlock l{ state->m_coalesce };
+    auto& open = state->coalescing;
+    if (open != nullptr && (open->k != k || open->nq + nq > COALESCE_MAX_BATCH)) {
+        l.unlock();
+        searchBatch(nq, k, xq, uids, scores, xids);
+        return;
+    }
+    bool leader = (open == nullptr);
+    if (leader) {
+        open = std::make_shared<CoalescedBatch>();
+        open->k = k;
+    }
+    std::shared_ptr<CoalescedBatch> batch = open;
+    long offset = batch->nq;
+    batch->nq += nq;
+    batch->xq.insert(batch->xq.end(), xq, xq + nq * dim);
+    if (leader) {
+        // Wait until the window elapses, or the batch is large enough for faiss to take the BLAS path.
+        batch->cv.wait_for(l, std::chrono::microseconds(window), [&] { return batch->nq >= faiss::distance_compute_blas_threshold; });
+        open.reset();
+        l.unlock();
+        batch->scores.resize(batch->nq * k);
+        batch->xids.resize(batch->nq * k);
+        searchBatch(batch->nq, k, batch->xq.data(), nullptr, batch->scores.data(), batch->xids.data());
+        l.lock();
+        batch->done = true;
+        batch->cv.notify_all();
+    } else {
+        if (batch->nq >= faiss::distance_compute_blas_threshold)
+            batch->cv.notify_all();
+        batch->cv.wait(l, [&] { return batch->done; });
+    }
+    memcpy(scores, &batch->scores[offset * k], nq * k * sizeof(float));
+    memcpy(xids, &batch->xids[offset * k], nq * k * sizeof(long));
+}
+
+void VectoDB::SetSearchCoalesceWindow(long window_us)
+{
+    state->coalesceWindow = window_us;
 }
 
-void VectoDB::Search(long nq, long k, const float* xq, const long* /*uids*/, float* scores, long* xids)
+void VectoDB::searchBatch(long nq, long k, const float* xq, const long* /*uids*/, float* scores, long* xids)
 {
     for (int i = 0; i < nq*k; i++) {
         xids[i] = -1L;
@@ -462,9 +1483,456 @@ void VectoDB::Search(long nq, long k, const float* xq, const long* /*uids*/, flo
             }
         }
     }
+    if (state->refFlat != nullptr)
+        sampleQueries(nq, k, xq, xids);
     return;
 }
 
+void VectoDB::searchSet(long nq, long m, long k, const float* xq, long agg, float* scores, long* xids)
+{
+    for (long i = 0; i < nq * k; i++) {
+        xids[i] = -1L;
+        scores[i] = -1.0;
+    }
+    if (m <= 0)
+        return;
+    rlock l{ state->rw_index };
+    // Candidates are from the base index, and scored with full vectors once per set instead of being refined per member.
+    const faiss::Index* index = state->initFlat;
+    const float* xb = nullptr;
+    if (state->initFlat != nullptr) {
+        xb = state->initFlat->xb.data();
+    } else if (state->refFlat != nullptr) {
+        index = state->refFlat->base_index;
+        xb = state->refFlat->refine_index.xb.data();
+    }
+    if (index == nullptr || index->ntotal <= 0)
+        return;
+    // The mean of inner products with members is the inner product with their centroid, so a mean set is searched as its centroid.
+    const long nm = (agg == SET_AGG_MEAN) ? 1 : m;
+    vector<float> centroids;
+    const float* xc = xq;
+    if (agg == SET_AGG_MEAN) {
+        centroids.assign(nq * dim, 0.0f);
+        for (long q = 0; q < nq; q++)
+            for (long j = 0; j < m; j++)
+                for (long i = 0; i < dim; i++)
+                    centroids[q * dim + i] += xq[(q * m + j) * dim + i] / m;
+        xc = centroids.data();
+    }
+    const long kc = std::min(k * SET_CANDIDATE_FACTOR, (long)index->ntotal);
+    vector<float> D(nq * nm * kc);
+    vector<faiss::Index::idx_t> I(nq * nm * kc);
+    index->search(nq * nm, xc, kc, D.data(), I.data());
+
+#pragma omp parallel for if (nq > 1)
+    for (long q = 0; q < nq; q++) {
+        // Candidates found by several members are scored once.
+        vector<long> cands;
+        cands.reserve(nm * kc);
+        for (long i = q * nm * kc; i < (q + 1) * nm * kc; i++) {
+            if (I[i] >= 0 && state->xids[I[i]] != -1L)
+                cands.push_back(I[i]);
+        }
+        std::sort(cands.begin(), cands.end());
+        cands.erase(std::unique(cands.begin(), cands.end()), cands.end());
+        vector<std::pair<float, long>> ranked;
+        ranked.reserve(cands.size());
+        for (long num : cands) {
+            float best = -std::numeric_limits<float>::max();
+            for (long j = 0; j < nm; j++)
+                best = std::max(best, faiss::fvec_inner_product(xc + (q * nm + j) * dim, xb + num * dim, dim));
+            ranked.emplace_back(best, state->xids[num]);
+        }
+        if (agg == SET_AGG_UID_TOP1) {
+            // Keep the best xid of each uid, the high 32 bits of xid.
+            std::unordered_map<long, long> uid2pos;
+            long cnt = 0;
+            for (const auto& r : ranked) {
+                long uid = (long)((unsigned long)r.second >> 32);
+                auto it = uid2pos.find(uid);
+                if (it == uid2pos.end()) {
+                    uid2pos[uid] = cnt;
+                    ranked[cnt++] = r;
+                } else if (r.first > ranked[it->second].first) {
+                    ranked[it->second] = r;
+                }
+            }
+            ranked.resize(cnt);
+        }
+        const long n = std::min(k, (long)ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(), [](const std::pair<float, long>& a, const std::pair<float, long>& b) { return a.first > b.first; });
+        for (long i = 0; i < n; i++) {
+            scores[q * k + i] = ranked[i].first;
+            xids[q * k + i] = ranked[i].second;
+        }
+    }
+}
+
+struct SearchTask {
+    VectoDB* vdb;
+    long nq;
+    long k;
+    const float* xq;
+    float* scores;
+    long* xids;
+    std::function<void()> done;
+    std::function<void()> work; //if set, run by a worker alone instead of being batched
+};
+
+// SearchPool is a fixed pool of search workers per NUMA node. Each worker coalesces queued tasks of the same VectoDB and k into one batch.
+class SearchPool {
+public:
+    // Get the pool whose workers are pinned to the node. node < 0 means the pool of unpinned workers.
+    static SearchPool& Instance(long node)
+    {
+        static mutex m_pools;
+        static std::map<long, std::unique_ptr<SearchPool>> pools;
+        if (node < 0 || node >= NUMA_MAX_NODES)
+            node = -1L;
+        mtxlock l{ m_pools };
+        auto& pool = pools[node];
+        if (pool == nullptr)
+            pool.reset(new SearchPool(node));
+        return *pool;
+    }
+
+    void Submit(SearchTask&& task)
+    {
+        {
+            mtxlock l{ m_tasks };
+            tasks.push_back(std::move(task));
+        }
+        cv_tasks.notify_one();
+    }
+
+    ~SearchPool()
+    {
+        {
+            mtxlock l{ m_tasks };
+            stop = true;
+        }
+        cv_tasks.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+private:
+    explicit SearchPool(long node_in)
+        : node(node_in)
+        , stop(false)
+    {
+        long num_workers = std::thread::hardware_concurrency();
+        if (node >= 0)
+            num_workers = parseIdList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist").size();
+        num_workers = std::max(1L, num_workers);
+        for (long i = 0; i < num_workers; i++)
+            workers.emplace_back(&SearchPool::serve, this);
+    }
+
+
+    void serve()
+    {
+        if (node >= 0)
+            setThreadNumaNode(node);
+        while (true) {
+            vector<SearchTask> batch;
+            long nq = 0;
+            {
+                mtxlock l{ m_tasks };
+                cv_tasks.wait(l, [&] { return stop || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                batch.push_back(std::move(tasks.front()));
+                tasks.pop_front();
+                nq = batch[0].nq;
+                for (auto it = tasks.begin(); it != tasks.end() && !batch[0].work && nq < ASYNC_MAX_BATCH;) {
+                    if (it->vdb == batch[0].vdb && !it->work && it->k == batch[0].k && nq + it->nq <= ASYNC_MAX_BATCH) {
+                        nq += it->nq;
+                        batch.push_back(std::move(*it));
+                        it = tasks.erase(it);
+                    } else {
+                        it++;
+                    }
+                }
+            }
+            run(batch, nq);
+        }
+    }
+
+    // Tasks are searched with searchBatch directly. The pool batches tasks by itself, a worker shall not wait in the search coalescer.
+    void run(vector<SearchTask>& batch, long nq)
+    {
+        VectoDB* vdb = batch[0].vdb;
+        const long k = batch[0].k;
+        if (batch[0].work) {
+            batch[0].work();
+        } else if (batch.size() == 1) {
+            vdb->searchBatch(nq, k, batch[0].xq, nullptr, batch[0].scores, batch[0].xids);
+        } else {
+            const long dim = vdb->GetDim();
+            vector<float> xq(nq * dim);
+            vector<float> scores(nq * k);
+            vector<long> xids(nq * k);
+            long q = 0;
+            for (const auto& task : batch) {
+                memcpy(&xq[q * dim], task.xq, task.nq * dim * sizeof(float));
+                q += task.nq;
+            }
+            vdb->searchBatch(nq, k, xq.data(), nullptr, scores.data(), xids.data());
+            q = 0;
+            for (const auto& task : batch) {
+                memcpy(task.scores, &scores[q * k], task.nq * k * sizeof(float));
+                memcpy(task.xids, &xids[q * k], task.nq * k * sizeof(long));
+                q += task.nq;
+            }
+        }
+        for (auto& task : batch)
+            task.done();
+    }
+
+    const long node;
+    mutex m_tasks; //protects all following
+    condition_variable cv_tasks;
+    deque<SearchTask> tasks;
+    bool stop;
+    vector<std::thread> workers;
+};
+
+void VectoDB::SearchAsync(long nq, long k, const float* xq, const long* /*uids*/, float* scores, long* xids, std::function<void()> done)
+{
+    if (nq <= 0 || k <= 0) {
+        done();
+        return;
+    }
+    SearchPool::Instance(state->numaNode).Submit(SearchTask{ this, nq, k, xq, scores, xids, std::move(done), nullptr });
+}
+
+void VectoDB::SearchSet(long nq, long m, long k, const float* xq, long agg, float* scores, long* xids)
+{
+    if (agg != SET_AGG_MAX && agg != SET_AGG_MEAN && agg != SET_AGG_UID_TOP1)
+        throw fs::filesystem_error("invalid set aggregation " + std::to_string(agg), work_dir, error_code(EINVAL, generic_category()));
+    long node = state->numaNode;
+    if (node < 0 || getCurrentNumaNode() == node) {
+        searchSet(nq, m, k, xq, agg, scores, xids);
+        return;
+    }
+    // Route to the workers on the node which the index is placed on, like Search. Sets are not batched with other tasks.
+    mutex m_done;
+    condition_variable cv_done;
+    bool done = false;
+    SearchPool::Instance(node).Submit(SearchTask{ this, nq, k, xq, scores, xids, [&] {
+        mtxlock l{ m_done };
+        done = true;
+        cv_done.notify_one();
+    }, [&] { searchSet(nq, m, k, xq, agg, scores, xids); } });
+    mtxlock l{ m_done };
+    cv_done.wait(l, [&] { return done; });
+}
+
+long VectoDB::GetDim() const
+{
+    return dim;
+}
+
+void VectoDB::SetNumaNode(long node)
+{
+    if (node >= 0) {
+        vector<long> nodes = NumaNodes();
+        if (node >= NUMA_MAX_NODES || std::find(nodes.begin(), nodes.end(), node) == nodes.end())
+            throw fs::filesystem_error("NUMA node does not exist or has no memory", "/sys/devices/system/node/node" + std::to_string(node), error_code(EINVAL, generic_category()));
+    }
+    state->numaNode = node;
+    if (node < 0)
+        return;
+    NumaScope numa{ node };
+    mtxlock m{ state->m_base };
+    wlock w{ state->rw_index };
+    bindIndex(state->initFlat, node);
+    bindIndex(state->refFlat, node);
+    bindVector(state->xids, node);
+    // Nodes of the hash map are scattered over the heap, copying reallocates them under the memory policy.
+    std::unordered_map<long, long> xid2num(state->xid2num);
+    state->xid2num.swap(xid2num);
+    LOG(INFO) << "Placed " << work_dir << " on NUMA node " << node;
+}
+
+void VectoDB::SetRecallSamplePeriod(long period)
+{
+    state->recallPeriod = period;
+    if (period <= 0)
+        return;
+    mtxlock l{ state->m_recall };
+    if (!state->recallWorker.joinable())
+        state->recallWorker = std::thread(&VectoDB::serveRecall, this);
+}
+
+void VectoDB::GetStats(VectoDBStats& stats)
+{
+    stats = VectoDBStats{};
+    {
+        rlock l{ state->rw_index };
+        stats.total = state->xids.size();
+        accountIndex(state->initFlat, stats);
+        accountIndex(state->refFlat, stats);
+        stats.xids_bytes = state->xids.capacity() * sizeof(long);
+        // Each node of libstdc++ hash map holds the next pointer, the pair and the cached hash.
+        stats.xid2num_bytes = state->xid2num.bucket_count() * sizeof(void*) + state->xid2num.size() * (sizeof(void*) + sizeof(std::pair<const long, long>) + sizeof(size_t));
+    }
+    stats.ingest_bytes = state->ingestXb.capacity() * sizeof(float) + state->ingestXids.capacity() * sizeof(long) + state->ingestCap * sizeof(atomic<long>);
+    mtxlock l{ state->m_recall };
+    stats.recall_queries = state->recallQueries;
+    stats.recall_window = state->recallWindow.size();
+    stats.recall = state->recallWindow.empty() ? -1.0 : state->recallSum / state->recallWindow.size();
+}
+
+void VectoDB::GetListStats(vector<VectoDBListStats>& lists)
+{
+    lists.clear();
+    rlock l{ state->rw_index };
+    const faiss::IndexIVF* ivf = (state->refFlat == nullptr) ? nullptr : faiss::ivflib::try_extract_index_ivf(state->refFlat->base_index);
+    if (ivf == nullptr)
+        return;
+    auto ails = dynamic_cast<const faiss::ArrayInvertedLists*>(ivf->invlists);
+    lists.resize(ivf->nlist);
+    for (size_t i = 0; i < ivf->nlist; i++) {
+        lists[i].size = ivf->invlists->list_size(i);
+        if (ails != nullptr) {
+            lists[i].codes_bytes = ails->codes[i].capacity();
+            lists[i].ids_bytes = ails->ids[i].capacity() * sizeof(faiss::Index::idx_t);
+        }
+    }
+}
+
+void VectoDB::sampleQueries(long nq, long k, const float* xq, const long* xids)
+{
+    long period = state->recallPeriod;
+    if (period <= 0)
+        return;
+    long cnt = state->cntQueries.fetch_add(nq);
+    // the sampled queries are the ones whose global sequence number is a multiple of period
+    for (long q = (period - cnt % period) % period; q < nq; q += period) {
+        mtxlock l{ state->m_recall };
+        if ((long)state->recallPending.size() >= RECALL_MAX_PENDING)
+            return;
+        RecallSample sample{ k, vector<float>(xq + q * dim, xq + (q + 1) * dim), vector<long>(xids + q * k, xids + (q + 1) * k) };
+        state->recallPending.push_back(std::move(sample));
+        state->cv_recall.notify_one();
+    }
+}
+
+void VectoDB::serveRecall()
+{
+    // Shadow evaluation shall not compete with the foreground work.
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    while (true) {
+        deque<RecallSample> samples;
+        {
+            mtxlock l{ state->m_recall };
+            state->cv_recall.wait(l, [&] { return state->stopRecall || !state->recallPending.empty(); });
+            if (state->stopRecall)
+                return;
+            samples.swap(state->recallPending);
+        }
+        evalRecall(samples);
+    }
+}
+
+void VectoDB::evalRecall(const deque<RecallSample>& samples)
+{
+    uint8_t *data_xids, *data_fvecs;
+    long len_xids, len_fvecs;
+    {
+        mtxlock m{ state->m_base };
+        MmapFile(fp_base_xids, data_xids, len_xids, false, true);
+        MmapFile(fp_base_fvecs, data_fvecs, len_fvecs, false, true);
+    }
+    const long nb = std::min(len_xids / (long)sizeof(long), len_fvecs / len_vec);
+    const long nq = samples.size();
+    long kmax = 0;
+    for (const auto& sample : samples)
+        kmax = std::max(kmax, sample.k);
+    vector<float> xq(nq * dim);
+    vector<float> D(nq * kmax);
+    vector<long> I(nq * kmax);
+    for (long q = 0; q < nq; q++)
+        memcpy(&xq[q * dim], samples[q].xq.data(), len_vec);
+    // Removed rows are dropped before taking the exact top-k, otherwise they would take places of live rows and bias the recall.
+    // Live rows of each block are compacted and searched in one batch of all samples so that faiss takes the BLAS path,
+    // then the top-k of the block is merged into the overall one.
+    faiss::float_minheap_array_t res = { size_t(nq), size_t(kmax), I.data(), D.data() };
+    res.heapify();
+    const long block = std::max(1L, LEN_COMPACT_CHUNK / len_vec);
+    vector<float> xb_live;
+    vector<long> nums_live;
+    vector<float> D_block(nq * kmax);
+    vector<long> I_block(nq * kmax);
+    for (long b0 = 0; b0 < nb; b0 += block) {
+        const long b1 = std::min(nb, b0 + block);
+        nums_live.clear();
+        for (long num = b0; num < b1; num++) {
+            if (*((const long*)data_xids + num) != -1L)
+                nums_live.push_back(num);
+        }
+        const long cnt_live = nums_live.size();
+        if (cnt_live == 0)
+            continue;
+        const float* xb = (const float*)data_fvecs + b0 * dim;
+        if (cnt_live < b1 - b0) {
+            xb_live.resize(cnt_live * dim);
+            for (long i = 0; i < cnt_live; i++)
+                memcpy(&xb_live[i * dim], (const float*)data_fvecs + nums_live[i] * dim, len_vec);
+            xb = xb_live.data();
+        }
+        faiss::float_minheap_array_t res_block = { size_t(nq), size_t(kmax), I_block.data(), D_block.data() };
+        faiss::knn_inner_product(xq.data(), xb, dim, nq, cnt_live, &res_block);
+        for (long q = 0; q < nq; q++) {
+            float* simi = &D[q * kmax];
+            long* idxi = &I[q * kmax];
+            for (long i = 0; i < kmax; i++) {
+                long label = I_block[q * kmax + i];
+                float score = D_block[q * kmax + i];
+                if (label < 0 || score <= simi[0])
+                    break; //sorted in descending order
+                faiss::minheap_pop(kmax, simi, idxi);
+                faiss::minheap_push(kmax, simi, idxi, score, nums_live[label]);
+            }
+        }
+    }
+    res.reorder();
+    vector<double> recalls;
+    for (long q = 0; q < nq; q++) {
+        const RecallSample& sample = samples[q];
+        long total = 0, hit = 0;
+        for (long i = 0; i < sample.k; i++) {
+            long num = I[q * kmax + i];
+            if (num < 0)
+                break; //fewer live rows than k
+            long xid = *((long*)data_xids + num);
+            if (xid == -1L)
+                continue; //removed during the evaluation
+            total++;
+            if (std::find(sample.xids.begin(), sample.xids.end(), xid) != sample.xids.end())
+                hit++;
+        }
+        if (total > 0)
+            recalls.push_back((double)hit / total);
+    }
+    MunmapFile(fp_base_xids, data_xids, len_xids);
+    MunmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
+
+    mtxlock l{ state->m_recall };
+    for (double recall : recalls) {
+        state->recallWindow.push_back(recall);
+        state->recallSum += recall;
+        if ((long)state->recallWindow.size() > RECALL_WINDOW) {
+            state->recallSum -= state->recallWindow.front();
+            state->recallWindow.pop_front();
+        }
+    }
+    state->recallQueries += recalls.size();
+}
+
 long VectoDB::getBaseMutation() const
 {
     return *(uint64_t*)state->data_mut;
@@ -513,6 +1981,13 @@ std::string VectoDB::getBaseMutationFp() const
     return oss.str();
 }
 
+std::string VectoDB::getIndexParamsFp() const
+{
+    ostringstream oss;
+    oss << work_dir << "/" << index_key << ".params";
+    return oss.str();
+}
+
 std::string VectoDB::getIndexFp(long mutation, long ntotal) const
 {
     ostringstream oss;
@@ -542,7 +2017,7 @@ void VectoDB::getIndexFpLatest(long& mutation, long& ntotal) const
     }
 }
 
-void VectoDB::clearIndexFiles()
+void VectoDB::clearIndexFiles(const std::string& keep)
 {
     fs::path fp_index;
     const std::regex base_regex(index_key + R"(\.(\d+)\.(\d+)\.index)");
@@ -551,13 +2026,359 @@ void VectoDB::clearIndexFiles()
         const fs::path& p = ent->path();
         if (fs::is_regular_file(p)) {
             const string fn = p.filename().string();
-            if (std::regex_match(fn, base_match, base_regex)) {
+            if (std::regex_match(fn, base_match, base_regex) && fn != keep) {
                 fs::remove(p);
             }
         }
     }
 }
 
+void VectoDB::followPrimary()
+{
+    mtxlock ms{ state->m_sync };
+    NumaScope numa{ state->numaNode };
+    if (!fs::is_regular_file(fp_base_xids) || !fs::is_regular_file(fp_base_fvecs))
+        return;
+    // Snapshots dumped without swapping base files hold the same rows as the followed index, so they are not adopted.
+    Manifest man;
+    bool swapped = state->refFlat == nullptr || getInode(fp_base_fvecs) != state->replicaFvecsInode;
+    if (swapped && readManifest(man) && man.swap == 0 && (man.index != state->replicaManifest.index || man.index_checksum != state->replicaManifest.index_checksum))
+        adoptSnapshot(man);
+    followTail();
+}
+
+void VectoDB::adoptSnapshot(const Manifest& man)
+{
+    // The primary may swap base files at any time. The snapshot is adopted only if the manifest and base files
+    // are the same ones before and after reading it, otherwise it's retried in the next round.
+    const long inode_xids = getInode(fp_base_xids);
+    const long inode_fvecs = getInode(fp_base_fvecs);
+    const long mutation = getBaseMutationRaw();
+    const long rows = std::min(getBaseTotalRaw(), (long)fs::file_size(fp_base_fvecs) / len_vec);
+    if (!verifyManifest(man, rows))
+        return;
+    vector<long> xids;
+    unordered_map<long, long> xid2num;
+    faiss::IndexRefineFlat* refFlat = readSnapshot(work_dir + "/" + man.index, man.ntotal, rows, xids, xid2num);
+    Manifest man2;
+    if (!readManifest(man2) || man2.index != man.index || man2.swap != 0 || getInode(fp_base_xids) != inode_xids || getInode(fp_base_fvecs) != inode_fvecs) {
+        LOG(INFO) << "Primary swapped base files of " << work_dir << " during adoption, retry later";
+        delete refFlat;
+        return;
+    }
+    {
+        // Writers of the index and the xid maps, including SetNumaNode, are serialized by m_base.
+        mtxlock m{ state->m_base };
+        wlock w{ state->rw_index };
+        delete state->initFlat;
+        delete state->refFlat;
+        state->initFlat = nullptr;
+        state->refFlat = refFlat;
+        state->refMutation = man.mutation;
+        state->refDumpedTotal = man.ntotal;
+        state->xids = std::move(xids);
+        state->xid2num = std::move(xid2num);
+    }
+    state->replicaManifest = man;
+    state->replicaMutation = mutation;
+    state->replicaXidsInode = inode_xids;
+    state->replicaFvecsInode = inode_fvecs;
+    LOG(INFO) << "Adopted snapshot " << man.index << " of primary " << work_dir << ", rows " << rows;
+    google::FlushLogFiles(google::INFO);
+}
+
+void VectoDB::followTail()
+{
+    const long inode_xids = getInode(fp_base_xids);
+    const long inode_fvecs = getInode(fp_base_fvecs);
+    if (state->replicaXidsInode < 0) {
+        // No snapshot is adopted, rows are indexed by the flat index from the beginning of base files.
+        state->replicaXidsInode = inode_xids;
+        state->replicaFvecsInode = inode_fvecs;
+    } else if (inode_xids != state->replicaXidsInode || inode_fvecs != state->replicaFvecsInode) {
+        // Base files have been swapped, rows will be re-read with the next snapshot.
+        return;
+    }
+    const long mutation = getBaseMutationRaw();
+    uint8_t *data_xids, *data_fvecs;
+    long len_xids, len_fvecs;
+    MmapFile(fp_base_xids, data_xids, len_xids, false, true);
+    MmapFile(fp_base_fvecs, data_fvecs, len_fvecs, false, true);
+    if (getInode(fp_base_xids) == inode_xids && getInode(fp_base_fvecs) == inode_fvecs) {
+        // The primary appends base.fvecs before base.xids, only complete rows of both are followed.
+        const long rows = std::min(len_xids / (long)sizeof(long), len_fvecs / len_vec);
+        const long* base_xids = (const long*)data_xids;
+        mtxlock m{ state->m_base };
+        wlock w{ state->rw_index };
+        const long cnt_xids = state->xids.size();
+        if (mutation != state->replicaMutation) {
+            // Removals are tombstones in base.xids.
+            long removed = 0;
+            for (long i = 0; i < std::min(rows, cnt_xids); i++) {
+                if (base_xids[i] == -1L && state->xids[i] != -1L) {
+                    state->xid2num.erase(state->xids[i]);
+                    state->xids[i] = -1L;
+                    removed++;
+                }
+            }
+            state->replicaMutation = mutation;
+            if (removed > 0)
+                LOG(INFO) << "Applied " << removed << " removals of primary " << work_dir;
+        }
+        if (rows > cnt_xids) {
+            for (long i = cnt_xids; i < rows; i++) {
+                state->xids.push_back(base_xids[i]);
+                if (base_xids[i] != -1L)
+                    state->xid2num[base_xids[i]] = i;
+            }
+            const float* xb = (const float*)data_fvecs + cnt_xids * dim;
+            if (state->initFlat)
+                state->initFlat->add(rows - cnt_xids, xb);
+            else
+                state->refFlat->add(rows - cnt_xids, xb);
+        }
+    }
+    MunmapFile(fp_base_xids, data_xids, len_xids);
+    MunmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
+}
+
+std::string VectoDB::getManifestFp() const
+{
+    ostringstream oss;
+    oss << work_dir << "/MANIFEST";
+    return oss.str();
+}
+
+void VectoDB::loadIndex(const std::string& fp_index, long mutation, long ntotal, long rawTotal)
+{
+    vector<long> xids;
+    unordered_map<long, long> xid2num;
+    faiss::IndexRefineFlat* refFlat = readSnapshot(fp_index, ntotal, rawTotal, xids, xid2num);
+    state->refMutation = mutation;
+    state->refDumpedTotal = ntotal;
+    state->refFlat = refFlat;
+    state->initFlat = nullptr;
+    state->xids = std::move(xids);
+    state->xid2num = std::move(xid2num);
+}
+
+faiss::IndexRefineFlat* VectoDB::readSnapshot(const std::string& fp_index, long ntotal, long rawTotal, std::vector<long>& xids, std::unordered_map<long, long>& xid2num) const
+{
+    uint8_t *data_xids, *data_fvecs;
+    long len_xids, len_fvecs;
+    xids.resize(rawTotal);
+    xid2num.clear();
+    xid2num.reserve(rawTotal);
+    MmapFile(fp_base_xids, data_xids, len_xids, false, true);
+    memcpy(&xids[0], data_xids, rawTotal * sizeof(long));
+    MunmapFile(fp_base_xids, data_xids, len_xids);
+    for (long i = 0; i < rawTotal; i++) {
+        if (xids[i] != -1L)
+            xid2num[xids[i]] = i;
+    }
+
+    faiss::Index* index = faiss::read_index(fp_index.c_str(), 0);
+    faiss::IndexRefineFlat* refFlat = dynamic_cast<faiss::IndexRefineFlat*>(index);
+    LOG(INFO) << "Readed index " << fp_index;
+    setQueryParams(refFlat->base_index);
+    if (rawTotal > ntotal) {
+        LOG(INFO) << "Indexing another " << rawTotal - ntotal << " vectors of " << work_dir;
+        MmapFile(fp_base_fvecs, data_fvecs, len_fvecs, false, true);
+        refFlat->add(rawTotal - ntotal, (const float*)data_fvecs + dim * ntotal);
+        MunmapFile(fp_base_fvecs, data_fvecs, len_fvecs);
+    }
+    placeIndex(refFlat, state->numaNode, true);
+    return refFlat;
+}
+
+void VectoDB::dumpIndex(const faiss::Index* index, long mutation, long ntotal, Manifest& man) const
+{
+    const string fp_index = getIndexFp(mutation, ntotal);
+    faiss::write_index(index, fp_index.c_str());
+    syncFile(fp_index);
+    uint8_t* data;
+    long len;
+    MmapFile(fp_index, data, len, false, true);
+    struct stat st;
+    if (stat(fp_index.c_str(), &st) < 0)
+        throw fs::filesystem_error(fp_index, error_code(errno, generic_category()));
+    man.index = fs::path(fp_index).filename().string();
+    man.mutation = mutation;
+    man.ntotal = ntotal;
+    man.index_checksum = checksum(data, len);
+    man.base_fingerprint = 0;
+    man.swap = 0;
+    man.index_size = st.st_size;
+    man.index_mtime = getMtimeNs(st);
+    MunmapFile(fp_index, data, len);
+    LOG(INFO) << "Dumped index to " << fp_index;
+}
+
+uint64_t VectoDB::fingerprintBase(const std::string& fp_fvecs, long rows) const
+{
+    uint8_t* data;
+    long len;
+    MmapFile(fp_fvecs, data, len);
+    const long len_rows = std::min(len, rows * len_vec);
+    const long len_part = std::min(len_rows, LEN_FINGERPRINT);
+    uint64_t h = checksum(data, len_part, checksum((const uint8_t*)&len_rows, sizeof(len_rows)));
+    h = checksum(data + len_rows - len_part, len_part, h);
+    MunmapFile(fp_fvecs, data, len);
+    return h;
+}
+
+bool VectoDB::readManifest(Manifest& man) const
+{
+    const string fp_manifest = getManifestFp();
+    std::ifstream ifs(fp_manifest);
+    if (!ifs.is_open())
+        return false;
+    // Manifests written before index_size and index_mtime were introduced are verified by the checksum.
+    man = Manifest{ "", -1L, -1L, 0, 0, 0, -1L, -1L };
+    string body, line;
+    vector<std::pair<string, string>> fields;
+    uint64_t expected = 0;
+    bool sealed = false;
+    while (std::getline(ifs, line)) {
+        size_t pos = line.find('=');
+        if (pos == string::npos)
+            continue;
+        const string key = line.substr(0, pos);
+        const string val = line.substr(pos + 1);
+        if (key == "checksum") {
+            sealed = parseUint64(val, expected);
+            break;
+        }
+        body += line + "\n";
+        fields.emplace_back(key, val);
+    }
+    // Values are parsed only after the checksum is verified, and a malformed one still makes the manifest corrupted.
+    bool ok = sealed && expected == checksum((const uint8_t*)body.data(), body.size());
+    for (const auto& field : fields) {
+        if (!ok)
+            break;
+        const string& key = field.first;
+        const string& val = field.second;
+        if (key == "index")
+            man.index = val;
+        else if (key == "mutation")
+            ok = parseLong(val, man.mutation);
+        else if (key == "ntotal")
+            ok = parseLong(val, man.ntotal);
+        else if (key == "index_checksum")
+            ok = parseUint64(val, man.index_checksum);
+        else if (key == "base_fingerprint")
+            ok = parseUint64(val, man.base_fingerprint);
+        else if (key == "swap")
+            ok = parseLong(val, man.swap);
+        else if (key == "index_size")
+            ok = parseLong(val, man.index_size);
+        else if (key == "index_mtime")
+            ok = parseLong(val, man.index_mtime);
+    }
+    if (!ok || man.index.empty() || man.ntotal < 0) {
+        LOG(ERROR) << "Ignored corrupted manifest " << fp_manifest;
+        return false;
+    }
+    return true;
+}
+
+void VectoDB::writeManifest(const Manifest& man) const
+{
+    const string fp_manifest = getManifestFp();
+    const string fp_manifest_tmp = fp_manifest + ".tmp";
+    ostringstream oss;
+    oss << "index=" << man.index << "\n"
+        << "mutation=" << man.mutation << "\n"
+        << "ntotal=" << man.ntotal << "\n"
+        << "index_checksum=" << man.index_checksum << "\n"
+        << "base_fingerprint=" << man.base_fingerprint << "\n"
+        << "swap=" << man.swap << "\n"
+        << "index_size=" << man.index_size << "\n"
+        << "index_mtime=" << man.index_mtime << "\n";
+    const string body = oss.str();
+    const string content = body + "checksum=" + std::to_string(checksum((const uint8_t*)body.data(), body.size())) + "\n";
+    // Write to a temp file, and rename it over the manifest after it's durable.
+    int f = open(fp_manifest_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f < 0)
+        throw fs::filesystem_error(fp_manifest_tmp, error_code(errno, generic_category()));
+    bool ok = write(f, content.data(), content.size()) == (ssize_t)content.size() && fsync(f) == 0;
+    int err = errno;
+    close(f);
+    if (!ok)
+        throw fs::filesystem_error(fp_manifest_tmp, error_code(err, generic_category()));
+    fs::rename(fp_manifest_tmp, fp_manifest);
+    int d = open(work_dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (d >= 0) {
+        fsync(d);
+        close(d);
+    }
+    LOG(INFO) << "Wrote manifest " << fp_manifest << " of index " << man.index << ", ntotal " << man.ntotal << ", swap " << man.swap;
+}
+
+bool VectoDB::verifyManifest(const Manifest& man, long rawTotal) const
+{
+    const string fp_index = work_dir + "/" + man.index;
+    struct stat st;
+    if (stat(fp_index.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+        LOG(ERROR) << "Index " << fp_index << " of manifest is missing";
+        return false;
+    }
+    if (rawTotal < man.ntotal || fingerprintBase(fp_base_fvecs, man.ntotal) != man.base_fingerprint) {
+        LOG(ERROR) << "Base files of " << work_dir << " don't match the manifest";
+        return false;
+    }
+    // The index file is immutable once dumped. If its size and mtime are unchanged, checksumming the whole file is skipped.
+    if (st.st_size == man.index_size && getMtimeNs(st) == man.index_mtime)
+        return true;
+    LOG(INFO) << "Index " << fp_index << " changed size or mtime since dumped, verifying its checksum";
+    uint8_t* data;
+    long len;
+    MmapFile(fp_index, data, len, false, true);
+    uint64_t sum = checksum(data, len);
+    MunmapFile(fp_index, data, len);
+    if (sum != man.index_checksum) {
+        LOG(ERROR) << "Index " << fp_index << " doesn't match checksum of the manifest";
+        return false;
+    }
+    return true;
+}
+
+void VectoDB::recoverSwap()
+{
+    Manifest man;
+    if (!readManifest(man) || man.swap == 0)
+        return;
+    // Renaming is atomic, the base file is either the old one or the new one. A missing temp file has been renamed.
+    for (const auto& fps : { std::make_pair(fp_base_xids_tmp, fp_base_xids), std::make_pair(fp_base_fvecs_tmp, fp_base_fvecs), std::make_pair(fp_base_mutation_tmp, fp_base_mutation) }) {
+        if (fs::exists(fps.first)) {
+            fs::rename(fps.first, fps.second);
+            LOG(INFO) << "Recovered interrupted swap, renamed " << fps.first << " to " << fps.second;
+        }
+    }
+    man.swap = 0;
+    writeManifest(man);
+}
+
+void SetHugePages(bool enable)
+{
+    hugePages = enable;
+}
+
+vector<long> NumaNodes()
+{
+    // Possible nodes may be offline, and online nodes may have no memory. Neither can hold a database.
+    vector<long> nodes = parseIdList("/sys/devices/system/node/has_memory");
+    if (nodes.empty())
+        nodes = parseIdList("/sys/devices/system/node/online");
+    return nodes;
+}
+
+long NumaNodeCount()
+{
+    return std::max(1L, (long)NumaNodes().size());
+}
+
 void ClearDir(const char* work_dir)
 {
     fs::remove_all(work_dir);
@@ -576,21 +2397,26 @@ void NormVec(float* vec, int dim)
     }
 }
 
-void MmapFile(const std::string& fp, uint8_t*& data, long& len_data)
+void MmapFile(const std::string& fp, uint8_t*& data, long& len_data, bool writable, bool sequential)
 {
     data = nullptr;
     len_data = 0;
     long len_f = fs::file_size(fp); //equivalent to "fs_base_fvecs.seekp(0, ios_base::end); long len_f = fs_base_fvecs.tellp();"
     if (len_f == 0)
         return;
-    int f = open(fp.c_str(), O_RDONLY);
-    void* tmpd = mmap(NULL, len_f, PROT_READ, MAP_SHARED, f, 0);
+    int f = open(fp.c_str(), writable ? O_RDWR : O_RDONLY);
+    void* tmpd = mmap(NULL, len_f, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, f, 0);
     if (tmpd == MAP_FAILED)
         throw fs::filesystem_error(fp, error_code(errno, generic_category()));
     close(f);
-    int rc = madvise(tmpd, len_f, MADV_RANDOM | MADV_DONTDUMP);
+    int rc = madvise(tmpd, len_f, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    if (rc == 0)
+        rc = madvise(tmpd, len_f, MADV_DONTDUMP);
     if (rc < 0)
         LOG(ERROR) << "madvise failed with " << strerror(errno);
+    // File backed huge pages depend on the file system, failure is not an error.
+    if (hugePages)
+        madvise(tmpd, len_f, MADV_HUGEPAGE);
     data = (uint8_t*)tmpd;
     len_data = len_f;
 }
@@ -610,25 +2436,72 @@ void MunmapFile(const std::string& fp, uint8_t*& data, long& len_data)
  * C wrappers
  */
 
+// Exceptions shall not cross the C boundary. They are logged and converted to errno values.
+static int catchError(const char* op, const std::function<void()>& fn)
+{
+    try {
+        fn();
+    } catch (const fs::filesystem_error& e) {
+        LOG(ERROR) << op << " failed: " << e.what();
+        return e.code().value() != 0 ? e.code().value() : EIO;
+    } catch (const std::exception& e) {
+        LOG(ERROR) << op << " failed: " << e.what();
+        return EIO;
+    }
+    return 0;
+}
+
 void* VectodbNew(char* work_dir, long dim)
 {
     VectoDB* vdb = new VectoDB(work_dir, dim);
     return vdb;
 }
 
+void* VectodbNewReplica(char* work_dir, long dim)
+{
+    VectoDB* vdb = new VectoDB(work_dir, dim, "IVF4096,PQ32", "nprobe=256", true);
+    return vdb;
+}
+
+void* VectodbNewWithIndex(char* work_dir, long dim, char* index_key, char* query_params, int replica)
+{
+    VectoDB* vdb = new VectoDB(work_dir, dim, index_key, query_params, replica != 0);
+    return vdb;
+}
+
 void VectodbDelete(void* vdb)
 {
     delete static_cast<VectoDB*>(vdb);
 }
 
-void VectodbAddWithIds(void* vdb, long nb, float* xb, long* xids)
+int VectodbAddWithIds(void* vdb, long nb, float* xb, long* xids)
+{
+    return catchError("AddWithIds", [&] { static_cast<VectoDB*>(vdb)->AddWithIds(nb, xb, xids); });
+}
+
+int VectodbAddFromFile(void* vdb, char* fp_vecs, char* fp_xids)
 {
-    static_cast<VectoDB*>(vdb)->AddWithIds(nb, xb, xids);
+    return catchError("AddFromFile", [&] { static_cast<VectoDB*>(vdb)->AddFromFile(fp_vecs, fp_xids); });
 }
 
-void VectodbRemoveIds(void* vdb, long nb, long* xids)
+int VectodbRemoveIds(void* vdb, long nb, long* xids)
 {
-    static_cast<VectoDB*>(vdb)->RemoveIds(nb, xids);
+    return catchError("RemoveIds", [&] { static_cast<VectoDB*>(vdb)->RemoveIds(nb, xids); });
+}
+
+void* VectodbScanOpen(void* vdb, long uid_begin, long uid_end)
+{
+    return static_cast<VectoDB*>(vdb)->Scan(uid_begin, uid_end);
+}
+
+long VectodbScanNext(void* cursor, long n, float* xb, long* xids)
+{
+    return static_cast<VectoDBCursor*>(cursor)->Next(n, xb, xids);
+}
+
+void VectodbScanClose(void* cursor)
+{
+    delete static_cast<VectoDBCursor*>(cursor);
 }
 
 void VectodbSyncIndex(void* vdb)
@@ -642,11 +2515,95 @@ long VectodbGetTotal(void* vdb)
     return static_cast<VectoDB*>(vdb)->GetTotal();
 }
 
+void VectodbSetSearchCoalesceWindow(void* vdb, long window_us)
+{
+    static_cast<VectoDB*>(vdb)->SetSearchCoalesceWindow(window_us);
+}
+
+int VectodbSetNumaNode(void* vdb, long node)
+{
+    return catchError("SetNumaNode", [&] { static_cast<VectoDB*>(vdb)->SetNumaNode(node); });
+}
+
+void VectodbSetRecallSamplePeriod(void* vdb, long period)
+{
+    static_cast<VectoDB*>(vdb)->SetRecallSamplePeriod(period);
+}
+
+void VectodbSetTuneRecall(void* vdb, double recall)
+{
+    static_cast<VectoDB*>(vdb)->SetTuneRecall(recall);
+}
+
+void VectodbGetStats(void* vdb, VectodbStats* stats)
+{
+    VectoDBStats st;
+    static_cast<VectoDB*>(vdb)->GetStats(st);
+    stats->total = st.total;
+    stats->recall_queries = st.recall_queries;
+    stats->recall_window = st.recall_window;
+    stats->recall = st.recall;
+    stats->flat_bytes = st.flat_bytes;
+    stats->codes_bytes = st.codes_bytes;
+    stats->ids_bytes = st.ids_bytes;
+    stats->quantizer_bytes = st.quantizer_bytes;
+    stats->tables_bytes = st.tables_bytes;
+    stats->xids_bytes = st.xids_bytes;
+    stats->xid2num_bytes = st.xid2num_bytes;
+    stats->ingest_bytes = st.ingest_bytes;
+}
+
+long VectodbGetListStats(void* vdb, long max_lists, long* sizes, long* codes_bytes, long* ids_bytes)
+{
+    vector<VectoDBListStats> lists;
+    static_cast<VectoDB*>(vdb)->GetListStats(lists);
+    long n = std::min((long)lists.size(), max_lists);
+    for (long i = 0; i < n; i++) {
+        sizes[i] = lists[i].size;
+        codes_bytes[i] = lists[i].codes_bytes;
+        ids_bytes[i] = lists[i].ids_bytes;
+    }
+    return lists.size();
+}
+
 void VectodbSearch(void* vdb, long nq, long k, float* xq, long* uids, float* scores, long* xids)
 {
     static_cast<VectoDB*>(vdb)->Search(nq, k, xq, uids, scores, xids);
 }
 
+int VectodbSearchSet(void* vdb, long nq, long m, long k, float* xq, long agg, float* scores, long* xids)
+{
+    return catchError("SearchSet", [&] { static_cast<VectoDB*>(vdb)->SearchSet(nq, m, k, xq, agg, scores, xids); });
+}
+
+// Completion queue of async searches submitted via the C API.
+static mutex m_completed;
+static condition_variable cv_completed;
+static deque<long> completed_tags;
+
+void VectodbSearchSubmit(void* vdb, long nq, long k, float* xq, long* uids, float* scores, long* xids, long tag)
+{
+    static_cast<VectoDB*>(vdb)->SearchAsync(nq, k, xq, uids, scores, xids, [tag]() {
+        {
+            mtxlock l{ m_completed };
+            completed_tags.push_back(tag);
+        }
+        cv_completed.notify_one();
+    });
+}
+
+long VectodbSearchWaitCompleted(long timeout_ms, long* tags, long max_tags)
+{
+    mtxlock l{ m_completed };
+    cv_completed.wait_for(l, std::chrono::milliseconds(timeout_ms), [] { return !completed_tags.empty(); });
+    long n = 0;
+    for (; n < max_tags && !completed_tags.empty(); n++) {
+        tags[n] = completed_tags.front();
+        completed_tags.pop_front();
+    }
+    return n;
+}
+
 void VectodbClearDir(char* work_dir)
 {
     ClearDir(work_dir);
@@ -656,3 +2613,21 @@ void VectodbNormVec(float* vec, int dim)
 {
     NormVec(vec, dim);
 }
+
+void VectodbSetHugePages(int enable)
+{
+    SetHugePages(enable != 0);
+}
+
+long VectodbNumaNodeCount()
+{
+    return NumaNodeCount();
+}
+
+long VectodbNumaNodes(long* nodes, long max_nodes)
+{
+    vector<long> ids = NumaNodes();
+    long n = std::min((long)ids.size(), max_nodes);
+    std::copy(ids.begin(), ids.begin() + n, nodes);
+    return n;
+}
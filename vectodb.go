@@ -10,8 +10,12 @@ package vectodb
 import "C"
 
 import (
+	"sync"
+	"sync/atomic"
+	"syscall"
 	"unsafe"
 
+	"github.com/pkg/errors"
 	log "github.com/sirupsen/logrus"
 )
 
@@ -35,6 +39,42 @@ func NewVectoDB(workDir string, dimIn int) (vdb *VectoDB, err error) {
 	return
 }
 
+//NewVectoDBReplica 打开主库workDir的只读副本。副本不写workDir，SyncIndex跟随主库的基础文件增删并采用主库发布的索引快照，无需自己训练。
+func NewVectoDBReplica(workDir string, dimIn int) (vdb *VectoDB, err error) {
+	log.Infof("creating VectoDB replica %v", workDir)
+	wordDirC := C.CString(workDir)
+	vdbC := C.VectodbNewReplica(wordDirC, C.long(dimIn))
+	vdb = &VectoDB{
+		vdbC:    vdbC,
+		dim:     dimIn,
+		workDir: workDir,
+	}
+	C.free(unsafe.Pointer(wordDirC))
+	return
+}
+
+//NewVectoDBWithIndex 以指定的索引类型和查询参数打开workDir。replica为true时打开只读副本。
+func NewVectoDBWithIndex(workDir string, dimIn int, indexKey, queryParams string, replica bool) (vdb *VectoDB, err error) {
+	log.Infof("creating VectoDB %v with index %v %v", workDir, indexKey, queryParams)
+	wordDirC := C.CString(workDir)
+	indexKeyC := C.CString(indexKey)
+	queryParamsC := C.CString(queryParams)
+	var replicaC C.int
+	if replica {
+		replicaC = 1
+	}
+	vdbC := C.VectodbNewWithIndex(wordDirC, C.long(dimIn), indexKeyC, queryParamsC, replicaC)
+	vdb = &VectoDB{
+		vdbC:    vdbC,
+		dim:     dimIn,
+		workDir: workDir,
+	}
+	C.free(unsafe.Pointer(wordDirC))
+	C.free(unsafe.Pointer(indexKeyC))
+	C.free(unsafe.Pointer(queryParamsC))
+	return
+}
+
 func (vdb *VectoDB) Destroy() (err error) {
 	log.Infof("destroying VectoDB %+v", vdb)
 	C.VectodbDelete(vdb.vdbC)
@@ -46,13 +86,83 @@ func (vdb *VectoDB) Destroy() (err error) {
 input parameters:
 @param xb:   nb个向量
 @param xids: nb个向量编号。xid 64 bit结构：高32 bit为uid（用户ID），低32 bit为pid（图片ID）
+基础文件写入失败（如磁盘已满）时返回错误，部分向量可能已写入；之后的写入都会失败，直到重新打开数据库
 */
 func (vdb *VectoDB) AddWithIds(xb []float32, xids []int64) (err error) {
 	nb := len(xids)
 	if len(xb) != nb*vdb.dim {
 		log.Fatalf("invalid length of xb, want %v, have %v", nb*vdb.dim, len(xb))
 	}
-	C.VectodbAddWithIds(vdb.vdbC, C.long(nb), (*C.float)(&xb[0]), (*C.long)(&xids[0]))
+	rc := C.VectodbAddWithIds(vdb.vdbC, C.long(nb), (*C.float)(&xb[0]), (*C.long)(&xids[0]))
+	err = vdb.cError("AddWithIds", rc)
+	return
+}
+
+//RemoveIds 删除编号为xids的向量，不存在的编号被忽略。只读副本上返回错误
+func (vdb *VectoDB) RemoveIds(xids []int64) (err error) {
+	if len(xids) == 0 {
+		return
+	}
+	rc := C.VectodbRemoveIds(vdb.vdbC, C.long(len(xids)), (*C.long)(&xids[0]))
+	err = vdb.cError("RemoveIds", rc)
+	return
+}
+
+/*
+AddFromFile 从文件批量导入空数据库并一次性构建索引。写入前先校验全部输入，失败时基础文件保持不变。
+input parameters:
+@param fpVecs: 向量文件。按扩展名识别格式：.fvecs, .bvecs, 其他视为raw float32
+@param fpXids: 向量编号文件（raw int64），可选。为空时使用行号作为向量编号
+*/
+func (vdb *VectoDB) AddFromFile(fpVecs, fpXids string) (err error) {
+	fpVecsC := C.CString(fpVecs)
+	fpXidsC := C.CString(fpXids)
+	rc := C.VectodbAddFromFile(vdb.vdbC, fpVecsC, fpXidsC)
+	C.free(unsafe.Pointer(fpVecsC))
+	C.free(unsafe.Pointer(fpXidsC))
+	err = vdb.cError("AddFromFile", rc)
+	return
+}
+
+//cError 将C接口返回的errno转换为错误，0表示成功
+func (vdb *VectoDB) cError(op string, rc C.int) error {
+	if rc == 0 {
+		return nil
+	}
+	return errors.Errorf("VectoDB %v %v failed: %v", vdb.workDir, op, syscall.Errno(rc))
+}
+
+type VectoDBCursor struct {
+	cursorC unsafe.Pointer
+	dim     int
+}
+
+/*
+Scan 打开游标，按基础文件顺序流式读取未删除的向量，不阻塞写入。
+@param uidBegin: uid下界（含）
+@param uidEnd:   uid上界（不含），-1表示无上界
+*/
+func (vdb *VectoDB) Scan(uidBegin, uidEnd int64) (cur *VectoDBCursor, err error) {
+	cur = &VectoDBCursor{
+		cursorC: C.VectodbScanOpen(vdb.vdbC, C.long(uidBegin), C.long(uidEnd)),
+		dim:     vdb.dim,
+	}
+	return
+}
+
+//Next 读取至多n个向量及其编号，读完时返回空
+func (cur *VectoDBCursor) Next(n int) (xb []float32, xids []int64, err error) {
+	xb = make([]float32, n*cur.dim)
+	xids = make([]int64, n)
+	cnt := int(C.VectodbScanNext(cur.cursorC, C.long(n), (*C.float)(&xb[0]), (*C.long)(&xids[0])))
+	xb = xb[:cnt*cur.dim]
+	xids = xids[:cnt]
+	return
+}
+
+func (cur *VectoDBCursor) Close() (err error) {
+	C.VectodbScanClose(cur.cursorC)
+	cur.cursorC = nil
 	return
 }
 
@@ -67,6 +177,99 @@ func (vdb *VectoDB) GetTotal() (total int, err error) {
 	return
 }
 
+type VectoDBStats struct {
+	Total         int     //向量总数
+	RecallQueries int     //已评估的采样查询数
+	RecallWindow  int     //Recall所平均的最近采样查询数
+	Recall        float64 //最近采样查询的recall@k均值，未知时为-1
+	//各组件常驻内存字节数
+	FlatBytes      int //refine flat索引（或初始flat索引）的原始向量
+	CodesBytes     int //倒排表编码，或非IVF基础索引的编码
+	IdsBytes       int //倒排表id
+	QuantizerBytes int //IVF粗量化器
+	TablesBytes    int //PQ码本、预计算表和SQ训练参数
+	XidsBytes      int //xids向量
+	Xid2numBytes   int //xid到行号的映射（估算）
+	IngestBytes    int //写入缓冲区
+}
+
+//MemoryBytes 返回各组件常驻内存字节数之和
+func (stats *VectoDBStats) MemoryBytes() int {
+	return stats.FlatBytes + stats.CodesBytes + stats.IdsBytes + stats.QuantizerBytes + stats.TablesBytes + stats.XidsBytes + stats.Xid2numBytes + stats.IngestBytes
+}
+
+//SetSearchCoalesceWindow 合并并发的小查询：第一个查询最多等待windowUs微秒，与其他查询合并成批后统一检索。windowUs为0时关闭。仅作用于Search，SearchAsync由线程池自行合并，不等待窗口。
+func (vdb *VectoDB) SetSearchCoalesceWindow(windowUs int) (err error) {
+	C.VectodbSetSearchCoalesceWindow(vdb.vdbC, C.long(windowUs))
+	return
+}
+
+//SetNumaNode 将数据库放置到NUMA节点：索引和编号映射迁移到该节点内存，其他节点发起的查询转由绑定在该节点的线程执行。node为-1时取消放置。
+//node须为VectodbNumaNodes()之一，否则返回错误。
+func (vdb *VectoDB) SetNumaNode(node int) (err error) {
+	rc := C.VectodbSetNumaNode(vdb.vdbC, C.long(node))
+	err = vdb.cError("SetNumaNode", rc)
+	return
+}
+
+//SetRecallSamplePeriod 每period个查询采样一个，在后台与精确检索结果比较以估计召回率。period为0时关闭采样。
+func (vdb *VectoDB) SetRecallSamplePeriod(period int) (err error) {
+	C.VectodbSetRecallSamplePeriod(vdb.vdbC, C.long(period))
+	return
+}
+
+//SetTuneRecall 重建索引时自动调参，选择满足recall@10目标的最小nprobe并持久化到索引旁。recall为0时关闭。
+func (vdb *VectoDB) SetTuneRecall(recall float64) (err error) {
+	C.VectodbSetTuneRecall(vdb.vdbC, C.double(recall))
+	return
+}
+
+func (vdb *VectoDB) GetStats() (stats VectoDBStats, err error) {
+	var statsC C.VectodbStats
+	C.VectodbGetStats(vdb.vdbC, &statsC)
+	stats = VectoDBStats{
+		Total:         int(statsC.total),
+		RecallQueries: int(statsC.recall_queries),
+		RecallWindow:  int(statsC.recall_window),
+		Recall:        float64(statsC.recall),
+
+		FlatBytes:      int(statsC.flat_bytes),
+		CodesBytes:     int(statsC.codes_bytes),
+		IdsBytes:       int(statsC.ids_bytes),
+		QuantizerBytes: int(statsC.quantizer_bytes),
+		TablesBytes:    int(statsC.tables_bytes),
+		XidsBytes:      int(statsC.xids_bytes),
+		Xid2numBytes:   int(statsC.xid2num_bytes),
+		IngestBytes:    int(statsC.ingest_bytes),
+	}
+	return
+}
+
+//VectoDBListStats IVF倒排表的统计，用于发现不均衡的倒排表
+type VectoDBListStats struct {
+	Size       int //倒排表中的向量数
+	CodesBytes int //编码常驻内存字节数
+	IdsBytes   int //id常驻内存字节数
+}
+
+//GetListStats 返回IVF索引各倒排表的统计。索引为flat或非IVF时为空
+func (vdb *VectoDB) GetListStats() (lists []VectoDBListStats, err error) {
+	nlist := int(C.VectodbGetListStats(vdb.vdbC, 0, nil, nil, nil))
+	if nlist == 0 {
+		return
+	}
+	sizes := make([]int64, nlist)
+	codesBytes := make([]int64, nlist)
+	idsBytes := make([]int64, nlist)
+	// The index may be rebuilt in between, with the same nlist of index_key.
+	n := int(C.VectodbGetListStats(vdb.vdbC, C.long(nlist), (*C.long)(&sizes[0]), (*C.long)(&codesBytes[0]), (*C.long)(&idsBytes[0])))
+	lists = make([]VectoDBListStats, MinInt(n, nlist))
+	for i := range lists {
+		lists[i] = VectoDBListStats{Size: int(sizes[i]), CodesBytes: int(codesBytes[i]), IdsBytes: int(idsBytes[i])}
+	}
+	return
+}
+
 type XidScore struct {
 	Xid   int64
 	Score float32
@@ -98,7 +301,42 @@ func (vdb *VectoDB) Search(k int, xq []float32, uids []string) (res [][]XidScore
 	xids := make([]int64, nq*k)
 	var uidsFilter int64
 	C.VectodbSearch(vdb.vdbC, C.long(nq), C.long(k), (*C.float)(&xq[0]), (*C.long)(&uidsFilter), (*C.float)(&scores[0]), (*C.long)(&xids[0]))
-	for i := 0; i < nq; i++ {
+	fillResults(res, k, scores, xids)
+	return
+}
+
+const (
+	SetAggMax     int = 0 //成员向量得分的最大值
+	SetAggMean    int = 1 //成员向量得分的均值
+	SetAggUidTop1 int = 2 //成员向量得分的最大值，每个uid只保留最好的xid
+)
+
+/**
+SearchSet 集合检索。每个逻辑查询由m个向量组成，各成员共享候选集并在检索内按agg聚合得分，直接返回前k个结果。
+input parameters:
+@param m:       每个集合的向量数
+@param k:       kNN参数k
+@param xq:      nq个集合，共nq*m个查询向量
+@param agg:     得分聚合方式，SetAggMax, SetAggMean或SetAggUidTop1，其他值返回错误
+*/
+func (vdb *VectoDB) SearchSet(m, k int, xq []float32, agg int) (res [][]XidScore, err error) {
+	nq := len(xq) / (m * vdb.dim)
+	if len(xq) != nq*m*vdb.dim {
+		log.Fatalf("invalid length of xq, want %v, have %v", nq*m*vdb.dim, len(xq))
+	}
+	res = make([][]XidScore, nq)
+	scores := make([]float32, nq*k)
+	xids := make([]int64, nq*k)
+	rc := C.VectodbSearchSet(vdb.vdbC, C.long(nq), C.long(m), C.long(k), (*C.float)(&xq[0]), C.long(agg), (*C.float)(&scores[0]), (*C.long)(&xids[0]))
+	if err = vdb.cError("SearchSet", rc); err != nil {
+		return
+	}
+	fillResults(res, k, scores, xids)
+	return
+}
+
+func fillResults(res [][]XidScore, k int, scores []float32, xids []int64) {
+	for i := 0; i < len(res); i++ {
 		for j := 0; j < k; j++ {
 			if xids[i*k+j] == int64(-1) {
 				break
@@ -106,7 +344,81 @@ func (vdb *VectoDB) Search(k int, xq []float32, uids []string) (res [][]XidScore
 			res[i] = append(res[i], XidScore{Xid: xids[i*k+j], Score: scores[i*k+j]})
 		}
 	}
-	return
+}
+
+type SearchResult struct {
+	Res [][]XidScore
+	Err error
+}
+
+type asyncSearch struct {
+	nq     int
+	k      int
+	xq     *C.float
+	scores *C.float
+	xids   *C.long
+	ch     chan SearchResult
+}
+
+var (
+	asyncOnce    sync.Once
+	asyncTag     int64
+	asyncPending sync.Map //tag -> *asyncSearch
+)
+
+/**
+SearchAsync 异步检索。查询由C++线程池执行，并发的小查询会被合并成批。结果通过返回的channel送达。
+参数同Search。查询向量为空或k不为正时，channel送达错误。
+*/
+func (vdb *VectoDB) SearchAsync(k int, xq []float32, uids []string) (ch <-chan SearchResult) {
+	nq := len(xq) / vdb.dim
+	if len(xq) != nq*vdb.dim {
+		log.Fatalf("invalid length of xq, want %v, have %v", nq*vdb.dim, len(xq))
+	}
+	if nq == 0 || k <= 0 {
+		errCh := make(chan SearchResult, 1)
+		errCh <- SearchResult{Err: errors.Errorf("VectoDB %v SearchAsync: invalid nq %v or k %v", vdb.workDir, nq, k)}
+		return errCh
+	}
+	// C++ keeps the buffers after VectodbSearchSubmit returns, so they must not be Go memory.
+	as := &asyncSearch{
+		nq:     nq,
+		k:      k,
+		xq:     (*C.float)(C.malloc(C.size_t(len(xq) * SIZEOF_FLOAT32))),
+		scores: (*C.float)(C.malloc(C.size_t(nq * k * SIZEOF_FLOAT32))),
+		xids:   (*C.long)(C.malloc(C.size_t(nq * k * 8))),
+		ch:     make(chan SearchResult, 1),
+	}
+	copy((*[1 << 30]float32)(unsafe.Pointer(as.xq))[:len(xq):len(xq)], xq)
+	tag := atomic.AddInt64(&asyncTag, 1)
+	asyncPending.Store(tag, as)
+	asyncOnce.Do(func() { go dispatchAsyncSearch() })
+	C.VectodbSearchSubmit(vdb.vdbC, C.long(nq), C.long(k), as.xq, nil, as.scores, as.xids, C.long(tag))
+	return as.ch
+}
+
+// dispatchAsyncSearch delivers results of completed async searches. It's the only goroutine which waits in C for them.
+func dispatchAsyncSearch() {
+	tags := make([]int64, 256)
+	for {
+		n := int(C.VectodbSearchWaitCompleted(C.long(100), (*C.long)(&tags[0]), C.long(len(tags))))
+		for _, tag := range tags[:n] {
+			v, ok := asyncPending.Load(tag)
+			if !ok {
+				log.Errorf("async search tag %v is unknown", tag)
+				continue
+			}
+			asyncPending.Delete(tag)
+			as := v.(*asyncSearch)
+			cnt := as.nq * as.k
+			res := make([][]XidScore, as.nq)
+			fillResults(res, as.k, (*[1 << 30]float32)(unsafe.Pointer(as.scores))[:cnt:cnt], (*[1 << 27]int64)(unsafe.Pointer(as.xids))[:cnt:cnt])
+			C.free(unsafe.Pointer(as.xq))
+			C.free(unsafe.Pointer(as.scores))
+			C.free(unsafe.Pointer(as.xids))
+			as.ch <- SearchResult{Res: res}
+		}
+	}
 }
 
 /**
@@ -120,3 +432,27 @@ func VectodbClearWorkDir(workDir string) (err error) {
 	C.free(unsafe.Pointer(wordDirC))
 	return
 }
+
+//VectodbNumaNodeCount 返回本机有内存的NUMA节点数
+func VectodbNumaNodeCount() int {
+	return int(C.VectodbNumaNodeCount())
+}
+
+//VectodbNumaNodes 返回本机有内存的NUMA节点编号，编号可能不连续。内核未提供NUMA拓扑时为空
+func VectodbNumaNodes() (nodes []int) {
+	ids := make([]int64, 1024)
+	n := int(C.VectodbNumaNodes((*C.long)(&ids[0]), C.long(len(ids))))
+	for _, id := range ids[:n] {
+		nodes = append(nodes, int(id))
+	}
+	return
+}
+
+//VectodbSetHugePages 索引结构和映射的基础文件使用透明大页以减少TLB miss，对之后构建或加载的索引生效
+func VectodbSetHugePages(enable bool) {
+	var enableC C.int
+	if enable {
+		enableC = 1
+	}
+	C.VectodbSetHugePages(enableC)
+}
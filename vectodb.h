@@ -4,22 +4,77 @@
 extern "C" {
 #endif
 
+typedef struct {
+    long total;
+    long recall_queries;
+    long recall_window;
+    double recall;
+    long flat_bytes;
+    long codes_bytes;
+    long ids_bytes;
+    long quantizer_bytes;
+    long tables_bytes;
+    long xids_bytes;
+    long xid2num_bytes;
+    long ingest_bytes;
+} VectodbStats;
+
 /**
  * Constructor and destructor methods.
+ * Methods which return int return 0 on success, or an errno value on failure. The failure is logged.
  */
 void* VectodbNew(char* work_dir, long dim);
+void* VectodbNewReplica(char* work_dir, long dim);
+void* VectodbNewWithIndex(char* work_dir, long dim, char* index_key, char* query_params, int replica);
 void VectodbDelete(void* vdb);
-void VectodbAddWithIds(void* vdb, long nb, float* xb, long* xids);
-void VectodbRemoveIds(long nb, long* xids);
+int VectodbAddWithIds(void* vdb, long nb, float* xb, long* xids);
+int VectodbAddFromFile(void* vdb, char* fp_vecs, char* fp_xids);
+int VectodbRemoveIds(void* vdb, long nb, long* xids);
 void VectodbSearch(void* vdb, long nq, long k, float* xq, long* uids, float* scores, long* xids);
 void VectodbSyncIndex(void* vdb);
+
+/**
+ * Set search. xq holds nq sets of m vectors, agg is 0 for max, 1 for mean, 2 for max and only the best xid of each uid.
+ */
+int VectodbSearchSet(void* vdb, long nq, long m, long k, float* xq, long agg, float* scores, long* xids);
+
+/**
+ * Scan methods.
+ * VectodbScanOpen opens a cursor over live vectors whose uid is in [uid_begin, uid_end), uid_end -1 means no upper bound.
+ * VectodbScanNext fetches up to n vectors and returns the number of them, 0 at the end.
+ */
+void* VectodbScanOpen(void* vdb, long uid_begin, long uid_end);
+long VectodbScanNext(void* cursor, long n, float* xb, long* xids);
+void VectodbScanClose(void* cursor);
+
+/**
+ * Asynchronous search methods.
+ * VectodbSearchSubmit queues a query batch to the worker pool and returns immediately. xq, scores and xids shall be kept valid until completion.
+ * VectodbSearchWaitCompleted waits up to timeout_ms for completed submissions, outputs their tags and returns the number of them.
+ */
+void VectodbSearchSubmit(void* vdb, long nq, long k, float* xq, long* uids, float* scores, long* xids, long tag);
+long VectodbSearchWaitCompleted(long timeout_ms, long* tags, long max_tags);
 long VectodbGetTotal(void* vdb);
+void VectodbSetSearchCoalesceWindow(void* vdb, long window_us);
+int VectodbSetNumaNode(void* vdb, long node);
+void VectodbSetRecallSamplePeriod(void* vdb, long period);
+void VectodbSetTuneRecall(void* vdb, double recall);
+void VectodbGetStats(void* vdb, VectodbStats* stats);
+
+/**
+ * Output sizes and resident bytes of up to max_lists inverted lists of the IVF index, and return the number of lists.
+ * It returns 0 if the index is flat or not IVF.
+ */
+long VectodbGetListStats(void* vdb, long max_lists, long* sizes, long* codes_bytes, long* ids_bytes);
 
 /**
  * Static methods.
  */
 void VectodbClearDir(char* work_dir);
 void VectodbNormVec(float* vec, int dim);
+long VectodbNumaNodeCount();
+long VectodbNumaNodes(long* nodes, long max_nodes);
+void VectodbSetHugePages(int enable);
 
 
 #ifdef __cplusplus
@@ -1,15 +1,90 @@
 #pragma once
 
+#include <deque>
+#include <functional>
 #include <memory> //std::shared_ptr
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class DbState;
+class SearchPool;
+struct Manifest;
+struct RecallSample;
 namespace faiss {
 class Index;
+struct IndexRefineFlat;
 };
 //class faiss::Index;
 
+struct VectoDBStats {
+    long total; //number of vectors, the same as GetTotal()
+    long recall_queries; //number of sampled queries evaluated against exact search
+    long recall_window; //number of the most recently evaluated queries which recall is averaged over
+    double recall; //recall@k averaged over the most recently sampled queries, -1 if unknown
+    // Resident bytes by component. Capacities of the containers are counted.
+    long flat_bytes; //full vectors of the refine flat index, or of the initial flat index
+    long codes_bytes; //codes of inverted lists, or of a non-IVF base index
+    long ids_bytes; //ids of inverted lists
+    long quantizer_bytes; //coarse quantizer of IVF
+    long tables_bytes; //PQ centroids, precomputed tables and SQ trained ranges
+    long xids_bytes; //vector of xid of all vectors
+    long xid2num_bytes; //map from xid to vector number, estimated from buckets and nodes
+    long ingest_bytes; //ingest buffer
+};
+
+// Resident bytes of an inverted list of IVF. Capacities of the containers are counted.
+struct VectoDBListStats {
+    long size; //number of vectors in the list
+    long codes_bytes;
+    long ids_bytes;
+};
+
+/** 
+ * Cursor which streams live vectors of a VectoDB in the order of base files.
+ * It scans the rows which exist when it's opened, and is not blocked by or blocking writes. Rows removed during the scan may or may not be skipped.
+ */
+class VectoDBCursor {
+public:
+    /** 
+     * Deconstruct a cursor and unmap base files.
+     */
+    virtual ~VectoDBCursor();
+
+    /** 
+     * Fetch the next batch of live vectors.
+     *
+     * @param n             input the maximum number of vectors to fetch
+     * @param xb            output vectors, size n * d
+     * @param xids          output ids of vectors, size n
+     * @return              the number of fetched vectors, 0 at the end
+     */
+    long Next(long n, float* xb, long* xids);
+
+private:
+    friend class VectoDB;
+    VectoDBCursor(long dim, long uid_begin, long uid_end);
+
+    long dim;
+    long uid_begin;
+    long uid_end;
+    std::string fp_fvecs;
+    std::string fp_xids;
+    uint8_t* data_fvecs;
+    uint8_t* data_xids;
+    long len_fvecs;
+    long len_xids;
+    long pos; //the next base row to scan
+    long total; //the number of base rows to scan
+};
+
+// Aggregations of scores of the member vectors of a set query.
+enum SetAggregation {
+    SET_AGG_MAX = 0, //the maximum score among members
+    SET_AGG_MEAN = 1, //the mean score of members
+    SET_AGG_UID_TOP1 = 2, //the maximum score among members, and only the best xid of each uid is kept
+};
+
 class VectoDB {
 public:
     /** 
@@ -19,8 +94,10 @@ public:
      * @param dim           input dimension of vector
      * @param index_key     input faiss index_key
      * @param query_params  input faiss selected params of auto-tuning
+     * @param replica       input whether to open a read replica of the primary which owns work_dir. A replica doesn't write work_dir,
+     *                      SyncIndex follows base files and adopts index snapshots of the primary instead of building index.
      */
-    VectoDB(const char* work_dir, long dim, const char* index_key = "IVF4096,PQ32", const char* query_params = "nprobe=256");
+    VectoDB(const char* work_dir, long dim, const char* index_key = "IVF4096,PQ32", const char* query_params = "nprobe=256", bool replica = false);
 
     /** 
      * Deconstruct a VectoDB.
@@ -28,7 +105,11 @@ public:
     virtual ~VectoDB();
 
     /** 
-     * Add n vectors of dimension d to the index.
+     * Add n vectors of dimension d to the index. It's safe to be called concurrently.
+     * The vectors are copied into an ingest buffer in parallel with other callers, and appended to base files and the index in batch.
+     * It returns after the vectors are visible to search.
+     * If base files fail to be appended, e.g. the disk is full, it throws and some of the vectors may have been added.
+     * Later additions are rejected until the database is reopened, since base files may end with a partial row.
      * The upper layer does memory management for xb, xids.
      *
      * @param xb     input matrix, size n * d
@@ -36,8 +117,27 @@ public:
      */
     void AddWithIds(long nb, const float* xb, const long* xids);
 
+    /** 
+     * Bulk load vectors from files, and build the index in one shot. Intended for the initial load of an empty database.
+     * Adding, searching and syncing are blocked until the index is built. The input is validated before anything is written,
+     * and base files are left untouched on failure.
+     *
+     * @param fp_vecs   input vectors file. The format is detected by extension: .fvecs, .bvecs, otherwise raw float32 of size n * d.
+     * @param fp_xids   input xids file, raw int64 of size n. Optional for all formats. If empty, row numbers are used as xids.
+     */
+    void AddFromFile(const char* fp_vecs, const char* fp_xids);
+
     void RemoveIds(long nb, const long* xids);
 
+    /** 
+     * Open a cursor over live vectors whose uid is in [uid_begin, uid_end). Removed vectors are skipped without materializing the whole set.
+     * The upper layer shall delete the cursor.
+     *
+     * @param uid_begin     input the lower bound of uid, inclusive
+     * @param uid_end       input the upper bound of uid, exclusive. -1 means no upper bound.
+     */
+    VectoDBCursor* Scan(long uid_begin = 0, long uid_end = -1);
+
     /** 
      * Get total number of vectors.
      *
@@ -46,6 +146,7 @@ public:
 
     /** 
      * Upper layer shall invoke this regularly to let deletion & update take effect, and ensure all vectors be indexed.
+     * For a replica, it applies additions and removals of the primary, and adopts the latest index snapshot.
      */
     void SyncIndex();
 
@@ -62,20 +163,123 @@ public:
      */
     void Search(long nq, long k, const float* xq, const long* uids, float* scores, long* xids);
 
+    /** 
+     * Query nq sets of m vectors. Candidates of all members are generated in one batch, every distinct candidate is scored exactly
+     * against all members of its set, and the aggregated scores are ranked. A mean set is searched as the centroid of its members.
+     * Like Search, it runs on the NUMA node which the database is placed on.
+     *
+     * @param nq            input the number of sets to search
+     * @param m             input the number of vectors of each set
+     * @param k             input do kNN search
+     * @param xq            input vectors to search, size nq * m * d
+     * @param agg           input the aggregation of scores, see SetAggregation. Other values fail with EINVAL
+     * @param scores        output aggregated scores, size nq * k
+     * @param xids          output labels of the kNN, size nq * k
+     */
+    void SearchSet(long nq, long m, long k, const float* xq, long agg, float* scores, long* xids);
+
+    /** 
+     * Enable coalescing of concurrent small searches. The first search opens a batch and waits up to window_us for others to join,
+     * then the batch is searched at once so that faiss takes the BLAS path. Results are demultiplexed to each caller.
+     * It applies to Search only. SearchAsync and searches routed to a NUMA node are batched by the worker pool instead.
+     *
+     * @param window_us     input the maximum wait in microseconds. 0 disables coalescing.
+     */
+    void SetSearchCoalesceWindow(long window_us);
+
+    /** 
+     * Query n vectors asynchronously. The query is served by a process-wide worker pool, which coalesces concurrent small queries
+     * of the same database and k into larger batches.
+     * The upper layer shall keep xq, scores, xids and the VectoDB valid until done is called.
+     *
+     * @param done          input callback which is invoked in a worker thread after scores and xids are filled
+     */
+    void SearchAsync(long nq, long k, const float* xq, const long* uids, float* scores, long* xids, std::function<void()> done);
+
+    /** 
+     * Get dimension of vectors.
+     */
+    long GetDim() const;
+
+    /** 
+     * Place the database on a NUMA node. Flat codes, inverted lists and id maps are moved to the node, and allocated there afterwards.
+     * Searches issued from other nodes are routed to workers pinned to the node.
+     *
+     * @param node          input the NUMA node, one of NumaNodes(). -1 disables placement.
+     */
+    void SetNumaNode(long node);
+
+    /** 
+     * Enable online recall estimation. A background low-priority thread re-runs sampled queries as exact search over base files,
+     * and compares with the results of the index.
+     *
+     * @param period        input sample one of every period queries. 0 disables sampling.
+     */
+    void SetRecallSamplePeriod(long period);
+
+    /** 
+     * Enable auto-tuning of query params at rebuild. The cheapest nprobe which meets the recall target is chosen,
+     * and persisted next to the index. It overrides nprobe of query_params.
+     *
+     * @param recall        input target of recall@10 in (0, 1]. 0 disables auto-tuning.
+     */
+    void SetTuneRecall(double recall);
+
+    /** 
+     * Get statistics of the database. It's cheap enough to be scraped every few seconds.
+     *
+     * @param stats         output statistics
+     */
+    void GetStats(VectoDBStats& stats);
+
+    /** 
+     * Get statistics of each inverted list of the IVF index, to spot imbalanced lists. It's empty if the index is flat or not IVF.
+     *
+     * @param lists         output statistics of lists, size nlist
+     */
+    void GetListStats(std::vector<VectoDBListStats>& lists);
+
 private:
+    friend class SearchPool;
     std::string getBaseFvecsFp() const;
     std::string getBaseXidsFp() const;
     std::string getBaseMutationFp() const;
     std::string getIndexFp(long mutuation, long ntrain) const;
+    std::string getIndexParamsFp() const;
     long getBaseMutation() const;
     void incBaseMutation();
     long getBaseMutationRaw();
     long getBaseTotalRaw();
     void getIndexFpLatest(long& mutation, long& ntrain) const;
-    void clearIndexFiles();
+    void clearIndexFiles(const std::string& keep = "");
+    std::string getManifestFp() const;
+    void loadIndex(const std::string& fp_index, long mutation, long ntotal, long rawTotal);
+    faiss::IndexRefineFlat* readSnapshot(const std::string& fp_index, long ntotal, long rawTotal, std::vector<long>& xids, std::unordered_map<long, long>& xid2num) const;
+    void followPrimary();
+    void adoptSnapshot(const Manifest& man);
+    void followTail();
+    void dumpIndex(const faiss::Index* index, long mutation, long ntotal, Manifest& man) const;
+    uint64_t fingerprintBase(const std::string& fp_fvecs, long rows) const;
+    bool readManifest(Manifest& man) const;
+    void writeManifest(const Manifest& man) const;
+    bool verifyManifest(const Manifest& man, long rawTotal) const;
+    void recoverSwap();
     void createBaseFilesIfNotExist();
     void openBaseFiles();
     void closeBaseFiles();
+    long compactBaseFiles(std::vector<long>& xids, std::unordered_map<long, long>& xid2num);
+    void servePublish();
+    void appendBase(long nb, const float* xb, const long* xids);
+    faiss::IndexRefineFlat* buildIndex(long nb, const float* xb);
+    void catchUpIndex(faiss::IndexRefineFlat* refFlat, long begin, const std::vector<long>& tail, std::vector<long>& xids, std::unordered_map<long, long>& xid2num);
+    void tombstoneRemoved(long orig_cnt_xids, long cnt_xids, long mutation, std::vector<long>& xids, std::unordered_map<long, long>& xid2num);
+    std::string tuneIndex(faiss::Index* index, long nb, const float* xb, double target) const;
+    void setQueryParams(faiss::Index* index) const;
+    void searchBatch(long nq, long k, const float* xq, const long* uids, float* scores, long* xids);
+    void searchSet(long nq, long m, long k, const float* xq, long agg, float* scores, long* xids);
+    void sampleQueries(long nq, long k, const float* xq, const long* xids);
+    void serveRecall();
+    void evalRecall(const std::deque<RecallSample>& samples);
 
 private:
     std::string work_dir;
@@ -100,5 +304,21 @@ private:
  */
 void ClearDir(const char* work_dir);
 void NormVec(float* vec, int dim);
-void MmapFile(const std::string& fp, uint8_t*& data, long& len_data);
+
+/** 
+ * Get ids of NUMA nodes which have memory, from /sys/devices/system/node/has_memory, or online if it's absent.
+ * Ids may be sparse. It's empty if the kernel doesn't expose NUMA topology.
+ */
+std::vector<long> NumaNodes();
+long NumaNodeCount();
+
+/** 
+ * Back index structures and mapped base files with transparent huge pages, to reduce TLB misses of IVF scans and refining.
+ * It takes effect on indexes which are built or loaded later, for all VectoDB instances of the process.
+ * It requires /sys/kernel/mm/transparent_hugepage/enabled to be always or madvise.
+ *
+ * @param enable        input whether to enable huge pages
+ */
+void SetHugePages(bool enable);
+void MmapFile(const std::string& fp, uint8_t*& data, long& len_data, bool writable = false, bool sequential = false);
 void MunmapFile(const std::string& fp, uint8_t*& data, long& len_data);
@@ -29,6 +29,7 @@ type VectodbMulti struct {
 	distThr     float32
 	workDir     string //the working directory of each VectoDB instance is <workDir>/vdb-<seq>
 	sizeLimit   int    //size limit of each VectoDB instance
+	numaNodes   []int  //instances are placed on NUMA nodes round-robin by seq
 
 	//state
 	curXidBatch int64
@@ -82,6 +83,7 @@ func NewVectodbMulti(workDir string, dim int, sizeLimit int) (vm *VectodbMulti,
 		dim:         dim,
 		workDir:     workDir,
 		sizeLimit:   sizeLimit,
+		numaNodes:   VectodbNumaNodes(),
 		curXidBatch: 0,
 	}
 	if err = os.MkdirAll(workDir, 0700); err != nil {
@@ -116,13 +118,29 @@ func NewVectodbMulti(workDir string, dim int, sizeLimit int) (vm *VectodbMulti,
 	sort.Ints(seqs)
 	for _, seq := range seqs {
 		dp := filepath.Join(workDir, getWorkDir(seq))
-		vdb, err = NewVectoDB(dp, dim)
+		if vdb, err = vm.newVectoDB(dp, seq); err != nil {
+			return
+		}
 		vm.vdbs = append(vm.vdbs, vdb)
 	}
 	vm.maxSeq = seqs[len(seqs)-1]
 	return
 }
 
+//newVectoDB creates the VectoDB instance of seq, and places it on a NUMA node if there are multiple ones.
+func (vm *VectodbMulti) newVectoDB(dp string, seq int) (vdb *VectoDB, err error) {
+	if vdb, err = NewVectoDB(dp, vm.dim); err != nil {
+		return
+	}
+	if len(vm.numaNodes) > 1 {
+		if err = vdb.SetNumaNode(vm.numaNodes[seq%len(vm.numaNodes)]); err != nil {
+			vdb.Destroy()
+			vdb = nil
+		}
+	}
+	return
+}
+
 //Search perform batch search
 /**
  * nq       number of query points, shall be equal to len(xids)
@@ -170,7 +188,7 @@ func (vm *VectodbMulti) AddWithIds(xb []float32, xids []int64) (err error) {
 		} else {
 			vm.maxSeq++
 			dp := filepath.Join(vm.workDir, getWorkDir(vm.maxSeq))
-			if vdb, err = NewVectoDB(dp, vm.dim); err != nil {
+			if vdb, err = vm.newVectoDB(dp, vm.maxSeq); err != nil {
 				return
 			}
 			vm.vdbs = append(vm.vdbs, vdb)
@@ -226,6 +244,37 @@ func (vm *VectodbMulti) StopBuilderLoop() {
 	return
 }
 
+//GetStats aggregates statistics of all VectoDB instances. Recall is weighted by the number of evaluated queries.
+func (vm *VectodbMulti) GetStats() (stats VectoDBStats, err error) {
+	var st VectoDBStats
+	var recallSum float64
+	stats.Recall = -1
+	for _, vdb := range vm.vdbs {
+		if st, err = vdb.GetStats(); err != nil {
+			return
+		}
+		stats.Total += st.Total
+		stats.FlatBytes += st.FlatBytes
+		stats.CodesBytes += st.CodesBytes
+		stats.IdsBytes += st.IdsBytes
+		stats.QuantizerBytes += st.QuantizerBytes
+		stats.TablesBytes += st.TablesBytes
+		stats.XidsBytes += st.XidsBytes
+		stats.Xid2numBytes += st.Xid2numBytes
+		stats.IngestBytes += st.IngestBytes
+		stats.RecallQueries += st.RecallQueries
+		// The recall of each instance is averaged over its window, so it's weighted by the samples in the window.
+		if st.Recall >= 0 {
+			stats.RecallWindow += st.RecallWindow
+			recallSum += st.Recall * float64(st.RecallWindow)
+		}
+	}
+	if stats.RecallWindow > 0 {
+		stats.Recall = recallSum / float64(stats.RecallWindow)
+	}
+	return
+}
+
 //AllocateIds allocate a batch of identifiers. The batch size is 2<<20.
 func (vm *VectodbMulti) AllocateIds() (xidBegin int64, err error) {
 	xidBatch := atomic.AddInt64(&vm.curXidBatch, int64(1)) - 1
@@ -3,6 +3,7 @@ package vectodb
 import (
 	"fmt"
 	"math/rand"
+	"path/filepath"
 	"testing"
 	"time"
 
@@ -50,3 +51,69 @@ func TestVectodbMulti(t *testing.T) {
 
 	vm.StopBuilderLoop()
 }
+
+func TestVectodbMultiStats(t *testing.T) {
+	var err error
+	const d, nb, k int = 32, 201000, 10
+	xb, xids := randBase(351, d, nb)
+	xq, _ := randBase(352, d, 100)
+	require.NoError(t, VectodbMultiClearWorkDir(workDir))
+	// Instances of low and high recall with different numbers of sampled queries, and a flat one without samples.
+	nprobes := []int{1, 256, 0}
+	nqs := []int{20, 60, 0}
+	vm := &VectodbMulti{dim: d, workDir: workDir}
+	for i, nprobe := range nprobes {
+		vdb, err := NewVectoDBWithIndex(filepath.Join(workDir, getWorkDir(i)), d, "IVF256,SQ8", fmt.Sprintf("nprobe=%d", nprobe), false)
+		require.NoError(t, err)
+		vm.vdbs = append(vm.vdbs, vdb)
+		if nqs[i] == 0 {
+			require.NoError(t, vdb.AddWithIds(xb[:1000*d], xids[:1000]))
+			continue
+		}
+		require.NoError(t, vdb.AddWithIds(xb, xids))
+		require.NoError(t, vdb.SyncIndex())
+		require.NoError(t, vdb.SetRecallSamplePeriod(1))
+		_, err = vdb.Search(k, xq[:nqs[i]*d], make([]string, nqs[i]))
+		require.NoError(t, err)
+		waitRecallQueries(t, vdb, nqs[i])
+	}
+
+	var want VectoDBStats
+	var recallSum float64
+	for _, vdb := range vm.vdbs {
+		stats, err := vdb.GetStats()
+		require.NoError(t, err)
+		want.Total += stats.Total
+		want.FlatBytes += stats.FlatBytes
+		want.CodesBytes += stats.CodesBytes
+		want.IdsBytes += stats.IdsBytes
+		want.QuantizerBytes += stats.QuantizerBytes
+		want.TablesBytes += stats.TablesBytes
+		want.XidsBytes += stats.XidsBytes
+		want.Xid2numBytes += stats.Xid2numBytes
+		want.IngestBytes += stats.IngestBytes
+		want.RecallQueries += stats.RecallQueries
+		want.RecallWindow += stats.RecallWindow
+		if stats.RecallWindow > 0 {
+			recallSum += stats.Recall * float64(stats.RecallWindow)
+		}
+	}
+	first, err := vm.vdbs[0].GetStats()
+	require.NoError(t, err)
+	second, err := vm.vdbs[1].GetStats()
+	require.NoError(t, err)
+	require.Less(t, first.Recall, second.Recall)
+	stats, err := vm.GetStats()
+	require.NoError(t, err)
+	require.Equal(t, 2*nb+1000, stats.Total)
+	require.Equal(t, 80, stats.RecallQueries)
+	require.Equal(t, 80, stats.RecallWindow)
+	require.InDelta(t, recallSum/80, stats.Recall, 1e-9)
+	// Weighted by the window, it is closer to the instance of more samples than the plain mean.
+	require.Greater(t, stats.Recall, (first.Recall+second.Recall)/2)
+	want.Recall = stats.Recall
+	require.Equal(t, want, stats)
+	for _, vdb := range vm.vdbs {
+		require.NoError(t, vdb.Destroy())
+	}
+}
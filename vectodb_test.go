@@ -1,8 +1,18 @@
 package vectodb
 
 import (
+	"encoding/binary"
+	"fmt"
+	"io/ioutil"
 	"math"
+	"math/rand"
+	"os"
+	"os/exec"
+	"sort"
+	"strings"
+	"sync"
 	"testing"
+	"time"
 
 	"github.com/stretchr/testify/require"
 )
@@ -21,6 +31,890 @@ func TestVectodbNew(t *testing.T) {
 	require.NoError(t, err)
 }
 
+func TestVectodbAddFromFile(t *testing.T) {
+	var err error
+	const nb int = 1000
+	fpVecs := workDir + ".fvecs"
+	f, err := os.Create(fpVecs)
+	require.NoError(t, err)
+	vec := make([]float32, dim)
+	for i := 0; i < nb; i++ {
+		for j := 0; j < dim; j++ {
+			vec[j] = rand.Float32()
+		}
+		normalizeInplace(dim, vec)
+		require.NoError(t, binary.Write(f, binary.LittleEndian, int32(dim)))
+		require.NoError(t, binary.Write(f, binary.LittleEndian, vec))
+	}
+	require.NoError(t, f.Close())
+	defer os.Remove(fpVecs)
+
+	// A bad dimension in the last row.
+	fpBad := workDir + ".bad.fvecs"
+	data, err := ioutil.ReadFile(fpVecs)
+	require.NoError(t, err)
+	binary.LittleEndian.PutUint32(data[(nb-1)*(4+dim*4):], uint32(dim+1))
+	require.NoError(t, ioutil.WriteFile(fpBad, data, 0644))
+	defer os.Remove(fpBad)
+	fpXids := workDir + ".xids"
+	require.NoError(t, ioutil.WriteFile(fpXids, make([]byte, (nb-1)*8), 0644))
+	defer os.Remove(fpXids)
+
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDB(workDir, dim)
+	require.NoError(t, err)
+	require.Error(t, vdb.AddFromFile(workDir+".none.fvecs", ""))
+	require.Error(t, vdb.AddFromFile(fpBad, ""))
+	require.Error(t, vdb.AddFromFile(fpVecs, fpXids))
+	total, err := vdb.GetTotal()
+	require.NoError(t, err)
+	require.Equal(t, 0, total)
+	err = vdb.AddFromFile(fpVecs, "")
+	require.NoError(t, err)
+	total, err = vdb.GetTotal()
+	require.NoError(t, err)
+	require.Equal(t, nb, total)
+	res, err := vdb.Search(1, vec, []string{""})
+	require.NoError(t, err)
+	require.Equal(t, int64(nb-1), res[0][0].Xid)
+	require.Error(t, vdb.AddFromFile(fpVecs, ""))
+	err = vdb.Destroy()
+	require.NoError(t, err)
+}
+
+func TestVectodbAddFailure(t *testing.T) {
+	var err error
+	const nb int = 100
+	// Writes to /dev/full fail with ENOSPC.
+	VectodbClearWorkDir(workDir)
+	require.NoError(t, os.Symlink("/dev/full", workDir+"/base.fvecs"))
+	vdb, err := NewVectoDB(workDir, dim)
+	require.NoError(t, err)
+	xb := make([]float32, nb*dim)
+	xids := make([]int64, nb)
+	for i := 0; i < nb; i++ {
+		xb[i*dim] = 1.0
+		xids[i] = int64(i)
+	}
+	require.Error(t, vdb.AddWithIds(xb, xids))
+	require.Error(t, vdb.AddWithIds(xb, xids))
+	total, err := vdb.GetTotal()
+	require.NoError(t, err)
+	require.Equal(t, 0, total)
+	err = vdb.Destroy()
+	require.NoError(t, err)
+}
+
+func TestVectodbScan(t *testing.T) {
+	var err error
+	const nb int = 1000
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDB(workDir, dim)
+	require.NoError(t, err)
+	xb := make([]float32, nb*dim)
+	xids := make([]int64, nb)
+	for i := 0; i < nb; i++ {
+		for j := 0; j < dim; j++ {
+			xb[i*dim+j] = rand.Float32()
+		}
+		normalizeInplace(dim, xb[i*dim:(i+1)*dim])
+		// uid i%2, pid i
+		xids[i] = int64(i%2)<<32 | int64(i)
+	}
+	err = vdb.AddWithIds(xb, xids)
+	require.NoError(t, err)
+
+	cur, err := vdb.Scan(1, 2)
+	require.NoError(t, err)
+	var scanned int
+	for {
+		xb2, xids2, err := cur.Next(64)
+		require.NoError(t, err)
+		if len(xids2) == 0 {
+			break
+		}
+		for i, xid := range xids2 {
+			num := int(xid & 0xffffffff)
+			require.Equal(t, 1, num%2)
+			require.Equal(t, xb[num*dim:(num+1)*dim], xb2[i*dim:(i+1)*dim])
+		}
+		scanned += len(xids2)
+	}
+	require.Equal(t, nb/2, scanned)
+	require.NoError(t, cur.Close())
+	err = vdb.Destroy()
+	require.NoError(t, err)
+}
+
+func TestVectodbNumaNode(t *testing.T) {
+	var err error
+	const nb, k int = 1000, 10
+	nodes := VectodbNumaNodes()
+	require.Equal(t, MaxInt(1, len(nodes)), VectodbNumaNodeCount())
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDB(workDir, dim)
+	require.NoError(t, err)
+	xb := make([]float32, nb*dim)
+	xids := make([]int64, nb)
+	for i := 0; i < nb; i++ {
+		for j := 0; j < dim; j++ {
+			xb[i*dim+j] = rand.Float32()
+		}
+		normalizeInplace(dim, xb[i*dim:(i+1)*dim])
+		xids[i] = int64(i)
+	}
+	require.NoError(t, vdb.AddWithIds(xb, xids))
+	// Nodes which don't exist or have no memory are rejected.
+	maxNode := -1
+	for _, node := range nodes {
+		maxNode = MaxInt(maxNode, node)
+	}
+	require.Error(t, vdb.SetNumaNode(maxNode+1))
+	require.Error(t, vdb.SetNumaNode(1<<20))
+	for _, node := range nodes {
+		require.NoError(t, vdb.SetNumaNode(node))
+		res, err := vdb.Search(k, xb[7*dim:8*dim], []string{""})
+		require.NoError(t, err)
+		require.Equal(t, int64(7), res[0][0].Xid)
+	}
+	require.NoError(t, vdb.SetNumaNode(-1))
+	err = vdb.Destroy()
+	require.NoError(t, err)
+}
+
+func TestVectodbSearchAsync(t *testing.T) {
+	var err error
+	const nb, nq, k int = 2000, 200, 10
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDB(workDir, dim)
+	require.NoError(t, err)
+	xb := make([]float32, nb*dim)
+	xids := make([]int64, nb)
+	for i := 0; i < nb; i++ {
+		for j := 0; j < dim; j++ {
+			xb[i*dim+j] = rand.Float32()
+		}
+		normalizeInplace(dim, xb[i*dim:(i+1)*dim])
+		xids[i] = int64(i)
+	}
+	require.NoError(t, vdb.AddWithIds(xb, xids))
+	xq := make([]float32, nq*dim)
+	for i := 0; i < nq*dim; i++ {
+		xq[i] = rand.Float32()
+	}
+	want, err := vdb.Search(k, xq, make([]string, nq))
+	require.NoError(t, err)
+
+	// Queries of 1 or 2 vectors are submitted concurrently, so that the pool coalesces some of them.
+	// Scores may differ in rounding since a coalesced batch takes the BLAS path.
+	var wg sync.WaitGroup
+	have := make([][]XidScore, nq)
+	errs := make([]error, nq)
+	for q := 0; q < nq; {
+		n := 1 + q%2
+		if q+n > nq {
+			n = nq - q
+		}
+		wg.Add(1)
+		go func(q, n int) {
+			defer wg.Done()
+			sr := <-vdb.SearchAsync(k, xq[q*dim:(q+n)*dim], make([]string, n))
+			errs[q] = sr.Err
+			copy(have[q:q+n], sr.Res)
+		}(q, n)
+		q += n
+	}
+	wg.Wait()
+	for q := 0; q < nq; q++ {
+		require.NoError(t, errs[q])
+		require.Len(t, have[q], k)
+		for i := 0; i < k; i++ {
+			require.Equal(t, want[q][i].Xid, have[q][i].Xid)
+			require.InDelta(t, want[q][i].Score, have[q][i].Score, 1e-4)
+		}
+	}
+
+	sr := <-vdb.SearchAsync(k, nil, nil)
+	require.Error(t, sr.Err)
+	err = vdb.Destroy()
+	require.NoError(t, err)
+}
+
+func TestVectodbSearchCoalesce(t *testing.T) {
+	var err error
+	const nb, nq, k int = 2000, 32, 10
+	const window = 500 * time.Millisecond
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDB(workDir, dim)
+	require.NoError(t, err)
+	xb := make([]float32, nb*dim)
+	xids := make([]int64, nb)
+	for i := 0; i < nb; i++ {
+		for j := 0; j < dim; j++ {
+			xb[i*dim+j] = rand.Float32()
+		}
+		normalizeInplace(dim, xb[i*dim:(i+1)*dim])
+		xids[i] = int64(i)
+	}
+	require.NoError(t, vdb.AddWithIds(xb, xids))
+	xq := make([]float32, nq*dim)
+	for i := 0; i < nq*dim; i++ {
+		xq[i] = rand.Float32()
+	}
+	want, err := vdb.Search(k, xq, make([]string, nq))
+	require.NoError(t, err)
+
+	require.NoError(t, vdb.SetSearchCoalesceWindow(int(window/time.Microsecond)))
+	var wg sync.WaitGroup
+	have := make([][]XidScore, nq)
+	for q := 0; q < nq; q++ {
+		wg.Add(1)
+		go func(q int) {
+			defer wg.Done()
+			res, _ := vdb.Search(k, xq[q*dim:(q+1)*dim], []string{""})
+			have[q] = res[0]
+		}(q)
+	}
+	wg.Wait()
+	for q := 0; q < nq; q++ {
+		require.Len(t, have[q], k)
+		for i := 0; i < k; i++ {
+			require.Equal(t, want[q][i].Xid, have[q][i].Xid)
+			require.InDelta(t, want[q][i].Score, have[q][i].Score, 1e-4)
+		}
+	}
+
+	// An async search is batched by the pool, and doesn't wait for the window.
+	begin := time.Now()
+	sr := <-vdb.SearchAsync(k, xq[:dim], []string{""})
+	require.NoError(t, sr.Err)
+	require.Less(t, int64(time.Since(begin)), int64(window/2))
+	require.Equal(t, want[0][0].Xid, sr.Res[0][0].Xid)
+	err = vdb.Destroy()
+	require.NoError(t, err)
+}
+
+// TestVectodbSearchSet 对比集合检索和暴力计算的结果。每个uid有2个向量。
+func TestVectodbSearchSet(t *testing.T) {
+	var err error
+	const nb, nq, m, k int = 2000, 5, 3, 10
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDB(workDir, dim)
+	require.NoError(t, err)
+	rng := rand.New(rand.NewSource(40))
+	xb := make([]float32, nb*dim)
+	xids := make([]int64, nb)
+	for i := 0; i < nb; i++ {
+		for j := 0; j < dim; j++ {
+			xb[i*dim+j] = rng.Float32() - 0.5
+		}
+		normalizeInplace(dim, xb[i*dim:(i+1)*dim])
+		xids[i] = int64(i/2)<<32 | int64(i%2)
+	}
+	require.NoError(t, vdb.AddWithIds(xb, xids))
+	xq := make([]float32, nq*m*dim)
+	for i := range xq {
+		xq[i] = rng.Float32() - 0.5
+	}
+	dot := func(a, b []float32) (s float32) {
+		for i := range a {
+			s += a[i] * b[i]
+		}
+		return
+	}
+	bruteForce := func(q, agg int) (want []XidScore) {
+		var ranked []XidScore
+		for i := 0; i < nb; i++ {
+			var score float32
+			for j := 0; j < m; j++ {
+				s := dot(xq[(q*m+j)*dim:(q*m+j+1)*dim], xb[i*dim:(i+1)*dim])
+				if agg == SetAggMean {
+					score += s / float32(m)
+				} else if j == 0 || s > score {
+					score = s
+				}
+			}
+			ranked = append(ranked, XidScore{Xid: xids[i], Score: score})
+		}
+		sort.Slice(ranked, func(i, j int) bool { return ranked[i].Score > ranked[j].Score })
+		uids := make(map[int64]bool)
+		for _, r := range ranked {
+			if agg == SetAggUidTop1 {
+				if uids[r.Xid>>32] {
+					continue
+				}
+				uids[r.Xid>>32] = true
+			}
+			want = append(want, r)
+			if len(want) == k {
+				break
+			}
+		}
+		return
+	}
+	for _, agg := range []int{SetAggMax, SetAggMean, SetAggUidTop1} {
+		res, err := vdb.SearchSet(m, k, xq, agg)
+		require.NoError(t, err)
+		require.Len(t, res, nq)
+		for q := 0; q < nq; q++ {
+			want := bruteForce(q, agg)
+			require.Len(t, res[q], k)
+			for i := 0; i < k; i++ {
+				require.Equal(t, want[i].Xid, res[q][i].Xid, "agg %v query %v rank %v", agg, q, i)
+				require.InDelta(t, want[i].Score, res[q][i].Score, 1e-4)
+			}
+		}
+	}
+	_, err = vdb.SearchSet(m, k, xq, SetAggUidTop1+1)
+	require.Error(t, err)
+	_, err = vdb.SearchSet(m, k, xq, -1)
+	require.Error(t, err)
+	err = vdb.Destroy()
+	require.NoError(t, err)
+}
+
+// TestVectodbRecovery 子进程建索引后追加向量并直接退出，父进程检查重启、中断的换文件、损坏的MANIFEST和被修改的索引文件都能恢复。
+func TestVectodbRecovery(t *testing.T) {
+	var err error
+	const d, nb, nt int = 32, 201000, 500
+	const indexKey, queryParams string = "IVF256,SQ8", "nprobe=256"
+	xb, xids := randBase(36, d, nb+nt)
+	if os.Getenv("VECTODB_TEST_CRASH") != "" {
+		vdb, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+		require.NoError(t, err)
+		require.NoError(t, vdb.AddWithIds(xb[:nb*d], xids[:nb]))
+		require.NoError(t, vdb.SyncIndex())
+		require.NoError(t, vdb.AddWithIds(xb[nb*d:], xids[nb:]))
+		os.Exit(0)
+	}
+
+	VectodbClearWorkDir(workDir)
+	cmd := exec.Command(os.Args[0], "-test.run=^TestVectodbRecovery$")
+	cmd.Env = append(os.Environ(), "VECTODB_TEST_CRASH=1")
+	out, err := cmd.CombinedOutput()
+	require.NoError(t, err, string(out))
+	check := func() {
+		vdb, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+		require.NoError(t, err)
+		total, err := vdb.GetTotal()
+		require.NoError(t, err)
+		require.Equal(t, nb+nt, total)
+		for _, i := range []int{0, nb - 1, nb, nb + nt - 1} {
+			res, err := vdb.Search(1, xb[i*d:(i+1)*d], []string{""})
+			require.NoError(t, err)
+			require.Equal(t, xids[i], res[0][0].Xid)
+		}
+		require.NoError(t, vdb.Destroy())
+	}
+	// The tail after the dumped index is re-added from base files.
+	check()
+
+	// Crashed after the manifest was switched, and before base.fvecs was renamed.
+	require.NoError(t, os.Rename(workDir+"/base.fvecs", workDir+"/base.fvecs.tmp"))
+	rewriteManifest(t, "swap", "1")
+	check()
+
+	// A malformed value with a valid checksum, and then a bad checksum. The index is found by its file name.
+	good, err := ioutil.ReadFile(workDir + "/MANIFEST")
+	require.NoError(t, err)
+	rewriteManifest(t, "ntotal", "abc")
+	check()
+	bad := append([]byte(nil), good...)
+	bad[0] ^= 1
+	require.NoError(t, ioutil.WriteFile(workDir+"/MANIFEST", bad, 0644))
+	check()
+	require.NoError(t, ioutil.WriteFile(workDir+"/MANIFEST", good, 0644))
+
+	// A touched index is verified by the checksum, and a modified one is rebuilt.
+	fpIndex := workDir + "/" + readManifestField(t, "index")
+	now := time.Now()
+	require.NoError(t, os.Chtimes(fpIndex, now, now))
+	check()
+	f, err := os.OpenFile(fpIndex, os.O_RDWR, 0644)
+	require.NoError(t, err)
+	fi, err := f.Stat()
+	require.NoError(t, err)
+	_, err = f.WriteAt([]byte{0xff, 0xff, 0xff, 0xff}, fi.Size()/2)
+	require.NoError(t, err)
+	require.NoError(t, f.Close())
+	check()
+	sum, err := ioutil.ReadFile(workDir + "/" + readManifestField(t, "index"))
+	require.NoError(t, err)
+	require.Equal(t, readManifestField(t, "index_checksum"), fmt.Sprint(manifestChecksum(sum)))
+}
+
+// TestVectodbReplica 只读副本跟随主库的追加、删除和索引重建，并拒绝写入。
+func TestVectodbReplica(t *testing.T) {
+	var err error
+	const d, nb, nt int = 32, 201000, 500
+	const indexKey, queryParams string = "IVF256,SQ8", "nprobe=256"
+	xb, xids := randBase(38, d, nb+nt)
+	// Removed rows are dropped from results, so a few more are searched.
+	top1 := func(vdb *VectoDB, i int) int64 {
+		res, err := vdb.Search(5, xb[i*d:(i+1)*d], []string{""})
+		require.NoError(t, err)
+		require.NotEqual(t, 0, len(res[0]))
+		return res[0][0].Xid
+	}
+	total := func(vdb *VectoDB) int {
+		total, err := vdb.GetTotal()
+		require.NoError(t, err)
+		return total
+	}
+
+	VectodbClearWorkDir(workDir)
+	primary, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	require.NoError(t, primary.AddWithIds(xb[:1000*d], xids[:1000]))
+	replica, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, true)
+	require.NoError(t, err)
+	require.Equal(t, 1000, total(replica))
+	require.Error(t, replica.AddWithIds(xb[:d], xids[:1]))
+	require.Error(t, replica.RemoveIds(xids[:1]))
+	require.Equal(t, xids[7], top1(replica, 7))
+
+	// Placing and inspecting the replica race with following the primary.
+	done := make(chan struct{})
+	var wg sync.WaitGroup
+	wg.Add(1)
+	go func() {
+		defer wg.Done()
+		node := VectodbNumaNodes()[0]
+		for {
+			select {
+			case <-done:
+				return
+			default:
+			}
+			replica.SetNumaNode(node)
+			replica.GetStats()
+		}
+	}()
+
+	require.NoError(t, primary.AddWithIds(xb[1000*d:nb*d], xids[1000:nb]))
+	require.NoError(t, primary.SyncIndex())
+	require.NoError(t, replica.SyncIndex())
+	require.Equal(t, nb, total(replica))
+	require.Equal(t, xids[nb-1], top1(replica, nb-1))
+
+	// The tail and removals are followed on top of the adopted snapshot.
+	require.NoError(t, primary.AddWithIds(xb[nb*d:], xids[nb:]))
+	require.NoError(t, primary.RemoveIds([]int64{xids[0], xids[nb]}))
+	require.NoError(t, replica.SyncIndex())
+	require.Equal(t, nb+nt, total(replica))
+	require.NotEqual(t, xids[0], top1(replica, 0))
+	require.NotEqual(t, xids[nb], top1(replica, nb))
+	require.Equal(t, xids[nb+1], top1(replica, nb+1))
+
+	// The primary rebuilds the index after removals, and the replica adopts it.
+	require.NoError(t, primary.SyncIndex())
+	require.NoError(t, replica.SyncIndex())
+	close(done)
+	wg.Wait()
+	require.NotEqual(t, xids[0], top1(replica, 0))
+	require.Equal(t, xids[1], top1(replica, 1))
+	require.Equal(t, xids[nb+nt-1], top1(replica, nb+nt-1))
+	require.NoError(t, replica.Destroy())
+	require.NoError(t, primary.Destroy())
+}
+
+// TestVectodbCompact 重建索引时压缩掉分散删除的行，包括首行和末行。
+func TestVectodbCompact(t *testing.T) {
+	var err error
+	const d, nb int = 32, 201000
+	const indexKey, queryParams string = "IVF256,SQ8", "nprobe=256"
+	xb, xids := randBase(27, d, nb)
+	// Scattered removals in the head, and the untouched tail is longer than one copy chunk.
+	removed := map[int64]bool{xids[0]: true, xids[1]: true, xids[nb-1]: true}
+	for i := 5; i < 50000; i += 97 {
+		removed[xids[i]] = true
+	}
+	for i := 20000; i < 20100; i++ {
+		removed[xids[i]] = true
+	}
+	rms := make([]int64, 0, len(removed))
+	for xid := range removed {
+		rms = append(rms, xid)
+	}
+
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	require.NoError(t, vdb.AddWithIds(xb, xids))
+	require.NoError(t, vdb.RemoveIds(rms))
+	require.NoError(t, vdb.SyncIndex())
+
+	check := func(vdb *VectoDB) {
+		total, err := vdb.GetTotal()
+		require.NoError(t, err)
+		require.Equal(t, nb-len(removed), total)
+		cur, err := vdb.Scan(0, 1)
+		require.NoError(t, err)
+		seen := make(map[int64]bool, total)
+		for {
+			xb2, xids2, err := cur.Next(4096)
+			require.NoError(t, err)
+			if len(xids2) == 0 {
+				break
+			}
+			for i, xid := range xids2 {
+				num := int(xid / 3)
+				require.False(t, removed[xid])
+				require.False(t, seen[xid])
+				seen[xid] = true
+				require.Equal(t, xb[num*d:(num+1)*d], xb2[i*d:(i+1)*d])
+			}
+		}
+		require.NoError(t, cur.Close())
+		require.Equal(t, total, len(seen))
+		for _, i := range []int{0, 1, 2, 5, 6, 19999, 20050, 20100, 49999, 50000, nb - 2, nb - 1} {
+			res, err := vdb.Search(5, xb[i*d:(i+1)*d], []string{""})
+			require.NoError(t, err)
+			require.NotEqual(t, 0, len(res[0]))
+			for _, xs := range res[0] {
+				require.False(t, removed[xs.Xid])
+			}
+			if !removed[xids[i]] {
+				require.Equal(t, xids[i], res[0][0].Xid)
+			}
+		}
+	}
+	check(vdb)
+	require.NoError(t, vdb.Destroy())
+	// The compacted base files are reloaded as is.
+	vdb, err = NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	check(vdb)
+	require.NoError(t, vdb.Destroy())
+}
+
+// TestVectodbRecall 采样查询的recall估计与暴力检索的结果一致，并排除已删除的行。
+func TestVectodbRecall(t *testing.T) {
+	var err error
+	const d, nb, nq, k int = 32, 201000, 50, 10
+	const indexKey, queryParams string = "IVF256,SQ8", "nprobe=1"
+	xb, xids := randBase(28, d, nb)
+	rng := rand.New(rand.NewSource(28))
+	xq := make([]float32, nq*d)
+	for q := 0; q < nq; q++ {
+		for j := 0; j < d; j++ {
+			xq[q*d+j] = xb[q*1000*d+j] + 0.1*(rng.Float32()-0.5)
+		}
+		normalizeInplace(d, xq[q*d:(q+1)*d])
+	}
+	// The nearest rows of some queries are removed, and shall not count as misses.
+	removed := make(map[int64]bool)
+	for q := 0; q < nq; q += 5 {
+		removed[xids[q*1000]] = true
+	}
+	rms := make([]int64, 0, len(removed))
+	for xid := range removed {
+		rms = append(rms, xid)
+	}
+
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	require.NoError(t, vdb.AddWithIds(xb, xids))
+	require.NoError(t, vdb.SyncIndex())
+	require.NoError(t, vdb.RemoveIds(rms))
+	stats, err := vdb.GetStats()
+	require.NoError(t, err)
+	require.Equal(t, 0, stats.RecallQueries)
+	require.Equal(t, float64(-1), stats.Recall)
+
+	require.NoError(t, vdb.SetRecallSamplePeriod(1))
+	res, err := vdb.Search(k, xq, make([]string, nq))
+	require.NoError(t, err)
+	stats = waitRecallQueries(t, vdb, nq)
+	require.Equal(t, nq, stats.RecallQueries)
+	require.Equal(t, nq, stats.RecallWindow)
+
+	for q := 0; q < nq; q++ {
+		for _, r := range res[q] {
+			require.False(t, removed[r.Xid])
+		}
+	}
+	want := recallAtK(d, k, xb, xids, removed, xq, res)
+	require.Less(t, want, 1.0)
+	require.InDelta(t, want, stats.Recall, 1e-9)
+	require.NoError(t, vdb.Destroy())
+}
+
+// TestVectodbTuneIndex 重建时按目标recall调优nprobe，持久化到.params文件，重新打开时加载，关闭调优后重建则删除。
+func TestVectodbTuneIndex(t *testing.T) {
+	var err error
+	const d, nb, nq, k int = 32, 201000, 50, 10
+	const indexKey, queryParams string = "IVF256,SQ8", "nprobe=1"
+	const target float64 = 0.9
+	xb, xids := randBase(29, d, nb)
+	// Queries are fresh points of the same distribution as the held out ones of tuning.
+	xq, _ := randBase(290, d, nq)
+	fpParams := workDir + "/" + indexKey + ".params"
+	recall := func(vdb *VectoDB) float64 {
+		res, err := vdb.Search(k, xq, make([]string, nq))
+		require.NoError(t, err)
+		return recallAtK(d, k, xb, xids, nil, xq, res)
+	}
+
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	require.NoError(t, vdb.SetTuneRecall(target))
+	require.NoError(t, vdb.AddWithIds(xb, xids))
+	require.NoError(t, vdb.SyncIndex())
+	data, err := ioutil.ReadFile(fpParams)
+	require.NoError(t, err)
+	var nprobe int
+	_, err = fmt.Sscanf(string(data), "nprobe=%d\n", &nprobe)
+	require.NoError(t, err)
+	require.Greater(t, nprobe, 1)
+	require.LessOrEqual(t, nprobe, 256)
+	tuned := recall(vdb)
+	require.GreaterOrEqual(t, tuned, target-0.05)
+	require.NoError(t, vdb.Destroy())
+
+	// The tuned params override queryParams after reopening.
+	vdb, err = NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	require.Equal(t, tuned, recall(vdb))
+
+	// A rebuild without tuning goes back to queryParams.
+	require.NoError(t, vdb.RemoveIds(xids[:1]))
+	require.NoError(t, vdb.SyncIndex())
+	_, err = os.Stat(fpParams)
+	require.True(t, os.IsNotExist(err))
+	require.Less(t, recall(vdb), tuned)
+	require.NoError(t, vdb.Destroy())
+}
+
+// TestVectodbRemoveDuringSync 重建索引期间删除的行（包括追加的行和删除后重新加入的xid）在新索引激活后不会复活。
+func TestVectodbRemoveDuringSync(t *testing.T) {
+	var err error
+	const d, nb, nt int = 32, 201000, 2000
+	const indexKey, queryParams string = "IVF256,SQ8", "nprobe=256"
+	xb, xids := randBase(31, d, nb+nt)
+	// xids[nb+nt-1] is re-added with the vector of row 1 after its own row is removed.
+	readded := xids[nb+nt-1]
+
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	require.NoError(t, vdb.AddWithIds(xb[:nb*d], xids[:nb]))
+	removed := make(map[int64]bool)
+	var iters int
+	done := make(chan struct{})
+	var wg sync.WaitGroup
+	wg.Add(1)
+	go func() {
+		defer wg.Done()
+		rng := rand.New(rand.NewSource(31))
+		for i := 0; ; i++ {
+			select {
+			case <-done:
+				iters = i
+				return
+			default:
+			}
+			var err error
+			if i < nt/100 {
+				err = vdb.AddWithIds(xb[(nb+i*100)*d:(nb+i*100+100)*d], xids[nb+i*100:nb+i*100+100])
+			} else if i == nt/100 {
+				if err = vdb.RemoveIds([]int64{readded}); err == nil {
+					err = vdb.AddWithIds(xb[d:2*d], []int64{readded})
+				}
+			}
+			rms := make([]int64, 0, 3)
+			for j := 0; j < 3; j++ {
+				num := rng.Intn(nb + MinInt(i, nt/100)*100)
+				if num != 1 && xids[num] != readded {
+					rms = append(rms, xids[num])
+				}
+			}
+			if err == nil {
+				err = vdb.RemoveIds(rms)
+			}
+			if err != nil {
+				t.Error(err)
+				return
+			}
+			for _, xid := range rms {
+				removed[xid] = true
+			}
+			time.Sleep(time.Millisecond)
+		}
+	}()
+	require.NoError(t, vdb.SyncIndex())
+	close(done)
+	wg.Wait()
+
+	// All rows are added before the build ends.
+	require.Greater(t, iters, nt/100)
+	check := func(vdb *VectoDB) {
+		cur, err := vdb.Scan(0, 1)
+		require.NoError(t, err)
+		var scanned int
+		for {
+			_, xids2, err := cur.Next(4096)
+			require.NoError(t, err)
+			if len(xids2) == 0 {
+				break
+			}
+			for _, xid := range xids2 {
+				require.False(t, removed[xid])
+			}
+			scanned += len(xids2)
+		}
+		require.NoError(t, cur.Close())
+		require.Equal(t, nb+nt-len(removed), scanned)
+		var searched int
+		for xid := range removed {
+			if searched++; searched > 200 {
+				break
+			}
+			num := int(xid / 3)
+			res, err := vdb.Search(5, xb[num*d:(num+1)*d], []string{""})
+			require.NoError(t, err)
+			for _, xs := range res[0] {
+				require.False(t, removed[xs.Xid])
+			}
+		}
+		// The re-added xid is found only by its new vector.
+		res, err := vdb.Search(5, xb[(nb+nt-1)*d:(nb+nt)*d], []string{""})
+		require.NoError(t, err)
+		require.NotEqual(t, readded, res[0][0].Xid)
+		res, err = vdb.Search(2, xb[d:2*d], []string{""})
+		require.NoError(t, err)
+		require.Equal(t, 2, len(res[0]))
+		require.Equal(t, xids[1]+readded, res[0][0].Xid+res[0][1].Xid)
+	}
+	require.NotEqual(t, 0, len(removed))
+	check(vdb)
+	// The next SyncIndex rebuilds without the tombstoned rows.
+	require.NoError(t, vdb.SyncIndex())
+	check(vdb)
+	require.NoError(t, vdb.Destroy())
+	vdb, err = NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	check(vdb)
+	require.NoError(t, vdb.Destroy())
+}
+
+// TestVectodbStats 各组件内存字节数不小于其数据量，倒排表统计与向量总数一致。
+func TestVectodbStats(t *testing.T) {
+	var err error
+	const d, nb, nlist int = 32, 201000, 256
+	const indexKey, queryParams string = "IVF256,SQ8", "nprobe=256"
+	xb, xids := randBase(35, d, nb)
+	within := func(want, have int) {
+		// Buffers grow geometrically.
+		require.GreaterOrEqual(t, have, want)
+		require.LessOrEqual(t, have, 2*want)
+	}
+	memory := func(stats VectoDBStats) int {
+		return stats.FlatBytes + stats.CodesBytes + stats.IdsBytes + stats.QuantizerBytes + stats.TablesBytes + stats.XidsBytes + stats.Xid2numBytes + stats.IngestBytes
+	}
+
+	VectodbClearWorkDir(workDir)
+	vdb, err := NewVectoDBWithIndex(workDir, d, indexKey, queryParams, false)
+	require.NoError(t, err)
+	const nf int = 1000
+	require.NoError(t, vdb.AddWithIds(xb[:nf*d], xids[:nf]))
+	stats, err := vdb.GetStats()
+	require.NoError(t, err)
+	// The initial flat index.
+	require.Equal(t, nf, stats.Total)
+	within(nf*d*4, stats.FlatBytes)
+	require.Equal(t, 0, stats.CodesBytes+stats.IdsBytes+stats.QuantizerBytes+stats.TablesBytes)
+	within(nf*8, stats.XidsBytes)
+	require.GreaterOrEqual(t, stats.Xid2numBytes, nf*(8+16+8))
+	require.GreaterOrEqual(t, stats.IngestBytes, 16<<20)
+	require.Equal(t, memory(stats), stats.MemoryBytes())
+	require.Equal(t, 0, stats.RecallQueries)
+	require.Equal(t, 0, stats.RecallWindow)
+	require.Equal(t, float64(-1), stats.Recall)
+	lists, err := vdb.GetListStats()
+	require.NoError(t, err)
+	require.Equal(t, 0, len(lists))
+
+	require.NoError(t, vdb.AddWithIds(xb[nf*d:], xids[nf:]))
+	require.NoError(t, vdb.SyncIndex())
+	stats, err = vdb.GetStats()
+	require.NoError(t, err)
+	// The refine flat index, SQ8 codes of 1 byte per dimension, the coarse quantizer, and the trained min and range per dimension.
+	require.Equal(t, nb, stats.Total)
+	within(nb*d*4, stats.FlatBytes)
+	require.GreaterOrEqual(t, stats.CodesBytes, nb*d)
+	require.GreaterOrEqual(t, stats.IdsBytes, nb*8)
+	within(nlist*d*4, stats.QuantizerBytes)
+	require.Equal(t, 2*d*4, stats.TablesBytes)
+	within(nb*8, stats.XidsBytes)
+	require.GreaterOrEqual(t, stats.Xid2numBytes, nb*(8+16+8))
+	require.Equal(t, memory(stats), stats.MemoryBytes())
+	lists, err = vdb.GetListStats()
+	require.NoError(t, err)
+	require.Equal(t, nlist, len(lists))
+	var size, codesBytes, idsBytes int
+	for _, l := range lists {
+		require.GreaterOrEqual(t, l.CodesBytes, l.Size*d)
+		require.GreaterOrEqual(t, l.IdsBytes, l.Size*8)
+		size += l.Size
+		codesBytes += l.CodesBytes
+		idsBytes += l.IdsBytes
+	}
+	require.Equal(t, nb, size)
+	// The rest is the array of lists.
+	require.Less(t, codesBytes, stats.CodesBytes)
+	require.LessOrEqual(t, stats.CodesBytes-codesBytes, 2*nlist*24)
+	require.Less(t, idsBytes, stats.IdsBytes)
+	require.LessOrEqual(t, stats.IdsBytes-idsBytes, 2*nlist*24)
+	require.NoError(t, vdb.Destroy())
+}
+
+// manifestChecksum is the FNV-1a variant of vectodb.cpp which hashes 8 bytes at a time.
+func manifestChecksum(data []byte) uint64 {
+	h := uint64(14695981039346656037)
+	const prime uint64 = 1099511628211
+	i := 0
+	for ; i+8 <= len(data); i += 8 {
+		h = (h ^ binary.LittleEndian.Uint64(data[i:])) * prime
+	}
+	for ; i < len(data); i++ {
+		h = (h ^ uint64(data[i])) * prime
+	}
+	return h
+}
+
+func readManifestField(t *testing.T, key string) string {
+	data, err := ioutil.ReadFile(workDir + "/MANIFEST")
+	require.NoError(t, err)
+	for _, line := range strings.Split(string(data), "\n") {
+		if strings.HasPrefix(line, key+"=") {
+			return strings.TrimPrefix(line, key+"=")
+		}
+	}
+	t.Fatalf("missing manifest field %v", key)
+	return ""
+}
+
+// rewriteManifest sets the value of key, and seals the manifest with a valid checksum.
+func rewriteManifest(t *testing.T, key, val string) {
+	data, err := ioutil.ReadFile(workDir + "/MANIFEST")
+	require.NoError(t, err)
+	var body string
+	for _, line := range strings.Split(string(data), "\n") {
+		if line == "" || strings.HasPrefix(line, "checksum=") {
+			break
+		}
+		if strings.HasPrefix(line, key+"=") {
+			line = key + "=" + val
+		}
+		body += line + "\n"
+	}
+	body += fmt.Sprintf("checksum=%d\n", manifestChecksum([]byte(body)))
+	require.NoError(t, ioutil.WriteFile(workDir+"/MANIFEST", []byte(body), 0644))
+}
+
 func normalizeInplace(d int, v []float32) {
 	var norm float32
 	for i := 0; i < d; i++ {
@@ -31,3 +925,63 @@ func normalizeInplace(d int, v []float32) {
 		v[i] /= norm
 	}
 }
+
+// randBase 生成n个d维的随机单位向量，第i个的xid为i*3
+func randBase(seed int64, d, n int) (xb []float32, xids []int64) {
+	rng := rand.New(rand.NewSource(seed))
+	xb = make([]float32, n*d)
+	xids = make([]int64, n)
+	for i := 0; i < n; i++ {
+		for j := 0; j < d; j++ {
+			xb[i*d+j] = rng.Float32() - 0.5
+		}
+		normalizeInplace(d, xb[i*d:(i+1)*d])
+		xids[i] = int64(i * 3)
+	}
+	return
+}
+
+// recallAtK 返回res的recall@k均值，真值为在未删除的行上暴力检索的前k个
+func recallAtK(d, k int, xb []float32, xids []int64, removed map[int64]bool, xq []float32, res [][]XidScore) float64 {
+	nq := len(xq) / d
+	var sum float64
+	for q := 0; q < nq; q++ {
+		exact := make([]XidScore, 0, len(xids))
+		for i, xid := range xids {
+			if removed[xid] {
+				continue
+			}
+			var score float32
+			for j := 0; j < d; j++ {
+				score += xq[q*d+j] * xb[i*d+j]
+			}
+			exact = append(exact, XidScore{Xid: xid, Score: score})
+		}
+		sort.Slice(exact, func(i, j int) bool { return exact[i].Score > exact[j].Score })
+		var hit int
+		for _, e := range exact[:k] {
+			for _, r := range res[q] {
+				if r.Xid == e.Xid {
+					hit++
+				}
+			}
+		}
+		sum += float64(hit) / float64(k)
+	}
+	return sum / float64(nq)
+}
+
+// waitRecallQueries 等待后台评估完至少n个采样查询，返回此时的统计
+func waitRecallQueries(t *testing.T, vdb *VectoDB, n int) (stats VectoDBStats) {
+	var err error
+	deadline := time.Now().Add(time.Minute)
+	for {
+		stats, err = vdb.GetStats()
+		require.NoError(t, err)
+		if stats.RecallQueries >= n {
+			return
+		}
+		require.True(t, time.Now().Before(deadline))
+		time.Sleep(10 * time.Millisecond)
+	}
+}
@@ -8,17 +8,17 @@ import "C"
 
 import (
 	"context"
+	"encoding/binary"
 	"fmt"
 	"hash"
 	"reflect"
 	"strconv"
+	"strings"
 	"sync"
-	"sync/atomic"
 	"time"
 	"unsafe"
 
 	"github.com/cespare/xxhash"
-	"github.com/go-redis/redis"
 	lru "github.com/hashicorp/golang-lru"
 	"github.com/pkg/errors"
 	log "github.com/sirupsen/logrus"
@@ -26,9 +26,36 @@ import (
 
 const (
 	SIZEOF_FLOAT32       = 4
+	SIZEOF_UINT64        = 8
 	ValidSeconds   int64 = 365 * 24 * 60 * 60 // 1 year
 )
 
+// Store writes are queued and flushed in one batch every FlushInterval, or once FlushBatchSize xids are pending.
+// A crash loses at most the writes queued since the last flush. Destroy tries the final flush FinalFlushAttempts times
+// with doubling backoff, and fails without destroying anything if the store still refuses it.
+const (
+	FlushInterval      = 100 * time.Millisecond
+	FlushBatchSize     = 1000
+	FinalFlushAttempts = 4
+)
+
+// Storage of VectoDBLite vectors. StorageFP16 and StorageSQ8 cut memory by 2x and 4x.
+// StorageSQ8 assumes normalized vectors. The store keeps the original vectors since a refresh only writes expireAt under
+// getExpireKey. Decoded vectors carry the quantization error, so only StorageFP32 leaves a snapshot.
+const (
+	StorageFP32 int = 0
+	StorageFP16 int = 1
+	StorageSQ8  int = 2
+)
+
+// VectoDBLiteOptions are optional settings of NewVectoDBLiteWithOptions.
+type VectoDBLiteOptions struct {
+	Slab      *VectoDBSlab // stores vectors in the shared slab under dbID if not nil. SearchK and SearchRange are not supported then.
+	Storage   int          // StorageFP32, StorageFP16 or StorageSQ8. Only StorageFP32 is supported with Slab.
+	Store     LiteStore    // persists items to Store instead of Redis at redisAddr if not nil. It's closed by Destroy, or by NewVectoDBLiteWithOptions on failure.
+	Prefilter bool         // Search and SearchRange scan binary codes before exact rerank. Assumes normalized vectors. Ignored with Slab.
+}
+
 // VectoDBLite is tiny stateless non-updatable non-removable vector database. Only supports metric type 0 - METRIC_INNER_PRODUCT.
 type VectoDBLite struct {
 	redisAddr     string
@@ -36,137 +63,429 @@ type VectoDBLite struct {
 	distThreshold float32
 	sizeLimit     int
 	dbKey         string
-	rcli          *redis.Client
-	lru           *lru.Cache //The three shall keep sync: redis, lru, flatC
+	store         LiteStore
+	lru           *lru.Cache //The three shall keep sync: store, lru, flatC. Vectors are only kept by flatC or slab.
+	evicted       []uint64   // xids evicted from lru, removed from flatC or slab by removeEvicted before rwlock is released
 	flatC         unsafe.Pointer
-	rwlock        sync.RWMutex // protect flatC
+	slab          *VectoDBSlab // replaces flatC if not nil, the tenant is dbID
+	dbID          int
+	gen           int64 // generation of the store at load, written to the snapshot
+	storage       int
+	prefilter     bool
+	rwlock        sync.RWMutex // protect flatC and evicted. Held by every lru mutation which may evict, lock order is rwlock -> lru.
 	h64           hash.Hash64
-	numEvicted    int32
+	expiry        *expiryBuckets
+	sweepMu       sync.RWMutex      // touch holds RLock, sweep holds Lock. Lock order is sweepMu -> rwlock.
+	pendMu        sync.Mutex        // protect pending
+	pending       map[string][]byte // store key -> marshaled VecTimestamp to write behind, nil means removal
+	flushCh       chan struct{}
 	cancel        context.CancelFunc
+	wg            sync.WaitGroup
 }
 
 func NewVectoDBLite(redisAddr string, dbID int, dimIn int, distThreshold float32, sizeLimit int) (vdbl *VectoDBLite, err error) {
+	return NewVectoDBLiteWithOptions(redisAddr, dbID, dimIn, distThreshold, sizeLimit, VectoDBLiteOptions{})
+}
+
+func NewVectoDBLiteWithOptions(redisAddr string, dbID int, dimIn int, distThreshold float32, sizeLimit int, opts VectoDBLiteOptions) (vdbl *VectoDBLite, err error) {
+	store := opts.Store
+	if store == nil {
+		store = NewLiteRedisStore(redisAddr, dbID)
+	}
+	defer func() {
+		if err != nil {
+			store.Close()
+			vdbl = nil
+		}
+	}()
+	slab := opts.Slab
+	if slab != nil && slab.dim != dimIn {
+		err = errors.Errorf("vectodblite %s slab dim mismatch, want %v, have %v", getDbKey(dbID), dimIn, slab.dim)
+		return
+	}
+	if opts.Storage < StorageFP32 || opts.Storage > StorageSQ8 || (slab != nil && opts.Storage != StorageFP32) {
+		err = errors.Errorf("vectodblite %s invalid storage %v", getDbKey(dbID), opts.Storage)
+		return
+	}
 	dbKey := getDbKey(dbID)
 	log.Infof("vectodblite %s creating", dbKey)
-	rcli := redis.NewClient(&redis.Options{
-		Addr:     redisAddr,
-		Password: "", // no password set
-		DB:       0,  // use default DB
-	})
 	vdbl = &VectoDBLite{
 		redisAddr:     redisAddr,
 		dim:           dimIn,
 		distThreshold: distThreshold,
 		sizeLimit:     sizeLimit,
 		dbKey:         dbKey,
-		rcli:          rcli,
+		slab:          slab,
+		dbID:          dbID,
+		storage:       opts.Storage,
+		prefilter:     opts.Prefilter,
+		store:         store,
 		h64:           xxhash.New(),
+		expiry:        newExpiryBuckets(),
+		pending:       make(map[string][]byte),
+		flushCh:       make(chan struct{}, 1),
 	}
+	// onEvicted is invoked with the lru lock held, and the caller holds rwlock. The vector is removed by removeEvicted
+	// before rwlock is released, so that adding to lru and flatC is atomic against eviction.
 	onEvicted := func(key, value interface{}) {
 		xidS := key.(string)
-		vdbl.rcli.HDel(vdbl.dbKey, xidS)
-		atomic.AddInt32(&vdbl.numEvicted, int32(1))
+		vdbl.expiry.remove(xidS)
+		vdbl.enqueue(xidS, nil)
+		vdbl.enqueue(getExpireKey(xidS), nil)
+		xid, err := strconv.ParseUint(xidS, 16, 64)
+		if err != nil {
+			log.Errorf("vectodblite %s got error %+v", vdbl.dbKey, errors.Wrapf(err, ""))
+			return
+		}
+		vdbl.evicted = append(vdbl.evicted, xid)
 	}
 	if vdbl.lru, err = lru.NewWithEvict(sizeLimit, onEvicted); err != nil {
 		err = errors.Wrapf(err, "")
 		return
 	}
-	ctx, cancel := context.WithCancel(context.TODO())
-	vdbl.cancel = cancel
-	go vdbl.servExpire(ctx)
 	if err = vdbl.load(); err != nil {
 		return
 	}
+	vdbl.serve()
 	return
 }
 
-// Init load data from redis
+// serve starts the background goroutines, which are stopped by cancel.
+func (vdbl *VectoDBLite) serve() {
+	ctx, cancel := context.WithCancel(context.TODO())
+	vdbl.cancel = cancel
+	vdbl.wg.Add(2)
+	go vdbl.servFlush(ctx)
+	go vdbl.servSweep(ctx)
+}
+
+// Init load data from the store. The snapshot left by the previous owner is preferred over items.
 func (vdbl *VectoDBLite) load() (err error) {
-	var vecMapS map[string]string
-	if vecMapS, err = vdbl.rcli.HGetAll(vdbl.dbKey).Result(); err != nil {
-		err = errors.Wrap(err, "")
+	var loaded bool
+	var xids []uint64
+	var vecs []float32
+	if loaded, xids, vecs, err = vdbl.loadSnapshot(); err != nil {
+		return
+	}
+	if !loaded {
+		if xids, vecs, err = vdbl.loadHash(); err != nil {
+			return
+		}
+	}
+	// Once this owner has loaded, a snapshot written later by any previous owner is stale.
+	if vdbl.gen, err = vdbl.store.BumpGeneration(); err != nil {
+		return
+	}
+	if err = vdbl.rebuildFlatC(xids, vecs); err != nil {
+		return
+	}
+	return
+}
+
+// loadHash adds items to lru, and returns their vectors for rebuildFlatC.
+func (vdbl *VectoDBLite) loadHash() (xids []uint64, vecs []float32, err error) {
+	var items map[string][]byte
+	if items, err = vdbl.store.LoadAll(); err != nil {
 		return
 	}
-	log.Debugf("vectodblite %s HGetAll: %+v", vdbl.dbKey, vecMapS)
+	log.Debugf("vectodblite %s loaded %v items", vdbl.dbKey, len(items))
+	// Refreshed expireAts are kept apart from the items.
+	refreshed := make(map[string]int64)
+	for key, vtB := range items {
+		if !strings.HasSuffix(key, expireKeySuffix) {
+			continue
+		}
+		vt := VecTimestamp{}
+		if err = vt.Unmarshal(vtB); err != nil {
+			err = errors.Wrapf(err, "")
+			return
+		}
+		refreshed[strings.TrimSuffix(key, expireKeySuffix)] = vt.ExpireAt
+		delete(items, key)
+	}
 	expiredXids := make([]string, 0)
+	xids = make([]uint64, 0, len(items))
+	vecs = make([]float32, 0, len(items)*vdbl.dim)
 	now := time.Now().Unix()
-	for xidS, vtS := range vecMapS {
+	for xidS, vtB := range items {
 		vt := VecTimestamp{}
-		if err = vt.Unmarshal([]byte(vtS)); err != nil {
+		if err = vt.Unmarshal(vtB); err != nil {
 			err = errors.Wrapf(err, "")
 			return
 		}
+		// An item written after the refresh has the later expireAt.
+		if expireAt, ok := refreshed[xidS]; ok {
+			delete(refreshed, xidS)
+			if expireAt > vt.ExpireAt {
+				vt.ExpireAt = expireAt
+			}
+		}
 		if vt.ExpireAt < now {
 			expiredXids = append(expiredXids, xidS)
-		} else {
-			vdbl.lru.Add(xidS, &vt)
+			continue
+		}
+		var xid uint64
+		if xid, err = strconv.ParseUint(xidS, 16, 64); err != nil {
+			err = errors.Wrapf(err, "")
+			return
+		}
+		if len(vt.Vec) != vdbl.dim {
+			err = errors.Errorf("vectodblite %s item %s dim mismatch, want %v, have %v", vdbl.dbKey, xidS, vdbl.dim, len(vt.Vec))
+			return
 		}
+		xids = append(xids, xid)
+		vecs = append(vecs, vt.Vec...)
+		vt.Vec = nil
+		vdbl.lru.Add(xidS, &vt)
+		vdbl.expiry.schedule(xidS, &vt, vt.ExpireAt)
 	}
 
 	if len(expiredXids) != 0 {
-		log.Infof("vectodblite %s purging expired items from redis: %v", vdbl.dbKey, expiredXids)
+		log.Infof("vectodblite %s purging expired items from store: %v", vdbl.dbKey, expiredXids)
 		for _, xidS := range expiredXids {
-			if _, err = vdbl.rcli.HDel(vdbl.dbKey, xidS).Result(); err != nil {
-				err = errors.Wrapf(err, "")
-				return
-			}
+			vdbl.enqueue(xidS, nil)
+			vdbl.enqueue(getExpireKey(xidS), nil)
 		}
 	}
+	// Left by a crash between the removal of an item and of its expireAt.
+	for xidS := range refreshed {
+		vdbl.enqueue(getExpireKey(xidS), nil)
+	}
+	return
+}
 
-	if err = vdbl.rebuildFlatC(); err != nil {
+// Snapshot layout, little endian: dim int64, n int64, gen int64, xids [n]uint64, expireAts [n]int64, vecs [n*dim]float32.
+// Items are in LRU order, oldest first. gen is the store generation of the owner which wrote it.
+const snapHeaderSize = 24
+
+// loadSnapshot takes the snapshot. The snapshot is consumed once since items move on as soon as the new owner writes,
+// and a later owner shall fall back to items. A corrupted snapshot, or one written by an owner which has been followed
+// by another owner, is discarded and items are loaded instead.
+func (vdbl *VectoDBLite) loadSnapshot() (loaded bool, xids []uint64, vecs []float32, err error) {
+	var snap []byte
+	if snap, err = vdbl.store.TakeSnapshot(); err != nil || snap == nil {
 		return
 	}
-
+	if len(snap) < snapHeaderSize {
+		log.Errorf("vectodblite %s discarded corrupted snapshot, want size >=%v, have %v", vdbl.dbKey, snapHeaderSize, len(snap))
+		return
+	}
+	dim := int(binary.LittleEndian.Uint64(snap[0:]))
+	n := int(binary.LittleEndian.Uint64(snap[8:]))
+	gen := int64(binary.LittleEndian.Uint64(snap[16:]))
+	if dim != vdbl.dim {
+		err = errors.Errorf("vectodblite %s snapshot dim mismatch, want %v, have %v", vdbl.dbKey, vdbl.dim, dim)
+		return
+	}
+	if want := snapHeaderSize + n*(16+dim*SIZEOF_FLOAT32); n < 0 || len(snap) != want {
+		log.Errorf("vectodblite %s discarded corrupted snapshot, want size %v, have %v", vdbl.dbKey, want, len(snap))
+		return
+	}
+	var curGen int64
+	if curGen, err = vdbl.store.Generation(); err != nil {
+		return
+	}
+	if gen != curGen {
+		log.Errorf("vectodblite %s discarded stale snapshot of generation %v, current generation %v", vdbl.dbKey, gen, curGen)
+		return
+	}
+	xids = make([]uint64, n)
+	expireAts := make([]int64, n)
+	vecs = make([]float32, n*dim)
+	off := snapHeaderSize
+	off += copy(asBytes(unsafe.Pointer(&xids), SIZEOF_UINT64), snap[off:])
+	off += copy(asBytes(unsafe.Pointer(&expireAts), SIZEOF_UINT64), snap[off:])
+	copy(asBytes(unsafe.Pointer(&vecs), SIZEOF_FLOAT32), snap[off:])
+	now := time.Now().Unix()
+	for i := 0; i < n; i++ {
+		xidS := getXidKey(xids[i])
+		if expireAts[i] < now {
+			vdbl.enqueue(xidS, nil)
+			vdbl.enqueue(getExpireKey(xidS), nil)
+			continue
+		}
+		vt := &VecTimestamp{}
+		vdbl.lru.Add(xidS, vt)
+		vdbl.expiry.schedule(xidS, vt, expireAts[i])
+	}
+	log.Infof("vectodblite %s loaded snapshot of %v items", vdbl.dbKey, n)
+	loaded = true
 	return
 }
 
-func (vdbl *VectoDBLite) rebuildFlatC() (err error) {
-	vdbl.rwlock.Lock()
-	defer vdbl.rwlock.Unlock()
-	if vdbl.flatC != nil {
-		C.IndexFlatDelete(vdbl.flatC)
+// saveSnapshot writes the items at lru to the snapshot. Vectors are taken from flatC or slab, so it's skipped with
+// compressed storage, and the next owner loads the original vectors from items instead.
+func (vdbl *VectoDBLite) saveSnapshot() (err error) {
+	if vdbl.storage != StorageFP32 {
+		log.Infof("vectodblite %s skipped snapshot of storage %v", vdbl.dbKey, vdbl.storage)
+		return
 	}
-	vdbl.flatC = C.IndexFlatNew(C.long(vdbl.dim))
-	var xid uint64
-	for _, xidInf := range vdbl.lru.Keys() {
+	keys := vdbl.lru.Keys()
+	n := len(keys)
+	xids := make([]uint64, 0, n)
+	expireAts := make([]int64, 0, n)
+	for _, xidInf := range keys {
+		var xid uint64
 		if xid, err = strconv.ParseUint(xidInf.(string), 16, 64); err != nil {
 			err = errors.Wrapf(err, "")
 			return
 		}
-		var vtInf interface{}
-		var ok bool
-		if vtInf, ok = vdbl.lru.Peek(xidInf); !ok {
-			err = errors.Errorf("vectodblite %s vdbl.lru is corrupted, want %v be present, have absent", vdbl.dbKey, xidInf.(string))
-			return
+		vtInf, ok := vdbl.lru.Peek(xidInf)
+		if !ok {
+			continue
+		}
+		xids = append(xids, xid)
+		expireAts = append(expireAts, vdbl.expiry.expireAt(vtInf.(*VecTimestamp)))
+	}
+	vecs := vdbl.reconstruct(xids)
+	// Drop items removed since lru.Keys.
+	n = 0
+	for i, xid := range xids {
+		if xid == ^uint64(0) {
+			continue
 		}
-		vt := vtInf.(*VecTimestamp)
-		C.IndexFlatAddWithIds(vdbl.flatC, C.long(1), (*C.float)(&vt.Vec[0]), (*C.ulong)(&xid))
+		xids[n], expireAts[n] = xid, expireAts[i]
+		copy(vecs[n*vdbl.dim:(n+1)*vdbl.dim], vecs[i*vdbl.dim:(i+1)*vdbl.dim])
+		n++
 	}
+	xids, expireAts, vecs = xids[:n], expireAts[:n], vecs[:n*vdbl.dim]
+	snap := make([]byte, snapHeaderSize, snapHeaderSize+n*(16+vdbl.dim*SIZEOF_FLOAT32))
+	binary.LittleEndian.PutUint64(snap[0:], uint64(vdbl.dim))
+	binary.LittleEndian.PutUint64(snap[8:], uint64(n))
+	binary.LittleEndian.PutUint64(snap[16:], uint64(vdbl.gen))
+	snap = append(snap, asBytes(unsafe.Pointer(&xids), SIZEOF_UINT64)...)
+	snap = append(snap, asBytes(unsafe.Pointer(&expireAts), SIZEOF_UINT64)...)
+	snap = append(snap, asBytes(unsafe.Pointer(&vecs), SIZEOF_FLOAT32)...)
+	if err = vdbl.store.PutSnapshot(snap); err != nil {
+		return
+	}
+	log.Infof("vectodblite %s saved snapshot of %v items", vdbl.dbKey, n)
 	return
 }
 
-func (vdbl *VectoDBLite) servExpire(ctx context.Context) {
-	tickCh := time.Tick(10 * time.Second)
+// rebuildFlatC adds the loaded vectors which are still at lru to a new flatC with one cgo call.
+func (vdbl *VectoDBLite) rebuildFlatC(xidsIn []uint64, vecsIn []float32) (err error) {
+	// Items may have been evicted while loading, flatC was nil then.
+	xids := xidsIn[:0]
+	vecs := vecsIn[:0]
+	for i, xid := range xidsIn {
+		if vdbl.lru.Contains(getXidKey(xid)) {
+			xids = append(xids, xid)
+			vecs = append(vecs, vecsIn[i*vdbl.dim:(i+1)*vdbl.dim]...)
+		}
+	}
+	if len(xids) != vdbl.lru.Len() {
+		err = errors.Errorf("vectodblite %s vdbl.lru is corrupted, want %v items, have %v", vdbl.dbKey, len(xids), vdbl.lru.Len())
+		return
+	}
+	vdbl.rwlock.Lock()
+	defer vdbl.rwlock.Unlock()
+	vdbl.evicted = vdbl.evicted[:0]
+	if vdbl.slab != nil {
+		vdbl.slab.removeTenant(vdbl.dbID)
+		vdbl.slab.add(vdbl.dbID, vecs, xids)
+		return
+	}
+	if vdbl.flatC != nil {
+		C.IndexFlatDelete(vdbl.flatC)
+	}
+	vdbl.flatC = C.IndexFlatNewWithStorage(C.long(vdbl.dim), C.int(vdbl.storage))
+	if vdbl.prefilter {
+		C.IndexFlatSetPrefilter(vdbl.flatC, C.int(1))
+	}
+	if len(xids) != 0 {
+		C.IndexFlatAddWithIds(vdbl.flatC, C.long(len(xids)), (*C.float)(&vecs[0]), (*C.ulong)(&xids[0]))
+	}
+	return
+}
+
+// enqueue coalesces a store write of xidS with the pending one. vtB is nil for removal.
+func (vdbl *VectoDBLite) enqueue(xidS string, vtB []byte) {
+	vdbl.pendMu.Lock()
+	vdbl.pending[xidS] = vtB
+	full := len(vdbl.pending) >= FlushBatchSize
+	vdbl.pendMu.Unlock()
+	if full {
+		select {
+		case vdbl.flushCh <- struct{}{}:
+		default:
+		}
+	}
+}
+
+func (vdbl *VectoDBLite) servFlush(ctx context.Context) {
+	defer vdbl.wg.Done()
+	ticker := time.NewTicker(FlushInterval)
+	defer ticker.Stop()
 	for {
 		select {
 		case <-ctx.Done():
-			log.Infof("vectodblite %s servExpire goroutine exited", vdbl.dbKey)
+			// Destroy does the final flush.
+			log.Infof("vectodblite %s servFlush goroutine exited", vdbl.dbKey)
 			return
-		case <-tickCh:
-			if atomic.SwapInt32(&vdbl.numEvicted, 0) != 0 {
-				if err := vdbl.rebuildFlatC(); err != nil {
-					log.Errorf("vectodblite %s got error %+v", vdbl.dbKey, err)
-				}
+		case <-ticker.C:
+		case <-vdbl.flushCh:
+		}
+		if err := vdbl.flush(); err != nil {
+			log.Errorf("vectodblite %s got error %+v", vdbl.dbKey, err)
+		}
+	}
+}
+
+// flush writes all pending writes to the store in one batch. On failure they are queued again unless superseded meanwhile.
+func (vdbl *VectoDBLite) flush() (err error) {
+	vdbl.pendMu.Lock()
+	batch := vdbl.pending
+	if len(batch) == 0 {
+		vdbl.pendMu.Unlock()
+		return
+	}
+	vdbl.pending = make(map[string][]byte, len(batch))
+	vdbl.pendMu.Unlock()
+
+	if err = vdbl.store.Apply(batch); err != nil {
+		vdbl.pendMu.Lock()
+		for xidS, vtB := range batch {
+			if _, ok := vdbl.pending[xidS]; !ok {
+				vdbl.pending[xidS] = vtB
 			}
 		}
+		vdbl.pendMu.Unlock()
 	}
+	return
 }
 
+// Destroy flushes pending writes and leaves a snapshot for the next owner. If the final flush keeps failing, it returns
+// the error and the db keeps serving, so that the caller keeps the ownership and may retry later.
 func (vdbl *VectoDBLite) Destroy() (err error) {
 	log.Infof("vectodblite %s destroying", vdbl.dbKey)
 	vdbl.cancel()
+	vdbl.wg.Wait()
+	for attempt := 0; ; attempt++ {
+		if err = vdbl.flush(); err == nil {
+			break
+		}
+		log.Errorf("vectodblite %s final flush attempt %d got error %+v", vdbl.dbKey, attempt, err)
+		if attempt+1 >= FinalFlushAttempts {
+			vdbl.serve()
+			err = errors.Wrapf(err, "vectodblite %s failed to flush pending writes", vdbl.dbKey)
+			return
+		}
+		time.Sleep(FlushInterval << uint(attempt))
+	}
+	// Items are all in the store now, the snapshot only speeds up the next load.
+	if err = vdbl.saveSnapshot(); err != nil {
+		log.Errorf("vectodblite %s got error %+v", vdbl.dbKey, err)
+	}
+	if err = vdbl.store.Close(); err != nil {
+		log.Errorf("vectodblite %s got error %+v", vdbl.dbKey, err)
+		err = nil
+	}
 	vdbl.rwlock.Lock()
 	defer vdbl.rwlock.Unlock()
+	if vdbl.slab != nil {
+		vdbl.slab.removeTenant(vdbl.dbID)
+	}
 	if vdbl.flatC != nil {
 		C.IndexFlatDelete(vdbl.flatC)
 		vdbl.flatC = nil
@@ -188,72 +507,281 @@ func (vdbl *VectoDBLite) AddWithId(xb []float32, xid uint64) (err error) {
 		return
 	}
 	xidS := getXidKey(xid)
-	vt := &VecTimestamp{
-		Vec:      xb,
-		ExpireAt: time.Now().Unix() + ValidSeconds,
-	}
+	expireAt := time.Now().Unix() + ValidSeconds
 	var vtB []byte
-	if vtB, err = vt.Marshal(); err != nil {
+	if vtB, err = (&VecTimestamp{Vec: xb, ExpireAt: expireAt}).Marshal(); err != nil {
 		err = errors.Wrapf(err, "")
 		return
 	}
-
-	if _, err = vdbl.rcli.HSet(vdbl.dbKey, xidS, string(vtB)).Result(); err != nil {
-		err = errors.Wrapf(err, "")
-		return
+	vt := &VecTimestamp{}
+	// The vector lands before the item, and the ones evicted by it are removed under the same lock.
+	vdbl.rwlock.Lock()
+	if vdbl.slab != nil {
+		vdbl.slab.add(vdbl.dbID, xb, []uint64{xid})
+	} else {
+		C.IndexFlatAddWithIds(vdbl.flatC, C.long(1), (*C.float)(&xb[0]), (*C.ulong)(&xid))
 	}
 	vdbl.lru.Add(xidS, vt)
-	vdbl.rwlock.Lock()
-	C.IndexFlatAddWithIds(vdbl.flatC, C.long(1), (*C.float)(&xb[0]), (*C.ulong)(&xid))
+	vdbl.expiry.schedule(xidS, vt, expireAt)
+	vdbl.removeEvicted()
+	// Queued in the same critical section, so that it's ordered with the removal queued by a later eviction.
+	vdbl.enqueue(xidS, vtB)
 	vdbl.rwlock.Unlock()
 	return
 }
 
+// Search returns the nearest vector whose distance is larger than distThreshold. xid is ^uint64(0) if there's none.
 func (vdbl *VectoDBLite) Search(xq []float32) (xid uint64, distance float32, err error) {
-	if len(xq) != vdbl.dim {
-		err = errors.Errorf("vectodblite %s invalid length of xq, want %v, have %v", vdbl.dbKey, vdbl.dim, len(xq))
+	var xids []uint64
+	var distances []float32
+	if vdbl.slab != nil {
+		if xids, distances, err = vdbl.searchSlab(xq); err != nil {
+			return
+		}
+	} else if xids, distances, err = vdbl.SearchRange(xq, vdbl.distThreshold, 1); err != nil {
+		return
+	}
+	xid = ^uint64(0)
+	if len(xids) != 0 {
+		xid, distance = xids[0], distances[0]
+	}
+	return
+}
+
+// SearchK returns the top k vectors in descending order of distance.
+func (vdbl *VectoDBLite) SearchK(xq []float32, k int) (xids []uint64, distances []float32, err error) {
+	if vdbl.slab != nil {
+		err = errors.Errorf("vectodblite %s SearchK is not supported with a slab", vdbl.dbKey)
+		return
+	}
+	if err = vdbl.checkSearch(xq, k); err != nil {
+		return
+	}
+	xids = make([]uint64, k)
+	distances = make([]float32, k)
+	vdbl.rwlock.RLock()
+	C.IndexFlatSearchK(vdbl.flatC, C.long(1), (*C.float)(&xq[0]), C.long(k), (*C.float)(&distances[0]), (*C.ulong)(&xids[0]))
+	vdbl.rwlock.RUnlock()
+	return vdbl.touchAll(xids, distances)
+}
+
+// SearchRange returns at most k vectors whose distance is larger than distThr, in descending order of distance.
+// The threshold is applied inside the kernel, so vectors below it are never collected.
+func (vdbl *VectoDBLite) SearchRange(xq []float32, distThr float32, k int) (xids []uint64, distances []float32, err error) {
+	if vdbl.slab != nil {
+		err = errors.Errorf("vectodblite %s SearchRange is not supported with a slab", vdbl.dbKey)
+		return
+	}
+	if err = vdbl.checkSearch(xq, k); err != nil {
+		return
+	}
+	xids = make([]uint64, k)
+	distances = make([]float32, k)
+	vdbl.rwlock.RLock()
+	n := int(C.IndexFlatRangeSearch(vdbl.flatC, (*C.float)(&xq[0]), C.float(distThr), C.long(k), (*C.float)(&distances[0]), (*C.ulong)(&xids[0])))
+	vdbl.rwlock.RUnlock()
+	return vdbl.touchAll(xids[:n], distances[:n])
+}
+
+func (vdbl *VectoDBLite) searchSlab(xq []float32) (xids []uint64, distances []float32, err error) {
+	if err = vdbl.checkSearch(xq, 1); err != nil {
 		return
 	}
 	vdbl.rwlock.RLock()
-	C.IndexFlatSearch(vdbl.flatC, C.long(1), (*C.float)(&xq[0]), (*C.float)(&distance), (*C.ulong)(&xid))
+	xids, distances, err = vdbl.slab.Search([]int{vdbl.dbID}, xq)
 	vdbl.rwlock.RUnlock()
-	if xid != ^uint64(0) {
-		//search ok, update expireAt at lur, and redis.
-		xidS := getXidKey(xid)
-		var vtInf interface{}
+	if err != nil {
+		return
+	}
+	if distances[0] <= vdbl.distThreshold {
+		xids, distances = xids[:0], distances[:0]
+	}
+	return vdbl.touchAll(xids, distances)
+}
+
+func (vdbl *VectoDBLite) checkSearch(xq []float32, k int) (err error) {
+	if len(xq) != vdbl.dim {
+		err = errors.Errorf("vectodblite %s invalid length of xq, want %v, have %v", vdbl.dbKey, vdbl.dim, len(xq))
+		return
+	}
+	if k <= 0 {
+		err = errors.Errorf("vectodblite %s invalid k, want >0, have %v", vdbl.dbKey, k)
+		return
+	}
+	return
+}
+
+// touchAll refreshes expireAt of search results, and drops results which are absent at lru.
+func (vdbl *VectoDBLite) touchAll(xidsIn []uint64, distancesIn []float32) (xids []uint64, distances []float32, err error) {
+	xids = xidsIn[:0]
+	distances = distancesIn[:0]
+	for i, xid := range xidsIn {
+		if xid == ^uint64(0) {
+			continue
+		}
 		var ok bool
-		if vtInf, ok = vdbl.lru.Get(xidS); !ok {
-			log.Infof("vectodblite %s xid %v in IndexFlat is absent in LRU", vdbl.dbKey, xidS)
-			xid = ^uint64(0)
+		if ok, err = vdbl.touch(xid); err != nil {
 			return
+		} else if ok {
+			xids = append(xids, xid)
+			distances = append(distances, distancesIn[i])
 		}
-		vt := vtInf.(*VecTimestamp)
-		vt.ExpireAt = time.Now().Unix() + ValidSeconds
-		var vtB []byte
-		if vtB, err = vt.Marshal(); err != nil {
-			err = errors.Wrapf(err, "")
-			return
+	}
+	return
+}
+
+func (vdbl *VectoDBLite) touch(xid uint64) (ok bool, err error) {
+	xidS := getXidKey(xid)
+	var vtInf interface{}
+	// Either the item is refreshed before sweep pops it, or it's already swept and absent at lru.
+	vdbl.sweepMu.RLock()
+	if vtInf, ok = vdbl.lru.Get(xidS); !ok {
+		vdbl.sweepMu.RUnlock()
+		log.Infof("vectodblite %s xid %v in IndexFlat is absent in LRU", vdbl.dbKey, xidS)
+		return
+	}
+	vt := vtInf.(*VecTimestamp)
+	expireAt := time.Now().Unix() + ValidSeconds
+	moved := vdbl.expiry.refresh(xidS, vt, expireAt)
+	vdbl.sweepMu.RUnlock()
+	if !moved {
+		return
+	}
+	// Only expireAt is written, so the item keeps its original vector. Marshal a copy since vt.ExpireAt is only stable
+	// under the expiry lock.
+	var vtB []byte
+	if vtB, err = (&VecTimestamp{ExpireAt: expireAt}).Marshal(); err != nil {
+		err = errors.Wrapf(err, "")
+		return
+	}
+	// Evictions hold rwlock, so under RLock the write is queued either before the removal, or not at all if evicted meanwhile.
+	vdbl.rwlock.RLock()
+	defer vdbl.rwlock.RUnlock()
+	if !vdbl.lru.Contains(xidS) {
+		return
+	}
+	vdbl.enqueue(getExpireKey(xidS), vtB)
+	return
+}
+
+// reconstruct returns vectors of xids from flatC or slab, decoded if compressed. xids of absent vectors are set to ^uint64(0).
+func (vdbl *VectoDBLite) reconstruct(xids []uint64) (vecs []float32) {
+	vecs = make([]float32, len(xids)*vdbl.dim)
+	if len(xids) == 0 {
+		return
+	}
+	vdbl.rwlock.RLock()
+	defer vdbl.rwlock.RUnlock()
+	if vdbl.slab != nil {
+		vdbl.slab.reconstruct(vdbl.dbID, xids, vecs)
+	} else if vdbl.flatC != nil {
+		C.IndexFlatReconstruct(vdbl.flatC, C.long(len(xids)), (*C.ulong)(&xids[0]), (*C.float)(&vecs[0]))
+	} else {
+		for i := range xids {
+			xids[i] = ^uint64(0)
 		}
-		if _, err = vdbl.rcli.HSet(vdbl.dbKey, xidS, string(vtB)).Result(); err != nil {
-			err = errors.Wrapf(err, "")
+	}
+	return
+}
+
+// removeEvicted removes vectors of items evicted from lru from flatC or slab. rwlock shall be held.
+func (vdbl *VectoDBLite) removeEvicted() {
+	if len(vdbl.evicted) == 0 {
+		return
+	}
+	if vdbl.slab != nil {
+		for _, xid := range vdbl.evicted {
+			vdbl.slab.remove(vdbl.dbID, xid)
+		}
+	} else if vdbl.flatC != nil {
+		C.IndexFlatRemoveIds(vdbl.flatC, C.long(len(vdbl.evicted)), (*C.ulong)(&vdbl.evicted[0]))
+	}
+	vdbl.evicted = vdbl.evicted[:0]
+}
+
+func (vdbl *VectoDBLite) servSweep(ctx context.Context) {
+	defer vdbl.wg.Done()
+	ticker := time.NewTicker(SweepInterval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-ctx.Done():
+			log.Infof("vectodblite %s servSweep goroutine exited", vdbl.dbKey)
 			return
+		case <-ticker.C:
+		}
+		// Sweep batch by batch so that no lock is held for long.
+		for ctx.Err() == nil && vdbl.sweep(time.Now().Unix()) == SweepBatchSize {
 		}
 	}
-	return
+}
+
+// sweep removes a batch of expired items from lru, flatC and the store.
+// sweepMu and rwlock are held from popping to removal, so that an item re-added or refreshed meanwhile is not removed.
+func (vdbl *VectoDBLite) sweep(now int64) (swept int) {
+	vdbl.sweepMu.Lock()
+	vdbl.rwlock.Lock()
+	xidSs := vdbl.expiry.popExpired(now, SweepBatchSize)
+	for _, xidS := range xidSs {
+		vdbl.lru.Remove(xidS)
+	}
+	vdbl.removeEvicted()
+	vdbl.rwlock.Unlock()
+	vdbl.sweepMu.Unlock()
+	if len(xidSs) != 0 {
+		log.Infof("vectodblite %s swept %v expired items", vdbl.dbKey, len(xidSs))
+	}
+	return len(xidSs)
 }
 
 func (vdbl *VectoDBLite) Size() int {
 	return vdbl.lru.Len()
 }
 
+// indexSize returns the number of vectors at flatC or slab. It equals Size when no write is in flight.
+func (vdbl *VectoDBLite) indexSize() int {
+	vdbl.rwlock.RLock()
+	defer vdbl.rwlock.RUnlock()
+	if vdbl.slab != nil {
+		return vdbl.slab.Size(vdbl.dbID)
+	} else if vdbl.flatC != nil {
+		return int(C.IndexFlatNtotal(vdbl.flatC))
+	}
+	return 0
+}
+
 func getXidKey(xid uint64) string {
 	return fmt.Sprintf("%016x", xid)
 }
 
+// expireKeySuffix marks the store key of a refreshed expireAt. xid keys are hexadecimal, so they never end with it.
+const expireKeySuffix = "_expire"
+
+// getExpireKey returns the store key of the refreshed expireAt of xidS, whose value is a VecTimestamp without Vec.
+func getExpireKey(xidS string) string {
+	return xidS + expireKeySuffix
+}
+
 func getDbKey(dbID int) string {
 	return fmt.Sprintf("vectodblite_%v", dbID)
 }
 
+func getSnapKey(dbID int) string {
+	return fmt.Sprintf("vectodblite_%v_snapshot", dbID)
+}
+
+func getGenKey(dbID int) string {
+	return fmt.Sprintf("vectodblite_%v_generation", dbID)
+}
+
+// asBytes reinterprets the slice pointed by slicePtr, whose element size is elemSize, as []byte without copying.
+func asBytes(slicePtr unsafe.Pointer, elemSize int) []byte {
+	header := *(*reflect.SliceHeader)(slicePtr)
+	header.Len *= elemSize
+	header.Cap *= elemSize
+	return *(*[]byte)(unsafe.Pointer(&header))
+}
+
 // allocateXid uses hash of vec as xid.
 func allocateXid(h64 hash.Hash64, vec []float32) (xid uint64) {
 	// https://stackoverflow.com/questions/11924196/convert-between-slices-of-different-types
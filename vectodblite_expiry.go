@@ -0,0 +1,125 @@
+package vectodb
+
+import (
+	"math"
+	"sync"
+	"time"
+)
+
+// VectoDBLite items are grouped into buckets of ExpireBucketSeconds by expireAt. A search hit writes the new expireAt to
+// the store only if it moves the item to a later bucket, so the persisted expireAt lags by at most one bucket.
+// Every SweepInterval, fully expired buckets are removed from the lru in batches of at most SweepBatchSize xids.
+const (
+	ExpireBucketSeconds int64 = 60 * 60
+	SweepInterval             = time.Minute
+	SweepBatchSize            = 1000
+)
+
+// expiryBuckets indexes xids by expireAt bucket. Lock order is lru -> mu.
+type expiryBuckets struct {
+	mu        sync.Mutex
+	buckets   map[int64]map[string]struct{} // bucket -> xids
+	bucketOf  map[string]int64              // xid -> bucket
+	minBucket int64                         // buckets before it are empty
+}
+
+func newExpiryBuckets() *expiryBuckets {
+	return &expiryBuckets{
+		buckets:   make(map[int64]map[string]struct{}),
+		bucketOf:  make(map[string]int64),
+		minBucket: math.MaxInt64,
+	}
+}
+
+func (eb *expiryBuckets) move(xidS string, bucket int64) {
+	if old, ok := eb.bucketOf[xidS]; ok {
+		delete(eb.buckets[old], xidS)
+		if len(eb.buckets[old]) == 0 {
+			delete(eb.buckets, old)
+		}
+	}
+	xidSet, ok := eb.buckets[bucket]
+	if !ok {
+		xidSet = make(map[string]struct{})
+		eb.buckets[bucket] = xidSet
+	}
+	xidSet[xidS] = struct{}{}
+	eb.bucketOf[xidS] = bucket
+	if bucket < eb.minBucket {
+		eb.minBucket = bucket
+	}
+}
+
+// schedule sets the expireAt of vt, and adds or moves xidS to its bucket.
+func (eb *expiryBuckets) schedule(xidS string, vt *VecTimestamp, expireAt int64) {
+	eb.mu.Lock()
+	vt.ExpireAt = expireAt
+	eb.move(xidS, expireAt/ExpireBucketSeconds)
+	eb.mu.Unlock()
+}
+
+// refresh sets the expireAt of vt. It returns true if xidS moved to another bucket, which needs a store write.
+// xidS is left alone if it has been removed meanwhile.
+func (eb *expiryBuckets) refresh(xidS string, vt *VecTimestamp, expireAt int64) (moved bool) {
+	eb.mu.Lock()
+	defer eb.mu.Unlock()
+	old, ok := eb.bucketOf[xidS]
+	if !ok {
+		return
+	}
+	vt.ExpireAt = expireAt
+	if bucket := expireAt / ExpireBucketSeconds; bucket != old {
+		eb.move(xidS, bucket)
+		moved = true
+	}
+	return
+}
+
+// expireAt reads the expireAt of vt, which is only stable under the lock.
+func (eb *expiryBuckets) expireAt(vt *VecTimestamp) int64 {
+	eb.mu.Lock()
+	defer eb.mu.Unlock()
+	return vt.ExpireAt
+}
+
+func (eb *expiryBuckets) remove(xidS string) {
+	eb.mu.Lock()
+	if old, ok := eb.bucketOf[xidS]; ok {
+		delete(eb.bucketOf, xidS)
+		delete(eb.buckets[old], xidS)
+		if len(eb.buckets[old]) == 0 {
+			delete(eb.buckets, old)
+		}
+	}
+	eb.mu.Unlock()
+}
+
+// popExpired removes and returns at most limit xids of buckets which are fully expired at now.
+func (eb *expiryBuckets) popExpired(now int64, limit int) (xidSs []string) {
+	eb.mu.Lock()
+	defer eb.mu.Unlock()
+	nowBucket := now / ExpireBucketSeconds
+	for ; eb.minBucket < nowBucket; eb.minBucket++ {
+		xidSet := eb.buckets[eb.minBucket]
+		for xidS := range xidSet {
+			if len(xidSs) >= limit {
+				return
+			}
+			xidSs = append(xidSs, xidS)
+			delete(xidSet, xidS)
+			delete(eb.bucketOf, xidS)
+		}
+		delete(eb.buckets, eb.minBucket)
+		if len(eb.buckets) == 0 {
+			eb.minBucket = math.MaxInt64
+			return
+		}
+	}
+	return
+}
+
+func (eb *expiryBuckets) Len() int {
+	eb.mu.Lock()
+	defer eb.mu.Unlock()
+	return len(eb.bucketOf)
+}
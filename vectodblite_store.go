@@ -0,0 +1,417 @@
+package vectodb
+
+import (
+	"encoding/binary"
+	"hash/crc32"
+	"os"
+	"path/filepath"
+	"syscall"
+
+	"github.com/go-redis/redis"
+	"github.com/pkg/errors"
+	log "github.com/sirupsen/logrus"
+)
+
+// LiteStore persists the items of a VectoDBLite. An item is a xid key and a marshaled VecTimestamp. A refreshed expireAt
+// is a VecTimestamp without Vec under the key getExpireKey(xid key).
+type LiteStore interface {
+	// LoadAll returns all persisted items.
+	LoadAll() (items map[string][]byte, err error)
+	// Apply writes a batch of items. A nil value means removal.
+	Apply(batch map[string][]byte) (err error)
+	// TakeSnapshot returns and removes the handover snapshot. snap is nil if there's none.
+	TakeSnapshot() (snap []byte, err error)
+	// PutSnapshot writes the handover snapshot.
+	PutSnapshot(snap []byte) (err error)
+	// Generation returns the number of times BumpGeneration has been called, 0 if never.
+	Generation() (gen int64, err error)
+	// BumpGeneration increments the generation and returns the new one. Each owner bumps it once at load.
+	BumpGeneration() (gen int64, err error)
+	Close() (err error)
+}
+
+// redisStore keeps items in the hash dbKey, the snapshot at snapKey, and the generation at genKey.
+type redisStore struct {
+	rcli    *redis.Client
+	dbKey   string
+	snapKey string
+	genKey  string
+}
+
+func NewLiteRedisStore(redisAddr string, dbID int) LiteStore {
+	rcli := redis.NewClient(&redis.Options{
+		Addr:     redisAddr,
+		Password: "", // no password set
+		DB:       0,  // use default DB
+	})
+	return &redisStore{
+		rcli:    rcli,
+		dbKey:   getDbKey(dbID),
+		snapKey: getSnapKey(dbID),
+		genKey:  getGenKey(dbID),
+	}
+}
+
+func (rs *redisStore) LoadAll() (items map[string][]byte, err error) {
+	var vecMapS map[string]string
+	if vecMapS, err = rs.rcli.HGetAll(rs.dbKey).Result(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	items = make(map[string][]byte, len(vecMapS))
+	for xidS, vtS := range vecMapS {
+		items[xidS] = []byte(vtS)
+	}
+	return
+}
+
+func (rs *redisStore) Apply(batch map[string][]byte) (err error) {
+	pipe := rs.rcli.Pipeline()
+	defer pipe.Close()
+	for xidS, vtB := range batch {
+		if vtB == nil {
+			pipe.HDel(rs.dbKey, xidS)
+		} else {
+			pipe.HSet(rs.dbKey, xidS, string(vtB))
+		}
+	}
+	if _, err = pipe.Exec(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	return
+}
+
+// TakeSnapshot fetches and deletes the snapshot atomically.
+func (rs *redisStore) TakeSnapshot() (snap []byte, err error) {
+	var getCmd *redis.StringCmd
+	_, err = rs.rcli.TxPipelined(func(pipe redis.Pipeliner) error {
+		getCmd = pipe.Get(rs.snapKey)
+		pipe.Del(rs.snapKey)
+		return nil
+	})
+	if err == redis.Nil {
+		err = nil
+		return
+	} else if err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	if snap, err = getCmd.Bytes(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	return
+}
+
+func (rs *redisStore) PutSnapshot(snap []byte) (err error) {
+	if err = rs.rcli.Set(rs.snapKey, snap, 0).Err(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	return
+}
+
+func (rs *redisStore) Generation() (gen int64, err error) {
+	if gen, err = rs.rcli.Get(rs.genKey).Int64(); err == redis.Nil {
+		gen, err = 0, nil
+	} else if err != nil {
+		err = errors.Wrap(err, "")
+	}
+	return
+}
+
+func (rs *redisStore) BumpGeneration() (gen int64, err error) {
+	if gen, err = rs.rcli.Incr(rs.genKey).Result(); err != nil {
+		err = errors.Wrap(err, "")
+	}
+	return
+}
+
+func (rs *redisStore) Close() (err error) {
+	if err = rs.rcli.Close(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	return
+}
+
+// localStore keeps items in a directory: "base" is a compacted image of all items, and "log" is the append-only log of
+// batches applied since. The log is compacted into base once it grows larger than base.
+// A record is crc32 uint32 | keyLen uint32 | valLen int32 (-1 for removal) | key | val, little endian. crc32 covers
+// everything after itself, so a torn tail is detected and dropped at load.
+type localStore struct {
+	dir      string
+	logFile  *os.File
+	logSize  int64
+	baseSize int64
+}
+
+const (
+	localBaseFile = "base"
+	localLogFile  = "log"
+	localSnapFile = "snapshot"
+	localGenFile  = "generation"
+	// The log is compacted once it's larger than both this and base.
+	localCompactMinBytes = 64 << 20
+	localRecordHeader    = 12
+)
+
+// NewLiteLocalStore creates a local store at dir/vectodblite_<dbID>.
+func NewLiteLocalStore(dir string, dbID int) (store LiteStore, err error) {
+	var ls *localStore
+	if ls, err = newLocalStore(filepath.Join(dir, getDbKey(dbID))); err != nil {
+		return
+	}
+	store = ls
+	return
+}
+
+func newLocalStore(dir string) (ls *localStore, err error) {
+	if err = os.MkdirAll(dir, 0755); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	ls = &localStore{dir: dir}
+	if ls.logFile, err = os.OpenFile(filepath.Join(dir, localLogFile), os.O_CREATE|os.O_RDWR|os.O_APPEND, 0644); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	var fi os.FileInfo
+	if fi, err = ls.logFile.Stat(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	ls.logSize = fi.Size()
+	if fi, err = os.Stat(filepath.Join(dir, localBaseFile)); err == nil {
+		ls.baseSize = fi.Size()
+	} else if !os.IsNotExist(err) {
+		err = errors.Wrap(err, "")
+		return
+	}
+	err = nil
+	return
+}
+
+func appendRecord(buf []byte, key string, val []byte) []byte {
+	start := len(buf)
+	var hdr [localRecordHeader]byte
+	buf = append(buf, hdr[:]...)
+	binary.LittleEndian.PutUint32(buf[start+4:], uint32(len(key)))
+	valLen := int32(-1)
+	if val != nil {
+		valLen = int32(len(val))
+	}
+	binary.LittleEndian.PutUint32(buf[start+8:], uint32(valLen))
+	buf = append(buf, key...)
+	buf = append(buf, val...)
+	binary.LittleEndian.PutUint32(buf[start:], crc32.ChecksumIEEE(buf[start+4:]))
+	return buf
+}
+
+// replay applies records of the mmapped file to items, and returns the length of the valid prefix.
+func replay(fp string, items map[string][]byte) (valid int64, err error) {
+	var f *os.File
+	if f, err = os.Open(fp); err != nil {
+		if os.IsNotExist(err) {
+			err = nil
+		} else {
+			err = errors.Wrap(err, "")
+		}
+		return
+	}
+	defer f.Close()
+	var fi os.FileInfo
+	if fi, err = f.Stat(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	if fi.Size() == 0 {
+		return
+	}
+	var data []byte
+	if data, err = syscall.Mmap(int(f.Fd()), 0, int(fi.Size()), syscall.PROT_READ, syscall.MAP_SHARED); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	defer syscall.Munmap(data)
+	off := 0
+	for off+localRecordHeader <= len(data) {
+		keyLen := int(binary.LittleEndian.Uint32(data[off+4:]))
+		valLen := int(int32(binary.LittleEndian.Uint32(data[off+8:])))
+		end := off + localRecordHeader + keyLen
+		if valLen > 0 {
+			end += valLen
+		}
+		if valLen < -1 || end > len(data) || crc32.ChecksumIEEE(data[off+4:end]) != binary.LittleEndian.Uint32(data[off:]) {
+			break
+		}
+		key := string(data[off+localRecordHeader : off+localRecordHeader+keyLen])
+		if valLen < 0 {
+			delete(items, key)
+		} else {
+			// Copy out since data is unmapped on return.
+			items[key] = append([]byte{}, data[off+localRecordHeader+keyLen:end]...)
+		}
+		off = end
+	}
+	valid = int64(off)
+	return
+}
+
+func (ls *localStore) LoadAll() (items map[string][]byte, err error) {
+	items = make(map[string][]byte)
+	if _, err = replay(filepath.Join(ls.dir, localBaseFile), items); err != nil {
+		return
+	}
+	var valid int64
+	if valid, err = replay(filepath.Join(ls.dir, localLogFile), items); err != nil {
+		return
+	}
+	if valid != ls.logSize {
+		log.Infof("localStore %s dropping torn log tail, size %v, valid %v", ls.dir, ls.logSize, valid)
+		if err = ls.logFile.Truncate(valid); err != nil {
+			err = errors.Wrap(err, "")
+			return
+		}
+		ls.logSize = valid
+	}
+	return
+}
+
+func (ls *localStore) Apply(batch map[string][]byte) (err error) {
+	buf := make([]byte, 0, len(batch)*(localRecordHeader+64))
+	for xidS, vtB := range batch {
+		buf = appendRecord(buf, xidS, vtB)
+	}
+	_, err = ls.logFile.Write(buf)
+	if err == nil {
+		err = ls.logFile.Sync()
+	}
+	if err != nil {
+		// Drop whatever part of the batch has landed. Otherwise the torn record would hide batches appended after it from replay.
+		if errT := ls.logFile.Truncate(ls.logSize); errT != nil {
+			log.Errorf("localStore %s failed to truncate log to %v: %+v", ls.dir, ls.logSize, errT)
+		}
+		err = errors.Wrap(err, "")
+		return
+	}
+	ls.logSize += int64(len(buf))
+	if ls.logSize > localCompactMinBytes && ls.logSize > ls.baseSize {
+		err = ls.compact()
+	}
+	return
+}
+
+// compact rewrites base with all items and empties the log. Replaying the log again on top of the new base is harmless
+// if it crashes before the log is truncated.
+func (ls *localStore) compact() (err error) {
+	var items map[string][]byte
+	if items, err = ls.LoadAll(); err != nil {
+		return
+	}
+	buf := make([]byte, 0, ls.baseSize+ls.logSize)
+	for xidS, vtB := range items {
+		buf = appendRecord(buf, xidS, vtB)
+	}
+	if err = writeFileAtomic(ls.dir, localBaseFile, buf); err != nil {
+		return
+	}
+	if err = ls.logFile.Truncate(0); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	ls.baseSize = int64(len(buf))
+	ls.logSize = 0
+	return
+}
+
+func (ls *localStore) TakeSnapshot() (snap []byte, err error) {
+	fp := filepath.Join(ls.dir, localSnapFile)
+	snapItems := make(map[string][]byte)
+	if _, err = replay(fp, snapItems); err != nil {
+		return
+	}
+	snap = snapItems[localSnapFile]
+	if err = os.Remove(fp); err != nil && !os.IsNotExist(err) {
+		err = errors.Wrap(err, "")
+		return
+	}
+	err = nil
+	return
+}
+
+// PutSnapshot stores the snapshot as a single record, so that a torn snapshot is detected the same way as the log.
+func (ls *localStore) PutSnapshot(snap []byte) (err error) {
+	return writeFileAtomic(ls.dir, localSnapFile, appendRecord(nil, localSnapFile, snap))
+}
+
+// The generation is stored as a single record like the snapshot.
+func (ls *localStore) Generation() (gen int64, err error) {
+	genItems := make(map[string][]byte)
+	if _, err = replay(filepath.Join(ls.dir, localGenFile), genItems); err != nil {
+		return
+	}
+	if genB, ok := genItems[localGenFile]; ok && len(genB) == 8 {
+		gen = int64(binary.LittleEndian.Uint64(genB))
+	}
+	return
+}
+
+func (ls *localStore) BumpGeneration() (gen int64, err error) {
+	if gen, err = ls.Generation(); err != nil {
+		return
+	}
+	gen++
+	genB := make([]byte, 8)
+	binary.LittleEndian.PutUint64(genB, uint64(gen))
+	err = writeFileAtomic(ls.dir, localGenFile, appendRecord(nil, localGenFile, genB))
+	return
+}
+
+func (ls *localStore) Close() (err error) {
+	if err = ls.logFile.Close(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	return
+}
+
+// writeFileAtomic writes data to dir/name via a temporary file, fsync and rename.
+func writeFileAtomic(dir, name string, data []byte) (err error) {
+	tmp := filepath.Join(dir, name+".tmp")
+	var f *os.File
+	if f, err = os.OpenFile(tmp, os.O_CREATE|os.O_WRONLY|os.O_TRUNC, 0644); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	if _, err = f.Write(data); err != nil {
+		f.Close()
+		err = errors.Wrap(err, "")
+		return
+	}
+	if err = f.Sync(); err != nil {
+		f.Close()
+		err = errors.Wrap(err, "")
+		return
+	}
+	if err = f.Close(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	if err = os.Rename(tmp, filepath.Join(dir, name)); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	var d *os.File
+	if d, err = os.Open(dir); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	defer d.Close()
+	if err = d.Sync(); err != nil {
+		err = errors.Wrap(err, "")
+		return
+	}
+	return
+}
@@ -0,0 +1,646 @@
+package vectodb
+
+import (
+	"math"
+	"math/rand"
+	"os"
+	"runtime"
+	"sort"
+	"strconv"
+	"sync"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/pkg/errors"
+	"github.com/stretchr/testify/require"
+)
+
+const (
+	liteDir string = "/tmp/vectodblite_test_go"
+)
+
+func TestVectoDBLiteLocal(t *testing.T) {
+	const nb int = 100
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	vecs := randUnitVecs(nb)
+	xids := make([]uint64, nb)
+
+	// The first owner persists items through the log, and leaves a snapshot at Destroy.
+	// The second owner loads the snapshot, the third one falls back to the log.
+	for round := 0; round < 3; round++ {
+		vdbl := openLocalLite(t, 0, nb, VectoDBLiteOptions{})
+		if round == 0 {
+			var err error
+			for i := 0; i < nb; i++ {
+				xids[i], err = vdbl.Add(vecs[i])
+				require.NoError(t, err)
+			}
+		}
+		require.Equal(t, nb, vdbl.Size())
+		for i := 0; i < nb; i++ {
+			xid, distance, err := vdbl.Search(vecs[i])
+			require.NoError(t, err)
+			require.Equal(t, xids[i], xid)
+			require.InDelta(t, 1.0, distance, 1e-4)
+		}
+		if round == 1 {
+			// Stop without leaving a snapshot, as a crash of the second owner after the last flush would.
+			vdbl.cancel()
+			vdbl.wg.Wait()
+			require.NoError(t, vdbl.store.Close())
+			continue
+		}
+		require.NoError(t, vdbl.Destroy())
+	}
+}
+
+// Vectors are only kept by flatC or the slab, and the next owner finds them again. Refreshes leave the original vectors
+// at the store, and compressed storage leaves no snapshot of decoded vectors.
+func TestVectoDBLiteStorage(t *testing.T) {
+	const nb int = 100
+	vecs := randUnitVecs(nb)
+	slab := NewVectoDBSlab(dim)
+	defer slab.Destroy()
+	for _, tc := range []struct {
+		storage int
+		slab    *VectoDBSlab
+		delta   float64
+	}{{StorageFP32, nil, 0}, {StorageFP16, nil, 1e-3}, {StorageSQ8, nil, 1e-2}, {StorageFP32, slab, 0}} {
+		os.RemoveAll(liteDir)
+		xids := make([]uint64, nb)
+		for round := 0; round < 2; round++ {
+			vdbl := openLocalLite(t, 0, nb, VectoDBLiteOptions{Storage: tc.storage, Slab: tc.slab})
+			if round == 0 {
+				var err error
+				for i := 0; i < nb; i++ {
+					xids[i], err = vdbl.Add(vecs[i])
+					require.NoError(t, err)
+					// Move it to an earlier bucket, so that the search hit below writes the refreshed expireAt.
+					xidS := getXidKey(xids[i])
+					vtInf, ok := vdbl.lru.Peek(xidS)
+					require.True(t, ok)
+					vdbl.expiry.schedule(xidS, vtInf.(*VecTimestamp), time.Now().Unix()+ValidSeconds-2*ExpireBucketSeconds)
+				}
+			}
+			require.Equal(t, nb, vdbl.Size())
+			recXids := append([]uint64{1 << 62}, xids...)
+			rec := vdbl.reconstruct(recXids)
+			require.Equal(t, ^uint64(0), recXids[0])
+			for i := 0; i < nb; i++ {
+				require.Equal(t, xids[i], recXids[i+1])
+				for j := 0; j < dim; j++ {
+					require.InDelta(t, vecs[i][j], rec[(i+1)*dim+j], tc.delta+1e-7)
+				}
+				xid, _, err := vdbl.Search(vecs[i])
+				require.NoError(t, err)
+				require.Equal(t, xids[i], xid)
+			}
+			require.NoError(t, vdbl.Destroy())
+
+			store, err := NewLiteLocalStore(liteDir, 0)
+			require.NoError(t, err)
+			items, err := store.LoadAll()
+			require.NoError(t, err)
+			require.Equal(t, 2*nb, len(items))
+			for i := 0; i < nb; i++ {
+				vt := VecTimestamp{}
+				require.NoError(t, vt.Unmarshal(items[getXidKey(xids[i])]))
+				require.Equal(t, vecs[i], vt.Vec)
+				vt = VecTimestamp{}
+				require.NoError(t, vt.Unmarshal(items[getExpireKey(getXidKey(xids[i]))]))
+				require.Equal(t, 0, len(vt.Vec))
+				require.Greater(t, vt.ExpireAt, time.Now().Unix()+ValidSeconds-ExpireBucketSeconds)
+			}
+			if tc.storage != StorageFP32 {
+				snap, err := store.TakeSnapshot()
+				require.NoError(t, err)
+				require.True(t, snap == nil)
+			}
+			require.NoError(t, store.Close())
+		}
+	}
+	os.RemoveAll(liteDir)
+}
+
+// A snapshot left by an owner which has been followed by another owner is stale, and a corrupted one is discarded.
+func TestVectoDBLiteSnapshotGeneration(t *testing.T) {
+	const nb int = 10
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	vecs := randUnitVecs(nb)
+	open := func() *VectoDBLite {
+		return openLocalLite(t, 0, nb, VectoDBLiteOptions{})
+	}
+	// The first owner is taken over by the second one before it leaves its snapshot, e.g. after being purged as dead.
+	first := open()
+	for i := 0; i < nb/2; i++ {
+		_, err := first.Add(vecs[i])
+		require.NoError(t, err)
+	}
+	require.NoError(t, first.flush())
+	second := open()
+	require.Equal(t, nb/2, second.Size())
+	for i := nb / 2; i < nb; i++ {
+		_, err := second.Add(vecs[i])
+		require.NoError(t, err)
+	}
+	second.cancel()
+	second.wg.Wait()
+	require.NoError(t, second.flush())
+	require.NoError(t, second.store.Close())
+	require.NoError(t, first.Destroy())
+
+	third := open()
+	require.Equal(t, nb, third.Size())
+	require.NoError(t, third.store.PutSnapshot([]byte{1, 2, 3}))
+	third.cancel()
+	third.wg.Wait()
+	require.NoError(t, third.store.Close())
+
+	fourth := open()
+	require.Equal(t, nb, fourth.Size())
+	require.NoError(t, fourth.Destroy())
+	fifth := open()
+	require.Equal(t, nb, fifth.Size())
+	require.NoError(t, fifth.Destroy())
+}
+
+// failingStore fails Apply while failures is positive.
+type failingStore struct {
+	LiteStore
+	failures int
+}
+
+func (fs *failingStore) Apply(batch map[string][]byte) (err error) {
+	if fs.failures > 0 {
+		fs.failures--
+		return errors.New("injected failure")
+	}
+	return fs.LiteStore.Apply(batch)
+}
+
+func TestVectoDBLiteDestroyFlush(t *testing.T) {
+	const nb int = 10
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	vecs := randUnitVecs(nb)
+	xids := make([]uint64, nb)
+	local, err := NewLiteLocalStore(liteDir, 0)
+	require.NoError(t, err)
+	store := &failingStore{LiteStore: local, failures: 1 << 30}
+	vdbl, err := NewVectoDBLiteWithOptions("", 0, dim, 0.9, nb, VectoDBLiteOptions{Store: store})
+	require.NoError(t, err)
+	for i := 0; i < nb; i++ {
+		xids[i], err = vdbl.Add(vecs[i])
+		require.NoError(t, err)
+	}
+
+	// The store keeps failing, the db keeps serving.
+	require.Error(t, vdbl.Destroy())
+	xid, _, err := vdbl.Search(vecs[0])
+	require.NoError(t, err)
+	require.Equal(t, xids[0], xid)
+
+	// A transient failure is retried. The restarted flusher is stopped first, so that it doesn't consume the failures.
+	vdbl.cancel()
+	vdbl.wg.Wait()
+	store.failures = FinalFlushAttempts - 1
+	require.NoError(t, vdbl.Destroy())
+	require.Equal(t, 0, store.failures)
+
+	// Items are in the store even without the snapshot.
+	local, err = NewLiteLocalStore(liteDir, 0)
+	require.NoError(t, err)
+	_, err = local.TakeSnapshot()
+	require.NoError(t, err)
+	items, err := local.LoadAll()
+	require.NoError(t, err)
+	require.Len(t, items, nb)
+	require.NoError(t, local.Close())
+}
+
+// A batch which fails to be written shall not leave a torn record, which would hide later batches from replay.
+func TestLiteLocalStoreFailedApply(t *testing.T) {
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	ls, err := newLocalStore(liteDir)
+	require.NoError(t, err)
+	require.NoError(t, ls.Apply(map[string][]byte{"a": []byte("1")}))
+	size := ls.logSize
+
+	// The file size limit cuts the write of the batch in the middle. SIGXFSZ is ignored by the Go runtime.
+	var rlim syscall.Rlimit
+	require.NoError(t, syscall.Getrlimit(syscall.RLIMIT_FSIZE, &rlim))
+	limited := rlim
+	limited.Cur = uint64(size + 10)
+	require.NoError(t, syscall.Setrlimit(syscall.RLIMIT_FSIZE, &limited))
+	err = ls.Apply(map[string][]byte{"b": make([]byte, 100)})
+	require.NoError(t, syscall.Setrlimit(syscall.RLIMIT_FSIZE, &rlim))
+	require.Error(t, err)
+	fi, err := os.Stat(liteDir + "/" + localLogFile)
+	require.NoError(t, err)
+	require.Equal(t, size, fi.Size())
+
+	require.NoError(t, ls.Apply(map[string][]byte{"c": []byte("3")}))
+	require.NoError(t, ls.Close())
+	ls, err = newLocalStore(liteDir)
+	require.NoError(t, err)
+	items, err := ls.LoadAll()
+	require.NoError(t, err)
+	require.Equal(t, map[string][]byte{"a": []byte("1"), "c": []byte("3")}, items)
+	require.NoError(t, ls.Close())
+}
+
+func TestExpiryBuckets(t *testing.T) {
+	eb := newExpiryBuckets()
+	now := int64(1000) * ExpireBucketSeconds
+	vts := make([]VecTimestamp, 3)
+	eb.schedule("a", &vts[0], now-2*ExpireBucketSeconds)
+	eb.schedule("b", &vts[1], now-ExpireBucketSeconds+1)
+	eb.schedule("c", &vts[2], now+1)
+
+	// Refreshing within the same bucket needs no store write, moving to a later bucket does.
+	require.False(t, eb.refresh("c", &vts[2], now+2))
+	require.Equal(t, now+2, vts[2].ExpireAt)
+	require.True(t, eb.refresh("b", &vts[1], now+ExpireBucketSeconds))
+	require.False(t, eb.refresh("d", &VecTimestamp{}, now))
+
+	require.Equal(t, []string{"a"}, eb.popExpired(now, SweepBatchSize))
+	require.Empty(t, eb.popExpired(now, SweepBatchSize))
+	require.Equal(t, 2, eb.Len())
+	eb.remove("c")
+	require.Equal(t, []string{"b"}, eb.popExpired(now+2*ExpireBucketSeconds, 1))
+	require.Equal(t, 0, eb.Len())
+}
+
+// Compares slab searches with brute force while tenants grow over several chunks, remove rows across chunks,
+// and reuse chunks freed by other tenants.
+func TestVectoDBSlab(t *testing.T) {
+	const nt, nb, nq int = 3, 200, 20
+	slab := NewVectoDBSlab(dim)
+	defer slab.Destroy()
+	refs := make([]map[uint64][]float32, nt)
+	addRandom := func(tenant int, n int) {
+		xb := make([]float32, 0, n*dim)
+		xids := make([]uint64, n)
+		for i := 0; i < n; i++ {
+			v := randUnitVec()
+			xids[i] = rand.Uint64() >> 1
+			xb = append(xb, v...)
+			refs[tenant][xids[i]] = v
+		}
+		slab.add(tenant, xb, xids)
+	}
+	check := func() {
+		tenants := make([]int, 0, nt*nq+1)
+		xq := make([]float32, 0, (nt*nq+1)*dim)
+		for tenant := 0; tenant < nt; tenant++ {
+			require.Equal(t, len(refs[tenant]), slab.Size(tenant))
+			for i := 0; i < nq; i++ {
+				tenants = append(tenants, tenant)
+				xq = append(xq, randUnitVec()...)
+			}
+		}
+		tenants = append(tenants, nt)
+		xq = append(xq, randUnitVec()...)
+		xids, distances, err := slab.Search(tenants, xq)
+		require.NoError(t, err)
+		for i, tenant := range tenants {
+			q := xq[i*dim : (i+1)*dim]
+			bestXid, bestDist := ^uint64(0), float32(-math.MaxFloat32)
+			for xid, v := range refs[tenant] {
+				var d float32
+				for j := 0; j < dim; j++ {
+					d += q[j] * v[j]
+				}
+				if d > bestDist {
+					bestXid, bestDist = xid, d
+				}
+			}
+			require.Equal(t, bestXid, xids[i])
+			if bestXid != ^uint64(0) {
+				require.InDelta(t, bestDist, distances[i], 1e-4)
+			}
+		}
+	}
+
+	for tenant := 0; tenant < nt; tenant++ {
+		refs[tenant] = make(map[uint64][]float32)
+		addRandom(tenant, nb)
+	}
+	refs = append(refs, map[uint64][]float32{})
+	check()
+
+	// Overwrite some vectors in place, then remove rows from the first chunks so that rows of the last chunk
+	// are swapped into them, and the last chunks are freed.
+	for xid := range refs[0] {
+		v := randUnitVec()
+		refs[0][xid] = v
+		slab.add(0, v, []uint64{xid})
+		break
+	}
+	for tenant := 0; tenant < nt; tenant++ {
+		removed := 0
+		for xid := range refs[tenant] {
+			if removed == nb/2 {
+				break
+			}
+			slab.remove(tenant, xid)
+			delete(refs[tenant], xid)
+			removed++
+		}
+	}
+	slab.remove(1, 1<<62)
+	check()
+
+	// Chunks freed by the removed tenant are reused by the others.
+	slab.removeTenant(1)
+	refs[1] = make(map[uint64][]float32)
+	addRandom(0, nb)
+	addRandom(2, nb/3)
+	check()
+	addRandom(1, nb/4)
+	check()
+}
+
+// closeCountingStore counts calls of Close.
+type closeCountingStore struct {
+	LiteStore
+	closed int
+}
+
+func (cs *closeCountingStore) Close() error {
+	cs.closed++
+	return cs.LiteStore.Close()
+}
+
+// A failed NewVectoDBLiteWithOptions closes the given store, whatever the failure.
+func TestVectoDBLiteNewFailure(t *testing.T) {
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	slab := NewVectoDBSlab(dim + 1)
+	defer slab.Destroy()
+	for _, tc := range []struct {
+		sizeLimit int
+		opts      VectoDBLiteOptions
+	}{{10, VectoDBLiteOptions{Slab: slab}}, {10, VectoDBLiteOptions{Storage: StorageSQ8 + 1}}, {0, VectoDBLiteOptions{}}} {
+		local, err := NewLiteLocalStore(liteDir, 0)
+		require.NoError(t, err)
+		store := &closeCountingStore{LiteStore: local}
+		tc.opts.Store = store
+		vdbl, err := NewVectoDBLiteWithOptions("", 0, dim, 0.9, tc.sizeLimit, tc.opts)
+		require.Error(t, err)
+		require.True(t, vdbl == nil)
+		require.Equal(t, 1, store.closed)
+	}
+}
+
+// The binary prefilter shall not change results of SearchRange, even for vectors just around the threshold.
+func TestVectoDBLitePrefilter(t *testing.T) {
+	const nb, nq int = 2000, 20
+	const distThr float32 = 0.9
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	// Each vector is at an inner product in [distThr-0.05, distThr+0.05] with one of the queries.
+	xq := randUnitVecs(nq)
+	vecs := make([][]float32, nb)
+	for i := 0; i < nb; i++ {
+		q := xq[i%nq]
+		u := randUnitVec()
+		var dot float32
+		for j := 0; j < dim; j++ {
+			dot += u[j] * q[j]
+		}
+		for j := 0; j < dim; j++ {
+			u[j] -= dot * q[j]
+		}
+		normalizeInplace(dim, u)
+		c := float64(distThr) + 0.1*(rand.Float64()-0.5)
+		s := math.Sqrt(1 - c*c)
+		vecs[i] = make([]float32, dim)
+		for j := 0; j < dim; j++ {
+			vecs[i][j] = float32(c)*q[j] + float32(s)*u[j]
+		}
+		normalizeInplace(dim, vecs[i])
+	}
+	for _, storage := range []int{StorageFP32, StorageSQ8} {
+		vdbls := make([]*VectoDBLite, 2)
+		for i, prefilter := range []bool{false, true} {
+			vdbls[i] = openLocalLite(t, i, nb, VectoDBLiteOptions{Storage: storage, Prefilter: prefilter})
+			for j := 0; j < nb; j++ {
+				require.NoError(t, vdbls[i].AddWithId(vecs[j], uint64(j)))
+			}
+		}
+		for i := 0; i < nq; i++ {
+			exactXids, exactDistances, err := vdbls[0].SearchRange(xq[i], distThr, nb)
+			require.NoError(t, err)
+			xids, distances, err := vdbls[1].SearchRange(xq[i], distThr, nb)
+			require.NoError(t, err)
+			require.NotEqual(t, 0, len(exactXids))
+			require.Equal(t, exactXids, xids)
+			require.Equal(t, exactDistances, distances)
+		}
+		for _, vdbl := range vdbls {
+			require.NoError(t, vdbl.Destroy())
+		}
+		os.RemoveAll(liteDir)
+	}
+}
+
+// SearchK and SearchRange agree with a brute force over the vectors left after eviction.
+func TestVectoDBLiteSearchK(t *testing.T) {
+	const nb, sizeLimit, nq int = 300, 200, 20
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	vecs := randUnitVecs(nb)
+	vdbl := openLocalLite(t, 0, sizeLimit, VectoDBLiteOptions{})
+	for i := 0; i < nb; i++ {
+		require.NoError(t, vdbl.AddWithId(vecs[i], uint64(i)))
+	}
+	// The first nb-sizeLimit items are evicted.
+	require.Equal(t, sizeLimit, vdbl.Size())
+	require.Equal(t, sizeLimit, vdbl.indexSize())
+	for i := 0; i < nb; i++ {
+		xid, _, err := vdbl.Search(vecs[i])
+		require.NoError(t, err)
+		if i < nb-sizeLimit {
+			require.Equal(t, ^uint64(0), xid)
+		} else {
+			require.Equal(t, uint64(i), xid)
+		}
+	}
+
+	dot := func(a, b []float32) (d float32) {
+		for j := range a {
+			d += a[j] * b[j]
+		}
+		return
+	}
+	for _, q := range randUnitVecs(nq) {
+		exact := make([]float32, 0, sizeLimit)
+		for i := nb - sizeLimit; i < nb; i++ {
+			exact = append(exact, dot(q, vecs[i]))
+		}
+		sort.Slice(exact, func(i, j int) bool { return exact[i] > exact[j] })
+
+		// k exceeds ntotal, so all live items are returned.
+		xids, distances, err := vdbl.SearchK(q, nb)
+		require.NoError(t, err)
+		require.Len(t, xids, sizeLimit)
+		require.Len(t, distances, sizeLimit)
+		for i, xid := range xids {
+			require.GreaterOrEqual(t, int(xid), nb-sizeLimit)
+			require.InDelta(t, dot(q, vecs[xid]), distances[i], 1e-5)
+			require.InDelta(t, exact[i], distances[i], 1e-5)
+			if i > 0 {
+				require.LessOrEqual(t, distances[i], distances[i-1])
+			}
+		}
+		topXids, topDistances, err := vdbl.SearchK(q, 10)
+		require.NoError(t, err)
+		require.Equal(t, xids[:10], topXids)
+		require.Equal(t, distances[:10], topDistances)
+
+		// The threshold is exclusive: the item scored exactly distThr is left out.
+		rangeXids, rangeDistances, err := vdbl.SearchRange(q, distances[4], nb)
+		require.NoError(t, err)
+		require.Equal(t, xids[:4], rangeXids)
+		require.Equal(t, distances[:4], rangeDistances)
+		// k caps the number of results.
+		rangeXids, rangeDistances, err = vdbl.SearchRange(q, distances[20], 3)
+		require.NoError(t, err)
+		require.Equal(t, xids[:3], rangeXids)
+		require.Equal(t, distances[:3], rangeDistances)
+		rangeXids, _, err = vdbl.SearchRange(q, distances[0], nb)
+		require.NoError(t, err)
+		require.Empty(t, rangeXids)
+		// k=1 goes through the argmax kernel, whose rounding may differ from the full scan.
+		rangeXids, rangeDistances, err = vdbl.SearchRange(q, distances[1], 1)
+		require.NoError(t, err)
+		require.Equal(t, xids[:1], rangeXids)
+		require.InDelta(t, distances[0], rangeDistances[0], 1e-5)
+		rangeXids, _, err = vdbl.SearchRange(q, rangeDistances[0], 1)
+		require.NoError(t, err)
+		require.Empty(t, rangeXids)
+	}
+	require.NoError(t, vdbl.Destroy())
+}
+
+// Items re-added while sweep removes expired ones shall survive the sweep.
+func TestVectoDBLiteSweepRace(t *testing.T) {
+	const nb int = 2000
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	vdbl := openLocalLite(t, 0, nb, VectoDBLiteOptions{})
+	vecs := randUnitVecs(nb)
+	now := time.Now().Unix()
+	for i := 0; i < nb; i++ {
+		require.NoError(t, vdbl.AddWithId(vecs[i], uint64(i)))
+		xidS := getXidKey(uint64(i))
+		vtInf, ok := vdbl.lru.Peek(xidS)
+		require.True(t, ok)
+		vdbl.expiry.schedule(xidS, vtInf.(*VecTimestamp), now-2*ExpireBucketSeconds)
+	}
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		for i := nb - 1; i >= 0; i-- {
+			if err := vdbl.AddWithId(vecs[i], uint64(i)); err != nil {
+				t.Errorf("%+v", err)
+				return
+			}
+		}
+	}()
+	for swept := -1; swept != 0; {
+		swept = vdbl.sweep(now)
+	}
+	<-done
+	for vdbl.sweep(now) != 0 {
+	}
+	// Every item has been re-added either before it was popped, or after it was swept.
+	require.Equal(t, nb, vdbl.Size())
+	require.Equal(t, nb, vdbl.expiry.Len())
+	require.NoError(t, vdbl.Destroy())
+}
+
+// TestVectoDBLiteEvictionRace adds concurrently beyond sizeLimit, an item evicted right after its lru insert shall not
+// leave its vector behind at flatC or slab.
+func TestVectoDBLiteEvictionRace(t *testing.T) {
+	const sizeLimit, ng, nb int = 100, 4, 1000
+	// More threads than cores make preemption inside AddWithId likely.
+	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(8))
+	os.RemoveAll(liteDir)
+	defer os.RemoveAll(liteDir)
+	slab := NewVectoDBSlab(dim)
+	defer slab.Destroy()
+	for _, opts := range []VectoDBLiteOptions{{}, {Slab: slab}} {
+		vdbl := openLocalLite(t, 0, sizeLimit, opts)
+		vecs := randUnitVecs(ng * nb)
+		var wg sync.WaitGroup
+		for g := 0; g < ng; g++ {
+			wg.Add(1)
+			go func(g int) {
+				defer wg.Done()
+				for i := g * nb; i < (g+1)*nb; i++ {
+					if err := vdbl.AddWithId(vecs[i], uint64(i)); err != nil {
+						t.Errorf("%+v", err)
+						return
+					}
+				}
+			}(g)
+		}
+		wg.Wait()
+		require.Equal(t, sizeLimit, vdbl.Size())
+		require.Equal(t, sizeLimit, vdbl.indexSize())
+		keys := vdbl.lru.Keys()
+		for _, xidInf := range keys {
+			xid, err := strconv.ParseUint(xidInf.(string), 16, 64)
+			require.NoError(t, err)
+			found, _, err := vdbl.Search(vecs[xid])
+			require.NoError(t, err)
+			require.Equal(t, xid, found)
+		}
+		require.NoError(t, vdbl.Destroy())
+		// The write of an item is not queued after the removal of its eviction.
+		store, err := NewLiteLocalStore(liteDir, 0)
+		require.NoError(t, err)
+		items, err := store.LoadAll()
+		require.NoError(t, err)
+		require.Equal(t, len(keys), len(items))
+		for _, xidInf := range keys {
+			_, ok := items[xidInf.(string)]
+			require.True(t, ok)
+		}
+		require.NoError(t, store.Close())
+		os.RemoveAll(liteDir)
+	}
+}
+
+// openLocalLite opens db dbID at liteDir with a local store and distThreshold 0.9.
+func openLocalLite(t *testing.T, dbID int, sizeLimit int, opts VectoDBLiteOptions) *VectoDBLite {
+	store, err := NewLiteLocalStore(liteDir, dbID)
+	require.NoError(t, err)
+	opts.Store = store
+	vdbl, err := NewVectoDBLiteWithOptions("", dbID, dim, 0.9, sizeLimit, opts)
+	require.NoError(t, err)
+	return vdbl
+}
+
+func randUnitVec() []float32 {
+	v := make([]float32, dim)
+	for j := 0; j < dim; j++ {
+		v[j] = rand.Float32() - 0.5
+	}
+	normalizeInplace(dim, v)
+	return v
+}
+
+func randUnitVecs(n int) [][]float32 {
+	vecs := make([][]float32, n)
+	for i := 0; i < n; i++ {
+		vecs[i] = randUnitVec()
+	}
+	return vecs
+}
@@ -0,0 +1,80 @@
+package vectodb
+
+// #include "index_flat_wrapper.h"
+import "C"
+
+import (
+	"unsafe"
+
+	"github.com/pkg/errors"
+)
+
+// VectoDBSlab is a flat index shared by many VectoDBLite of the same dim. Each VectoDBLite is a tenant identified by its dbID,
+// and its vectors live in tenant-contiguous chunks of one arena. Only supports metric type 0 - METRIC_INNER_PRODUCT.
+type VectoDBSlab struct {
+	dim   int
+	slabC unsafe.Pointer
+}
+
+func NewVectoDBSlab(dim int) (slab *VectoDBSlab) {
+	slab = &VectoDBSlab{
+		dim:   dim,
+		slabC: C.IndexSlabNew(C.long(dim)),
+	}
+	return
+}
+
+// Destroy shall be called after all tenants are destroyed.
+func (slab *VectoDBSlab) Destroy() {
+	C.IndexSlabDelete(slab.slabC)
+	slab.slabC = nil
+}
+
+func (slab *VectoDBSlab) add(tenant int, xb []float32, xids []uint64) {
+	if len(xids) == 0 {
+		return
+	}
+	C.IndexSlabAddWithIds(slab.slabC, C.long(tenant), C.long(len(xids)), (*C.float)(&xb[0]), (*C.ulong)(&xids[0]))
+}
+
+func (slab *VectoDBSlab) remove(tenant int, xid uint64) {
+	C.IndexSlabRemoveIds(slab.slabC, C.long(tenant), C.long(1), (*C.ulong)(&xid))
+}
+
+func (slab *VectoDBSlab) removeTenant(tenant int) {
+	C.IndexSlabRemoveTenant(slab.slabC, C.long(tenant))
+}
+
+// reconstruct copies vectors of xids of the given tenant to vecs. xids of absent vectors are set to ^uint64(0).
+func (slab *VectoDBSlab) reconstruct(tenant int, xids []uint64, vecs []float32) {
+	if len(xids) == 0 {
+		return
+	}
+	C.IndexSlabReconstruct(slab.slabC, C.long(tenant), C.long(len(xids)), (*C.ulong)(&xids[0]), (*C.float)(&vecs[0]))
+}
+
+// Size returns the number of vectors of the given tenant.
+func (slab *VectoDBSlab) Size(tenant int) int {
+	return int(C.IndexSlabNtotal(slab.slabC, C.long(tenant)))
+}
+
+// Search searches the nearest vector of xq[i*dim:(i+1)*dim] among vectors of tenants[i] in one call.
+// xids[i] is ^uint64(0) if tenants[i] has no vector. It doesn't refresh expiry of the results.
+func (slab *VectoDBSlab) Search(tenants []int, xq []float32) (xids []uint64, distances []float32, err error) {
+	nq := len(tenants)
+	if len(xq) != nq*slab.dim {
+		err = errors.Errorf("invalid length of xq, want %v, have %v", nq*slab.dim, len(xq))
+		return
+	}
+	if nq == 0 {
+		return
+	}
+	tenantsC := make([]int64, nq)
+	for i, tenant := range tenants {
+		tenantsC[i] = int64(tenant)
+	}
+	xids = make([]uint64, nq)
+	distances = make([]float32, nq)
+	C.IndexSlabSearch(slab.slabC, C.long(nq), (*C.long)(&tenantsC[0]), (*C.float)(&xq[0]), (*C.float)(&distances[0]), (*C.ulong)(&xids[0]))
+	return
+}